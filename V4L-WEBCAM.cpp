@@ -1,23 +1,268 @@
 #include <gtk/gtk.h>
 #include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
 #include <gst/video/videooverlay.h>
 #include <gdk/gdkx.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <linux/videodev2.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _DecodePool DecodePool;
 
 typedef struct {
     GtkWidget *main_window;
     GtkWidget *video_widget;
     int fd; // File descriptor for the V4L2 device
+    const char *device_path;
+    DecodePool *decode_pool;
+    GstElement *pipeline;
+    GstElement *display_src;
 } AppData;
 
 #define WIDTH 640
 #define HEIGHT 480
 
+// Frames queued or being decoded before the oldest one is dropped
+#define DECODE_MAX_IN_FLIGHT 8
+
+/*
+ * Parallel MJPEG decode stage.
+ *
+ * Every JPEG frame is independent, so frames are handed to a pool of worker
+ * threads, each owning its own jpegdec.  Decoded frames are released strictly
+ * in capture (timestamp) order.  At most max_in_flight frames are queued or
+ * decoding; when the camera outpaces the pool the oldest frame is dropped so
+ * the display never falls behind.
+ */
+typedef void (*DecodeOutputFunc)(GstSample *sample, gpointer user_data);
+
+typedef struct {
+    GstBuffer *jpeg;
+    GstSample *decoded;
+    gboolean started;
+    gboolean done;
+    gboolean dropped;
+} DecodeJob;
+
+struct _DecodePool {
+    GMutex lock;
+    GCond cond;
+    GQueue pending;  // jobs waiting for a worker, oldest first
+    GQueue in_order; // every live job in capture order, for re-ordering
+    GThread **workers;
+    guint n_workers;
+    guint max_in_flight;
+    gboolean stopping;
+    GstCaps *caps;
+    DecodeOutputFunc output;
+    gpointer output_data;
+    guint64 decoded;
+    guint64 dropped;
+};
+
+static void decode_job_free(DecodeJob *job) {
+    gst_buffer_unref(job->jpeg);
+    if (job->decoded)
+        gst_sample_unref(job->decoded);
+    g_free(job);
+}
+
+// Releases finished jobs at the head of the capture order.  Called with the
+// lock held, so output stays ordered even when several workers finish at once.
+static void decode_pool_flush_locked(DecodePool *pool) {
+    DecodeJob *job;
+
+    while ((job = (DecodeJob *)g_queue_peek_head(&pool->in_order)) && job->done) {
+        g_queue_pop_head(&pool->in_order);
+        if (job->decoded) {
+            pool->output(job->decoded, pool->output_data);
+            pool->decoded++;
+        }
+        decode_job_free(job);
+    }
+    g_cond_broadcast(&pool->cond);
+}
+
+// Empties a worker pipeline's bus, which has no main loop watching it.
+// Returns TRUE if an error was posted.
+static gboolean decode_worker_bus_error(GstBus *bus) {
+    GstMessage *message;
+    gboolean error = FALSE;
+
+    while ((message = gst_bus_pop(bus))) {
+        if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+            GError *err;
+            gst_message_parse_error(message, &err, NULL);
+            g_printerr("JPEG decode error: %s\n", err->message);
+            g_clear_error(&err);
+            error = TRUE;
+        }
+        gst_message_unref(message);
+    }
+    return error;
+}
+
+// Decodes one frame on a worker's pipeline.  Output is matched to the input
+// by timestamp, so a frame left over from an earlier job is never taken for
+// this one.  On an error or a timeout the pipeline is reset, which discards
+// whatever it still holds.
+static GstSample *decode_worker_decode(GstElement *pipeline, GstElement *in, GstElement *out, GstBus *bus,
+                                       GstBuffer *jpeg) {
+    GstClockTime pts = GST_BUFFER_PTS(jpeg);
+    gint64 deadline = g_get_monotonic_time() + G_USEC_PER_SEC;
+
+    gst_app_src_push_buffer(GST_APP_SRC(in), gst_buffer_ref(jpeg));
+    while (g_get_monotonic_time() < deadline && !decode_worker_bus_error(bus)) {
+        GstSample *sample = gst_app_sink_try_pull_sample(GST_APP_SINK(out), 10 * GST_MSECOND);
+        if (!sample)
+            continue;
+        GstClockTime decoded_pts = GST_BUFFER_PTS(gst_sample_get_buffer(sample));
+        if (!GST_CLOCK_TIME_IS_VALID(pts) || decoded_pts == pts)
+            return sample;
+        gst_sample_unref(sample);
+    }
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    return NULL;
+}
+
+static gpointer decode_worker(gpointer data) {
+    DecodePool *pool = (DecodePool *)data;
+    GstElement *pipeline = gst_parse_launch("appsrc name=in format=time ! jpegdec ! appsink name=out sync=false", NULL);
+    GstElement *in = gst_bin_get_by_name(GST_BIN(pipeline), "in");
+    GstElement *out = gst_bin_get_by_name(GST_BIN(pipeline), "out");
+    GstBus *bus = gst_element_get_bus(pipeline);
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    g_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stopping && g_queue_is_empty(&pool->pending))
+            g_cond_wait(&pool->cond, &pool->lock);
+        if (pool->stopping)
+            break;
+        DecodeJob *job = (DecodeJob *)g_queue_pop_head(&pool->pending);
+        job->started = TRUE;
+        GstCaps *caps = pool->caps ? gst_caps_ref(pool->caps) : NULL;
+        g_mutex_unlock(&pool->lock);
+
+        if (caps) {
+            gst_app_src_set_caps(GST_APP_SRC(in), caps);
+            gst_caps_unref(caps);
+        }
+        GstSample *sample = decode_worker_decode(pipeline, in, out, bus, job->jpeg);
+
+        g_mutex_lock(&pool->lock);
+        if (job->dropped) {
+            // Overtaken by the drop-oldest policy while decoding
+            if (sample)
+                gst_sample_unref(sample);
+            decode_job_free(job);
+            continue;
+        }
+        job->decoded = sample;
+        job->done = TRUE;
+        decode_pool_flush_locked(pool);
+    }
+    g_mutex_unlock(&pool->lock);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(in);
+    gst_object_unref(out);
+    gst_object_unref(pipeline);
+    return NULL;
+}
+
+static DecodePool *decode_pool_new(guint n_workers, guint max_in_flight, DecodeOutputFunc output, gpointer output_data) {
+    DecodePool *pool = g_new0(DecodePool, 1);
+
+    g_mutex_init(&pool->lock);
+    g_cond_init(&pool->cond);
+    g_queue_init(&pool->pending);
+    g_queue_init(&pool->in_order);
+    pool->n_workers = n_workers;
+    pool->max_in_flight = MAX(max_in_flight, n_workers);
+    pool->output = output;
+    pool->output_data = output_data;
+    pool->workers = g_new0(GThread *, n_workers);
+    for (guint i = 0; i < n_workers; i++)
+        pool->workers[i] = g_thread_new("jpeg-decode", decode_worker, pool);
+    return pool;
+}
+
+// Queues one JPEG frame.  Never blocks: when max_in_flight frames are already
+// queued or decoding, the oldest one is dropped to make room.
+static void decode_pool_push(DecodePool *pool, GstSample *sample) {
+    DecodeJob *job = g_new0(DecodeJob, 1);
+
+    job->jpeg = gst_buffer_ref(gst_sample_get_buffer(sample));
+
+    g_mutex_lock(&pool->lock);
+    GstCaps *caps = gst_sample_get_caps(sample);
+    if (caps && (!pool->caps || !gst_caps_is_equal(caps, pool->caps)))
+        gst_caps_replace(&pool->caps, caps);
+
+    if (g_queue_get_length(&pool->in_order) >= pool->max_in_flight) {
+        DecodeJob *oldest = (DecodeJob *)g_queue_pop_head(&pool->in_order);
+        pool->dropped++;
+        if (!oldest->started) {
+            g_queue_remove(&pool->pending, oldest);
+            decode_job_free(oldest);
+        } else if (oldest->done) {
+            decode_job_free(oldest);
+        } else {
+            oldest->dropped = TRUE; // the worker frees it when done
+        }
+        decode_pool_flush_locked(pool);
+    }
+    g_queue_push_tail(&pool->in_order, job);
+    g_queue_push_tail(&pool->pending, job);
+    g_cond_broadcast(&pool->cond);
+    g_mutex_unlock(&pool->lock);
+}
+
+// Waits until a frame can be queued without dropping one (benchmark only).
+static void decode_pool_wait_for_slot(DecodePool *pool) {
+    g_mutex_lock(&pool->lock);
+    while (g_queue_get_length(&pool->in_order) >= pool->max_in_flight)
+        g_cond_wait(&pool->cond, &pool->lock);
+    g_mutex_unlock(&pool->lock);
+}
+
+// Waits until every queued frame has been output.
+static void decode_pool_drain(DecodePool *pool) {
+    g_mutex_lock(&pool->lock);
+    while (!g_queue_is_empty(&pool->in_order))
+        g_cond_wait(&pool->cond, &pool->lock);
+    g_mutex_unlock(&pool->lock);
+}
+
+static void decode_pool_free(DecodePool *pool) {
+    g_mutex_lock(&pool->lock);
+    pool->stopping = TRUE;
+    g_cond_broadcast(&pool->cond);
+    g_mutex_unlock(&pool->lock);
+    for (guint i = 0; i < pool->n_workers; i++)
+        g_thread_join(pool->workers[i]);
+
+    g_queue_foreach(&pool->in_order, (GFunc)decode_job_free, NULL);
+    g_queue_clear(&pool->in_order);
+    g_queue_clear(&pool->pending);
+    if (pool->caps)
+        gst_caps_unref(pool->caps);
+    g_free(pool->workers);
+    g_mutex_clear(&pool->lock);
+    g_cond_clear(&pool->cond);
+    g_free(pool);
+}
+
 static void initialize_v4l2_device(AppData *app_data) {
-    const char *device_path = "/dev/video0";
+    const char *device_path = app_data->device_path;
 
     app_data->fd = open(device_path, O_RDWR | O_NONBLOCK, 0);
     if (app_data->fd == -1) {
@@ -75,8 +320,25 @@ static void setup_gui(AppData *app_data) {
     gtk_widget_show_all(app_data->main_window);
 }
 
+static GstFlowReturn on_jpeg_sample(GstAppSink *sink, gpointer data) {
+    AppData *app_data = (AppData *)data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+
+    if (sample) {
+        decode_pool_push(app_data->decode_pool, sample);
+        gst_sample_unref(sample);
+    }
+    return GST_FLOW_OK;
+}
+
+static void on_decoded_sample(GstSample *sample, gpointer data) {
+    AppData *app_data = (AppData *)data;
+
+    gst_app_src_push_sample(GST_APP_SRC(app_data->display_src), sample);
+}
+
 static void start_pipeline(AppData *app_data) {
-    GstElement *pipeline, *v4l2src, *jpegdec, *gtksink;
+    GstElement *pipeline, *v4l2src, *jpegsink, *displaysrc, *videoconvert, *gtksink;
     GstBus *bus;
 
     // Initialize GStreamer
@@ -91,12 +353,16 @@ static void start_pipeline(AppData *app_data) {
         return;
     }
 
+    // The capture and display halves are joined through the decode pool:
+    // v4l2src ! appsink -> decode workers -> appsrc ! videoconvert ! gtksink
     pipeline = gst_pipeline_new("v4l2_pipeline");
     v4l2src = gst_element_factory_make("v4l2src", "v4l2src");
-    jpegdec = gst_element_factory_make("jpegdec", "jpegdec");
+    jpegsink = gst_element_factory_make("appsink", "jpegsink");
+    displaysrc = gst_element_factory_make("appsrc", "displaysrc");
+    videoconvert = gst_element_factory_make("videoconvert", "videoconvert");
     gtksink = gst_element_factory_make("gtksink", "gtksink");
 
-    if (!pipeline || !v4l2src || !jpegdec || !gtksink) {
+    if (!pipeline || !v4l2src || !jpegsink || !displaysrc || !videoconvert || !gtksink) {
         g_error("Failed to create GStreamer elements.");
         return;
     }
@@ -107,10 +373,25 @@ static void start_pipeline(AppData *app_data) {
         return;
     }
 
-    g_object_set(G_OBJECT(v4l2src), "device", app_data->fd, NULL);
-
-    gst_bin_add_many(GST_BIN(pipeline), v4l2src, jpegdec, gtksink, NULL);
-    if (!gst_element_link_many(v4l2src, jpegdec, gtksink, NULL)) {
+    g_object_set(G_OBJECT(v4l2src), "device", app_data->device_path, NULL);
+
+    GstCaps *jpeg_caps = gst_caps_new_simple("image/jpeg", "width", G_TYPE_INT, WIDTH, "height", G_TYPE_INT, HEIGHT, NULL);
+    GstAppSinkCallbacks callbacks = {};
+    callbacks.new_sample = on_jpeg_sample;
+    gst_app_sink_set_caps(GST_APP_SINK(jpegsink), jpeg_caps);
+    gst_app_sink_set_callbacks(GST_APP_SINK(jpegsink), &callbacks, app_data, NULL);
+    g_object_set(G_OBJECT(jpegsink), "sync", FALSE, NULL);
+    gst_caps_unref(jpeg_caps);
+
+    // Decoding adds latency on top of the capture timestamps, so the display
+    // shows frames as soon as they are ready instead of syncing to the clock.
+    g_object_set(G_OBJECT(displaysrc), "format", GST_FORMAT_TIME, "is-live", TRUE, "block", FALSE, NULL);
+    g_object_set(G_OBJECT(gtksink), "sync", FALSE, NULL);
+    app_data->display_src = displaysrc;
+    app_data->decode_pool = decode_pool_new(g_get_num_processors(), DECODE_MAX_IN_FLIGHT, on_decoded_sample, app_data);
+
+    gst_bin_add_many(GST_BIN(pipeline), v4l2src, jpegsink, displaysrc, videoconvert, gtksink, NULL);
+    if (!gst_element_link(v4l2src, jpegsink) || !gst_element_link_many(displaysrc, videoconvert, gtksink, NULL)) {
         g_error("Failed to link GStreamer elements.");
         gst_object_unref(pipeline);
         return;
@@ -132,11 +413,83 @@ static void start_pipeline(AppData *app_data) {
         g_warning("The gtksink element does not support the video overlay interface.");
     }
 
+    app_data->pipeline = pipeline;
     gst_element_set_state(pipeline, GST_STATE_PLAYING);
 }
 
+typedef struct {
+    guint64 frames;
+    GstClockTime last_pts;
+    gboolean out_of_order;
+} DecodeBenchResult;
+
+static void on_bench_sample(GstSample *sample, gpointer data) {
+    DecodeBenchResult *result = (DecodeBenchResult *)data;
+    GstClockTime pts = GST_BUFFER_PTS(gst_sample_get_buffer(sample));
+
+    if (result->frames > 0 && pts <= result->last_pts)
+        result->out_of_order = TRUE;
+    result->last_pts = pts;
+    result->frames++;
+}
+
+// Decodes a batch of synthetic 1080p JPEG frames with 1..N workers and prints
+// the throughput of each pool size.  Run with --decode-bench [frames].
+static int run_decode_benchmark(guint n_frames) {
+    gchar *description = g_strdup_printf(
+        "videotestsrc pattern=smpte num-buffers=%u ! video/x-raw,width=1920,height=1080,framerate=60/1 ! "
+        "jpegenc ! appsink name=out sync=false",
+        n_frames);
+    GstElement *encoder = gst_parse_launch(description, NULL);
+    GstElement *out = gst_bin_get_by_name(GST_BIN(encoder), "out");
+    GPtrArray *frames = g_ptr_array_new_with_free_func((GDestroyNotify)gst_sample_unref);
+
+    g_free(description);
+    gst_element_set_state(encoder, GST_STATE_PLAYING);
+    GstSample *sample;
+    while ((sample = gst_app_sink_pull_sample(GST_APP_SINK(out))))
+        g_ptr_array_add(frames, sample);
+    gst_element_set_state(encoder, GST_STATE_NULL);
+    gst_object_unref(out);
+    gst_object_unref(encoder);
+
+    if (frames->len == 0) {
+        g_printerr("Failed to encode benchmark frames.\n");
+        return 1;
+    }
+
+    double single_fps = 0;
+    for (guint workers = 1; workers <= g_get_num_processors(); workers++) {
+        DecodeBenchResult result = {};
+        DecodePool *pool = decode_pool_new(workers, workers * 2, on_bench_sample, &result);
+
+        gint64 start = g_get_monotonic_time();
+        for (guint i = 0; i < frames->len; i++) {
+            decode_pool_wait_for_slot(pool);
+            decode_pool_push(pool, (GstSample *)g_ptr_array_index(frames, i));
+        }
+        decode_pool_drain(pool);
+        double seconds = (g_get_monotonic_time() - start) / 1e6;
+        decode_pool_free(pool);
+
+        double fps = result.frames / seconds;
+        if (workers == 1)
+            single_fps = fps;
+        g_print("%2u worker(s): %7.1f fps  x%.2f%s\n", workers, fps, fps / single_fps,
+                result.out_of_order ? "  OUT OF ORDER" : "");
+    }
+    g_ptr_array_unref(frames);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
-    AppData app_data;
+    AppData app_data = {};
+
+    if (argc > 1 && strcmp(argv[1], "--decode-bench") == 0) {
+        gst_init(&argc, &argv);
+        return run_decode_benchmark(argc > 2 ? atoi(argv[2]) : 300);
+    }
+    app_data.device_path = "/dev/video0";
 
     // Initialize V4L2 device
     initialize_v4l2_device(&app_data);
@@ -150,6 +503,16 @@ int main(int argc, char *argv[]) {
     // Run GTK main loop
     gtk_main();
 
+    // Stopping the pipeline joins its streaming threads, so nothing pushes
+    // into the decode pool once it is freed.  The workers may still push
+    // into display_src until the pool is gone.
+    if (app_data.pipeline)
+        gst_element_set_state(app_data.pipeline, GST_STATE_NULL);
+    if (app_data.decode_pool)
+        decode_pool_free(app_data.decode_pool);
+    if (app_data.pipeline)
+        gst_object_unref(app_data.pipeline);
+
     // Close V4L2 device
     close(app_data.fd);
 
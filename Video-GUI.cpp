@@ -7,6 +7,19 @@
 // required header for gstreamer
 #include <gst/gst.h>
 #include <gst/video/videooverlay.h>
+#include <gst/video/video.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/pbutils/pbutils.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 // video window handle
 static guintptr video_window_handle = 0;
 GtkWidget *video_window;
@@ -17,64 +30,2361 @@ GtkWidget *control;
 GtkWidget *Play;
 GtkWidget *Pause;
 GtkWidget *Open;
+GtkWidget *Library;
+GtkWidget *library_window;
+GtkListStore *library_store;
+GtkWidget *library_status;
+GtkWidget *Rewind;
+GtkWidget *Forward;
+GtkWidget *rate_label;
+GtkWidget *seek_bar;
+GtkWidget *thumbnail_popover;
+GtkWidget *thumbnail_image;
+GtkWidget *open_dialog;
+GtkWidget *open_spinner;
+GtkWidget *open_status;
+GtkWidget *open_cancel;
 GstElement *pipeline, *src, *sink;
 GstBus *bus;
+// playlist of URIs played back to back; the index is the item playing or
+// prerolling. about-to-finish reads them from a streaming thread.
+static GPtrArray *playlist = NULL;
+static guint playlist_index = 0;
+static gboolean playlist_loop = FALSE;
+G_LOCK_DEFINE_STATIC (playlist);
+// current playback rate; anything but 1 is a keyframe-only trick mode
+static gdouble playback_rate = 1.0;
+// keyframe stream times of the current item, ascending, and its URI; NULL
+// until the background scan (or the cache) provides them
+static GArray *keyframe_index = NULL;
+static gchar *keyframe_index_uri = NULL;
+// bumped for every open, so a superseded or cancelled one is ignored
+static gint open_generation = 0;
+// TRUE from an open until its preroll completes (or fails)
+static gboolean opening = FALSE;
+// UI thread: the open whose preroll the pipeline is doing, going by the
+// "open-preroll" marks open_async_cb posts on the bus
+static gint preroll_generation = 0;
+// state changes from the UI run on GStreamer's shared thread pool, which
+// does not keep them in order; this serialises them
+G_LOCK_DEFINE_STATIC (state_change);
+// bumped for every new scan so a stale one can stop early and its result
+// is dropped
+static gint keyframe_generation = 0;
+#define KEYFRAME_INDEX_MAGIC "KIDX"
+#define KEYFRAME_INDEX_VERSION 1
+// hover thumbnails: up to THUMBNAIL_COUNT per file, spread over keyframes,
+// decoded by THUMBNAIL_WORKERS low-priority threads
+#define THUMBNAIL_WIDTH 160
+#define THUMBNAIL_HEIGHT 90
+#define THUMBNAIL_COUNT 100
+#define THUMBNAIL_WORKERS 2
+#define THUMBNAIL_MAGIC "THMB"
+#define THUMBNAIL_VERSION 1
+// playbin's GST_PLAY_FLAG_DOWNLOAD: progressive download through queue2
+#define PLAY_FLAG_DOWNLOAD (1 << 7)
+// network media is downloaded into a file of at most ring_buffer_size
+// bytes; finished downloads are kept, cache_budget bytes in total, and
+// played from disk when opened again. Playback pauses when the download
+// falls under low_watermark of the buffer and resumes above high_watermark.
+static guint64 cache_budget = 512 * 1024 * 1024;
+static guint64 ring_buffer_size = 256 * 1024 * 1024;
+static gdouble low_watermark = 0.10;
+static gdouble high_watermark = 0.60;
+// TRUE while paused to let the download catch up
+static gboolean buffering = FALSE;
+// TRUE when the user paused, so buffering does not resume playback
+static gboolean user_paused = FALSE;
+// with --mmap, local files are played from a memory mapping through appsrc,
+// reading ahead MMAP_READAHEAD_SECONDS of media; page faults slower than
+// MMAP_STALL_US count as disk stalls
+static gboolean mmap_source = FALSE;
+#define MMAP_CHUNK (256 * 1024)
+#define MMAP_READAHEAD_SECONDS 4
+#define MMAP_MIN_READAHEAD (1024 * 1024)
+#define MMAP_MAX_READAHEAD (64 * 1024 * 1024)
+#define MMAP_STALL_US 10000
+// with --hires, video decoders use every core, a queue of up to
+// HIRES_DECODE_AHEAD frames lets them run ahead of the sink, and frames
+// later than HIRES_MAX_LATENESS are dropped before conversion and display
+static gboolean hires_profile = FALSE;
+#define HIRES_DECODE_AHEAD 8
+#define HIRES_MAX_LATENESS (20 * GST_MSECOND)
+// frames dropped for being late, counted by drop_late_cb
+static gint late_frames = 0;
+// longest a --bench pass runs
+#define BENCH_SECONDS 10
+// media library: the index file's GVariant type and version, and the
+// longest the discoverer may take over one file
+#define LIBRARY_INDEX_TYPE "(ua(sxtttuuussb))"
+#define LIBRARY_INDEX_VERSION 2
+#define LIBRARY_DISCOVER_TIMEOUT (10 * GST_SECOND)
+static void request_thumbnails (void);
+static gchar *playable_uri (const gchar * uri);
 static void video_widget_realize_cb (GtkWidget * widget, gpointer data);
 static GstBusSyncReply bus_sync_handler (GstBus * bus, GstMessage * message,
                      gpointer user_data);
+/* Replace the playlist and queue its first item; takes ownership of uris */
+static void
+set_playlist (GPtrArray * uris)
+{
+  G_LOCK (playlist);
+  if (playlist)
+    g_ptr_array_unref (playlist);
+  playlist = uris;
+  playlist_index = 0;
+  // network items already downloaded play from the cache
+  for (guint i = 0; i < uris->len; i++)
+    {
+      gchar *uri = playable_uri ((const gchar *) g_ptr_array_index (uris, i));
+      g_free (g_ptr_array_index (uris, i));
+      g_ptr_array_index (uris, i) = uri;
+    }
+  G_UNLOCK (playlist);
+  if (uris->len > 0)
+    g_object_set (G_OBJECT (pipeline), "uri", g_ptr_array_index (uris, 0),
+          NULL);
+}
+/* This function is called from a streaming thread when the current item is
+   almost played out. Setting the next URI here makes playbin preroll it while
+   the current one finishes, so there is no gap and the sink is not torn down;
+   with playbin3 the decoders are kept too when the caps allow. */
+static void
+about_to_finish_cb (GstElement * playbin, gpointer user_data)
+{
+  gchar *next = NULL;
+  G_LOCK (playlist);
+  if (playlist && playlist->len > 0)
+    {
+      guint index = playlist_index + 1;
+      if (index >= playlist->len && playlist_loop)
+        index = 0;
+      if (index < playlist->len)
+        {
+          playlist_index = index;
+          next = g_strdup ((const gchar *) g_ptr_array_index (playlist, index));
+        }
+    }
+  G_UNLOCK (playlist);
+  if (next)
+    {
+      g_object_set (G_OBJECT (playbin), "uri", next, NULL);
+      g_free (next);
+    }
+}
+/* Work order for the keyframe scan thread; it fills in times */
+typedef struct
+{
+  gchar *uri;
+  gint generation;
+  GArray *times;
+  gboolean have_video;
+} KeyframeScan;
+static void
+keyframe_scan_free (KeyframeScan * scan)
+{
+  g_free (scan->uri);
+  if (scan->times)
+    g_array_unref (scan->times);
+  g_free (scan);
+}
+/* The cache file of the given kind for a local file. The key covers the
+   path, size and mtime, so an edited file gets a new one. NULL for other
+   URIs. */
+static gchar *
+media_cache_path (const gchar * uri, const gchar * kind,
+    const gchar * extension)
+{
+  gchar *filename = g_filename_from_uri (uri, NULL, NULL);
+  gchar *key, *hash, *name, *path = NULL;
+  GStatBuf st;
+  if (filename && g_stat (filename, &st) == 0)
+    {
+      key = g_strdup_printf ("%s:%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT,
+          filename, (gint64) st.st_size, (gint64) st.st_mtime);
+      hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+      name = g_strconcat (hash, extension, NULL);
+      path = g_build_filename (g_get_user_cache_dir (), "video-gui", kind,
+          name, NULL);
+      g_free (name);
+      g_free (hash);
+      g_free (key);
+    }
+  g_free (filename);
+  return path;
+}
+/* Cache layout: magic, version and count as 32-bit words, then the times
+   as 64-bit nanoseconds, all native-endian */
+static GArray *
+load_keyframe_index (const gchar * path)
+{
+  gchar *contents;
+  gsize length;
+  guint32 header[3];
+  GArray *times = NULL;
+  if (!g_file_get_contents (path, &contents, &length, NULL))
+    return NULL;
+  if (length >= sizeof (header))
+    {
+      memcpy (header, contents, sizeof (header));
+      if (memcmp (&header[0], KEYFRAME_INDEX_MAGIC, 4) == 0
+          && header[1] == KEYFRAME_INDEX_VERSION
+          && length == sizeof (header) + header[2] * sizeof (guint64))
+        {
+          times = g_array_sized_new (FALSE, FALSE, sizeof (GstClockTime),
+              header[2]);
+          g_array_append_vals (times, contents + sizeof (header), header[2]);
+        }
+    }
+  g_free (contents);
+  return times;
+}
+static void
+save_keyframe_index (const gchar * path, GArray * times)
+{
+  guint32 header[3] = { 0, KEYFRAME_INDEX_VERSION, times->len };
+  gsize length = sizeof (header) + times->len * sizeof (guint64);
+  gchar *contents = (gchar *) g_malloc (length);
+  gchar *dir = g_path_get_dirname (path);
+  memcpy (&header[0], KEYFRAME_INDEX_MAGIC, 4);
+  memcpy (contents, header, sizeof (header));
+  memcpy (contents + sizeof (header), times->data,
+      times->len * sizeof (guint64));
+  // written to a temporary file and renamed, so readers never see half
+  if (g_mkdir_with_parents (dir, 0755) != 0
+      || !g_file_set_contents (path, contents, length, NULL))
+    g_printerr ("Cannot cache keyframe index in %s\n", path);
+  g_free (dir);
+  g_free (contents);
+}
+/* Streaming thread: records the stream time of every keyframe */
+static GstPadProbeReturn
+keyframe_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  KeyframeScan *scan = (KeyframeScan *) data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstEvent *event;
+  GstClockTime time;
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+    return GST_PAD_PROBE_OK;
+  time = GST_BUFFER_PTS_IS_VALID (buffer) ? GST_BUFFER_PTS (buffer)
+      : GST_BUFFER_DTS (buffer);
+  event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  if (event)
+    {
+      const GstSegment *segment;
+      gst_event_parse_segment (event, &segment);
+      time = gst_segment_to_stream_time (segment, GST_FORMAT_TIME, time);
+      gst_event_unref (event);
+    }
+  if (GST_CLOCK_TIME_IS_VALID (time))
+    g_array_append_val (scan->times, time);
+  return GST_PAD_PROBE_OK;
+}
+/* parsebin exposed a stream: discard it, but watch the first video one */
+static void
+keyframe_pad_added_cb (GstElement * parse, GstPad * pad, gpointer data)
+{
+  KeyframeScan *scan = (KeyframeScan *) data;
+  GstElement *scanner = GST_ELEMENT (gst_element_get_parent (parse));
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  GstPad *sinkpad = gst_element_get_static_pad (sink, "sink");
+  GstCaps *caps = gst_pad_query_caps (pad, NULL);
+  const gchar *media = gst_caps_is_empty (caps) ? ""
+      : gst_structure_get_name (gst_caps_get_structure (caps, 0));
+  gst_bin_add (GST_BIN (scanner), sink);
+  gst_element_sync_state_with_parent (sink);
+  gst_pad_link (pad, sinkpad);
+  if (g_str_has_prefix (media, "video/")
+      && g_atomic_int_compare_and_exchange (&scan->have_video, FALSE, TRUE))
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, keyframe_probe_cb,
+        scan, NULL);
+  gst_caps_unref (caps);
+  gst_object_unref (sinkpad);
+  gst_object_unref (scanner);
+}
+/* Runs the file through its demuxer and parsers only, without decoding,
+   which reads it as fast as the disk allows */
+static gboolean
+scan_keyframes (KeyframeScan * scan)
+{
+  GstElement *scanner = gst_pipeline_new ("keyframe-scan");
+  GstElement *source = gst_element_make_from_uri (GST_URI_SRC, scan->uri,
+      NULL, NULL);
+  GstElement *parse = gst_element_factory_make ("parsebin", NULL);
+  GstBus *scan_bus;
+  gboolean done = FALSE, ok = FALSE;
+  if (!source || !parse)
+    {
+      if (source)
+        gst_object_unref (source);
+      if (parse)
+        gst_object_unref (parse);
+      gst_object_unref (scanner);
+      return FALSE;
+    }
+  gst_bin_add_many (GST_BIN (scanner), source, parse, NULL);
+  gst_element_link (source, parse);
+  g_signal_connect (parse, "pad-added", G_CALLBACK (keyframe_pad_added_cb),
+      scan);
+  gst_element_set_state (scanner, GST_STATE_PLAYING);
+  scan_bus = gst_element_get_bus (scanner);
+  while (!done)
+    {
+      GstMessage *message = gst_bus_timed_pop_filtered (scan_bus,
+          100 * GST_MSECOND,
+          (GstMessageType) (GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+      // give up as soon as another file was opened
+      if (g_atomic_int_get (&keyframe_generation) != scan->generation)
+        done = TRUE;
+      if (!message)
+        continue;
+      ok = GST_MESSAGE_TYPE (message) == GST_MESSAGE_EOS;
+      done = TRUE;
+      gst_message_unref (message);
+    }
+  gst_element_set_state (scanner, GST_STATE_NULL);
+  gst_object_unref (scan_bus);
+  gst_object_unref (scanner);
+  return ok && scan->times->len > 0;
+}
+static gint
+compare_clock_time (gconstpointer a, gconstpointer b)
+{
+  GstClockTime x = *(const GstClockTime *) a, y = *(const GstClockTime *) b;
+  return x < y ? -1 : x > y;
+}
+/* Main thread: install a finished index if it is still for the file on
+   screen */
+static gboolean
+keyframe_index_ready_cb (gpointer data)
+{
+  KeyframeScan *scan = (KeyframeScan *) data;
+  if (scan->generation == g_atomic_int_get (&keyframe_generation))
+    {
+      if (keyframe_index)
+        g_array_unref (keyframe_index);
+      keyframe_index = scan->times;
+      scan->times = NULL;
+      request_thumbnails ();
+    }
+  keyframe_scan_free (scan);
+  return G_SOURCE_REMOVE;
+}
+static gpointer
+keyframe_scan_thread (gpointer data)
+{
+  KeyframeScan *scan = (KeyframeScan *) data;
+  gchar *path = media_cache_path (scan->uri, "keyframes", ".kidx");
+  GArray *cached = path ? load_keyframe_index (path) : NULL;
+  if (cached)
+    {
+      g_array_unref (scan->times);
+      scan->times = cached;
+      g_idle_add (keyframe_index_ready_cb, scan);
+    }
+  else if (scan_keyframes (scan))
+    {
+      g_array_sort (scan->times, compare_clock_time);
+      if (path)
+        save_keyframe_index (path, scan->times);
+      g_idle_add (keyframe_index_ready_cb, scan);
+    }
+  else
+    keyframe_scan_free (scan);
+  g_free (path);
+  return NULL;
+}
+/* Start building the index for uri in the background, unless it is the
+   one already there. Only local files are indexed. */
+static void
+request_keyframe_index (const gchar * uri)
+{
+  KeyframeScan *scan;
+  if (g_strcmp0 (uri, keyframe_index_uri) == 0)
+    return;
+  g_free (keyframe_index_uri);
+  keyframe_index_uri = g_strdup (uri);
+  if (keyframe_index)
+    g_array_unref (keyframe_index);
+  keyframe_index = NULL;
+  g_atomic_int_inc (&keyframe_generation);
+  if (!g_str_has_prefix (uri, "file:"))
+    return;
+  scan = g_new0 (KeyframeScan, 1);
+  scan->uri = g_strdup (uri);
+  scan->generation = g_atomic_int_get (&keyframe_generation);
+  scan->times = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  g_thread_unref (g_thread_new ("keyframe-index", keyframe_scan_thread, scan));
+}
+/* The indexed keyframe closest to position, or position if there is no
+   index yet */
+static GstClockTime
+nearest_keyframe (GstClockTime position)
+{
+  guint low = 0, high;
+  GstClockTime *times;
+  if (!keyframe_index || keyframe_index->len == 0)
+    return position;
+  times = (GstClockTime *) keyframe_index->data;
+  high = keyframe_index->len;
+  while (low < high)
+    {
+      guint mid = (low + high) / 2;
+      if (times[mid] < position)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+  if (low == keyframe_index->len
+      || (low > 0 && position - times[low - 1] < times[low] - position))
+    low--;
+  return times[low];
+}
+/* Seek at the current rate. In reverse the segment ends at position. */
+static void
+seek_to (GstClockTime position, GstSeekFlags flags)
+{
+  if (playback_rate != 1.0)
+    flags = (GstSeekFlags) (flags | GST_SEEK_FLAG_TRICKMODE
+        | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS | GST_SEEK_FLAG_TRICKMODE_NO_AUDIO);
+  if (playback_rate > 0)
+    gst_element_seek (pipeline, playback_rate, GST_FORMAT_TIME,
+        (GstSeekFlags) (flags | GST_SEEK_FLAG_FLUSH), GST_SEEK_TYPE_SET,
+        position, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+  else
+    gst_element_seek (pipeline, playback_rate, GST_FORMAT_TIME,
+        (GstSeekFlags) (flags | GST_SEEK_FLAG_FLUSH), GST_SEEK_TYPE_SET, 0,
+        GST_SEEK_TYPE_SET, position);
+}
+static void
+set_rate (gdouble rate)
+{
+  gint64 position = 0;
+  gchar *text;
+  gst_element_query_position (pipeline, GST_FORMAT_TIME, &position);
+  playback_rate = rate;
+  seek_to (position, rate == 1.0 ? GST_SEEK_FLAG_ACCURATE : GST_SEEK_FLAG_NONE);
+  text = rate == 1.0 ? g_strdup ("") : g_strdup_printf ("%gx", rate);
+  gtk_label_set_text (GTK_LABEL (rate_label), text);
+  g_free (text);
+}
+/* The seek bar was moved by the user: land on a keyframe, which is
+   instant because nothing has to be decoded up to the target */
+static gboolean
+seek_bar_cb (GtkRange * range, GtkScrollType scroll, gdouble value,
+    gpointer data)
+{
+  GstClockTime position = (GstClockTime) (MAX (value, 0) * GST_SECOND);
+  if (keyframe_index)
+    seek_to (nearest_keyframe (position), GST_SEEK_FLAG_KEY_UNIT);
+  else
+    seek_to (position, (GstSeekFlags) (GST_SEEK_FLAG_KEY_UNIT
+        | GST_SEEK_FLAG_SNAP_NEAREST));
+  return FALSE;
+}
+/* Keep the seek bar on the playing position */
+static gboolean
+update_seek_bar_cb (gpointer data)
+{
+  gint64 position, duration;
+  if (gst_element_query_duration (pipeline, GST_FORMAT_TIME, &duration)
+      && gst_element_query_position (pipeline, GST_FORMAT_TIME, &position))
+    {
+      GtkAdjustment *adjustment =
+          gtk_range_get_adjustment (GTK_RANGE (seek_bar));
+      gtk_adjustment_set_upper (adjustment, (gdouble) duration / GST_SECOND);
+      gtk_adjustment_set_value (adjustment, (gdouble) position / GST_SECOND);
+    }
+  return G_SOURCE_CONTINUE;
+}
+/* Thumbnail cache file, mapped shared: a header, one entry per thumbnail,
+   then the RGB pixels of each. An entry is marked ready only after its
+   pixels are written, so a partly built file resumes where it stopped. */
+typedef struct
+{
+  char magic[4];
+  guint32 version;
+  guint32 width;
+  guint32 height;
+  guint32 count;
+  guint32 reserved;
+} ThumbnailHeader;
+typedef struct
+{
+  guint64 time;
+  gint ready;
+  guint32 reserved;
+} ThumbnailEntry;
+/* A mapped thumbnail file, shared by the UI and the workers */
+typedef struct
+{
+  gint refcount;
+  gchar *uri;
+  gint generation;
+  guint8 *map;
+  gsize length;
+  ThumbnailHeader *header;
+  ThumbnailEntry *entries;
+  guint8 *pixels;
+} ThumbnailStrip;
+/* One worker's share of a strip: thumbnails first, first + step, ... */
+typedef struct
+{
+  ThumbnailStrip *strip;
+  guint first;
+  guint step;
+} ThumbnailJob;
+static ThumbnailStrip *thumbnail_strip = NULL;
+static GThreadPool *thumbnail_pool = NULL;
+static ThumbnailStrip *
+thumbnail_strip_ref (ThumbnailStrip * strip)
+{
+  g_atomic_int_inc (&strip->refcount);
+  return strip;
+}
+static void
+thumbnail_strip_unref (ThumbnailStrip * strip)
+{
+  if (!g_atomic_int_dec_and_test (&strip->refcount))
+    return;
+  munmap (strip->map, strip->length);
+  g_free (strip->uri);
+  g_free (strip);
+}
+static guint8 *
+thumbnail_pixels (ThumbnailStrip * strip, guint index)
+{
+  return strip->pixels + (gsize) index * THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT * 3;
+}
+/* Map the cache file for times, creating or resetting it if it was made
+   for other times or another size */
+static ThumbnailStrip *
+open_thumbnail_strip (const gchar * path, const GstClockTime * times,
+    guint count)
+{
+  gsize entries_end = sizeof (ThumbnailHeader) + count * sizeof (ThumbnailEntry);
+  gsize length = entries_end
+      + (gsize) count * THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT * 3;
+  gchar *dir = g_path_get_dirname (path);
+  ThumbnailStrip *strip;
+  gboolean valid;
+  GStatBuf st;
+  guint i;
+  int fd;
+  g_mkdir_with_parents (dir, 0755);
+  g_free (dir);
+  fd = g_open (path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return NULL;
+  valid = fstat (fd, &st) == 0 && (gsize) st.st_size == length;
+  if (!valid && (ftruncate (fd, 0) != 0 || ftruncate (fd, length) != 0))
+    {
+      close (fd);
+      return NULL;
+    }
+  strip = g_new0 (ThumbnailStrip, 1);
+  strip->map = (guint8 *) mmap (NULL, length, PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  close (fd);
+  if (strip->map == MAP_FAILED)
+    {
+      g_free (strip);
+      return NULL;
+    }
+  strip->refcount = 1;
+  strip->length = length;
+  strip->header = (ThumbnailHeader *) strip->map;
+  strip->entries = (ThumbnailEntry *) (strip->map + sizeof (ThumbnailHeader));
+  strip->pixels = strip->map + entries_end;
+  valid = valid && memcmp (strip->header->magic, THUMBNAIL_MAGIC, 4) == 0
+      && strip->header->version == THUMBNAIL_VERSION
+      && strip->header->width == THUMBNAIL_WIDTH
+      && strip->header->height == THUMBNAIL_HEIGHT
+      && strip->header->count == count;
+  for (i = 0; valid && i < count; i++)
+    valid = strip->entries[i].time == times[i];
+  if (!valid)
+    {
+      memset (strip->map, 0, entries_end);
+      for (i = 0; i < count; i++)
+        strip->entries[i].time = times[i];
+      strip->header->version = THUMBNAIL_VERSION;
+      strip->header->width = THUMBNAIL_WIDTH;
+      strip->header->height = THUMBNAIL_HEIGHT;
+      strip->header->count = count;
+      memcpy (strip->header->magic, THUMBNAIL_MAGIC, 4);
+    }
+  return strip;
+}
+static void
+thumbnail_pad_added_cb (GstElement * decode, GstPad * pad, gpointer data)
+{
+  GstPad *sinkpad = gst_element_get_static_pad (GST_ELEMENT (data), "sink");
+  if (!gst_pad_is_linked (sinkpad))
+    gst_pad_link (pad, sinkpad);
+  gst_object_unref (sinkpad);
+}
+/* Keep each worker's decoder to one thread; the cores belong to playback */
+static void
+thumbnail_element_added_cb (GstBin * bin, GstBin * sub_bin,
+    GstElement * element, gpointer data)
+{
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (element),
+          "max-threads"))
+    g_object_set (element, "max-threads", 1, NULL);
+}
+/* Background threads: lowest CPU priority, and the idle I/O class
+   (IOPRIO_CLASS_IDLE, 3, in the class bits) so the disk only serves them
+   when playback is not reading */
+static void
+lower_thread_priority (void)
+{
+  pid_t tid = (pid_t) syscall (SYS_gettid);
+  setpriority (PRIO_PROCESS, tid, 19);
+  syscall (SYS_ioprio_set, 1, tid, 3 << 13);
+}
+/* Worker thread: decode this job's thumbnails, one keyframe seek and one
+   frame each, with a pipeline of its own */
+static void
+thumbnail_worker (gpointer data, gpointer user_data)
+{
+  ThumbnailJob *job = (ThumbnailJob *) data;
+  ThumbnailStrip *strip = job->strip;
+  GstElement *decoder, *decode, *convert, *scale, *sink;
+  GstCaps *caps;
+  guint i;
+  lower_thread_priority ();
+  decoder = gst_pipeline_new ("thumbnailer");
+  decode = gst_element_factory_make ("uridecodebin", NULL);
+  convert = gst_element_factory_make ("videoconvert", NULL);
+  scale = gst_element_factory_make ("videoscale", NULL);
+  sink = gst_element_factory_make ("appsink", NULL);
+  if (!decode || !convert || !scale || !sink)
+    goto done;
+  gst_bin_add_many (GST_BIN (decoder), decode, convert, scale, sink, NULL);
+  caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING, "RGB",
+      "width", G_TYPE_INT, THUMBNAIL_WIDTH, "height", G_TYPE_INT,
+      THUMBNAIL_HEIGHT, "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1, NULL);
+  g_object_set (sink, "caps", caps, "sync", FALSE, "max-buffers", 1, NULL);
+  gst_caps_unref (caps);
+  caps = gst_caps_new_empty_simple ("video/x-raw");
+  // only the video stream is exposed
+  g_object_set (decode, "uri", strip->uri, "caps", caps,
+      "expose-all-streams", FALSE, NULL);
+  gst_caps_unref (caps);
+  gst_element_link_many (convert, scale, sink, NULL);
+  g_signal_connect (decode, "pad-added", G_CALLBACK (thumbnail_pad_added_cb),
+      convert);
+  g_signal_connect (decoder, "deep-element-added",
+      G_CALLBACK (thumbnail_element_added_cb), NULL);
+  gst_element_set_state (decoder, GST_STATE_PAUSED);
+  if (gst_element_get_state (decoder, NULL, NULL, 10 * GST_SECOND)
+      == GST_STATE_CHANGE_FAILURE)
+    goto done;
+  for (i = job->first; i < strip->header->count; i += job->step)
+    {
+      GstSample *sample;
+      GstVideoInfo info;
+      GstVideoFrame frame;
+      guint y;
+      // the file on screen changed; its strip is no longer wanted
+      if (g_atomic_int_get (&keyframe_generation) != strip->generation)
+        break;
+      if (g_atomic_int_get (&strip->entries[i].ready))
+        continue;
+      if (!gst_element_seek_simple (decoder, GST_FORMAT_TIME,
+              (GstSeekFlags) (GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT),
+              strip->entries[i].time))
+        continue;
+      sample = gst_app_sink_try_pull_preroll (GST_APP_SINK (sink),
+          5 * GST_SECOND);
+      if (!sample)
+        continue;
+      if (gst_video_info_from_caps (&info, gst_sample_get_caps (sample))
+          && gst_video_frame_map (&frame, &info, gst_sample_get_buffer (sample),
+              GST_MAP_READ))
+        {
+          for (y = 0; y < THUMBNAIL_HEIGHT; y++)
+            memcpy (thumbnail_pixels (strip, i) + y * THUMBNAIL_WIDTH * 3,
+                (guint8 *) GST_VIDEO_FRAME_PLANE_DATA (&frame, 0)
+                + y * GST_VIDEO_FRAME_PLANE_STRIDE (&frame, 0),
+                THUMBNAIL_WIDTH * 3);
+          gst_video_frame_unmap (&frame);
+          g_atomic_int_set (&strip->entries[i].ready, TRUE);
+        }
+      gst_sample_unref (sample);
+    }
+done:
+  gst_element_set_state (decoder, GST_STATE_NULL);
+  gst_object_unref (decoder);
+  thumbnail_strip_unref (strip);
+  g_free (job);
+}
+/* Called when a keyframe index is installed: map the current file's
+   thumbnail cache and queue whatever is missing from it */
+static void
+request_thumbnails (void)
+{
+  GstClockTime times[THUMBNAIL_COUNT];
+  GstClockTime last;
+  guint count = 0, i;
+  gchar *path;
+  if (thumbnail_strip)
+    thumbnail_strip_unref (thumbnail_strip);
+  thumbnail_strip = NULL;
+  if (!keyframe_index || keyframe_index->len == 0)
+    return;
+  // keyframes closest to evenly spaced times, without repeats
+  last = g_array_index (keyframe_index, GstClockTime, keyframe_index->len - 1);
+  for (i = 0; i < THUMBNAIL_COUNT; i++)
+    {
+      GstClockTime time = nearest_keyframe (last / (THUMBNAIL_COUNT - 1) * i);
+      if (count == 0 || time != times[count - 1])
+        times[count++] = time;
+    }
+  path = media_cache_path (keyframe_index_uri, "thumbnails", ".thumbs");
+  if (path)
+    thumbnail_strip = open_thumbnail_strip (path, times, count);
+  g_free (path);
+  if (!thumbnail_strip)
+    return;
+  thumbnail_strip->uri = g_strdup (keyframe_index_uri);
+  thumbnail_strip->generation = g_atomic_int_get (&keyframe_generation);
+  if (!thumbnail_pool)
+    thumbnail_pool = g_thread_pool_new (thumbnail_worker, NULL,
+        THUMBNAIL_WORKERS, TRUE, NULL);
+  for (i = 0; i < THUMBNAIL_WORKERS; i++)
+    {
+      ThumbnailJob *job = g_new0 (ThumbnailJob, 1);
+      job->strip = thumbnail_strip_ref (thumbnail_strip);
+      job->first = i;
+      job->step = THUMBNAIL_WORKERS;
+      g_thread_pool_push (thumbnail_pool, job, NULL);
+    }
+}
+/* Pointer over the seek bar: show the ready thumbnail closest to the time
+   under it */
+static gboolean
+seek_bar_motion_cb (GtkWidget * widget, GdkEventMotion * event,
+    gpointer data)
+{
+  GtkAdjustment *adjustment = gtk_range_get_adjustment (GTK_RANGE (widget));
+  gint width = gtk_widget_get_allocated_width (widget);
+  GstClockTime time, best_distance = GST_CLOCK_TIME_NONE;
+  guint i, best = 0;
+  GdkPixbuf *pixbuf, *copy;
+  GdkRectangle pointer = { (int) event->x, 0, 1, 1 };
+  if (!thumbnail_strip || width <= 0)
+    return FALSE;
+  time = (GstClockTime) (CLAMP (event->x / width, 0.0, 1.0)
+      * gtk_adjustment_get_upper (adjustment) * GST_SECOND);
+  for (i = 0; i < thumbnail_strip->header->count; i++)
+    {
+      ThumbnailEntry *entry = &thumbnail_strip->entries[i];
+      GstClockTime distance = entry->time > time ? entry->time - time
+          : time - entry->time;
+      if (g_atomic_int_get (&entry->ready) && distance < best_distance)
+        {
+          best = i;
+          best_distance = distance;
+        }
+    }
+  if (!GST_CLOCK_TIME_IS_VALID (best_distance))
+    return FALSE;
+  // copied, as the mapping goes away when another file is opened
+  pixbuf = gdk_pixbuf_new_from_data (thumbnail_pixels (thumbnail_strip, best),
+      GDK_COLORSPACE_RGB, FALSE, 8, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT,
+      THUMBNAIL_WIDTH * 3, NULL, NULL);
+  copy = gdk_pixbuf_copy (pixbuf);
+  gtk_image_set_from_pixbuf (GTK_IMAGE (thumbnail_image), copy);
+  g_object_unref (copy);
+  g_object_unref (pixbuf);
+  gtk_popover_set_pointing_to (GTK_POPOVER (thumbnail_popover), &pointer);
+  gtk_widget_show (thumbnail_popover);
+  return FALSE;
+}
+static gboolean
+seek_bar_leave_cb (GtkWidget * widget, GdkEventCrossing * event,
+    gpointer data)
+{
+  gtk_widget_hide (thumbnail_popover);
+  return FALSE;
+}
+/* A local file mapped for the appsrc source. Buffers point into the
+   mapping and hold a reference, so it outlives the source if need be. */
+typedef struct
+{
+  gint refcount;
+  int fd;
+  guint8 *map;
+  gsize size;
+  gsize offset;             // next byte to push; streaming thread only
+  gsize readahead_end;      // end of the range already advised
+  gint64 bytes_per_second;  // media bitrate estimate, from the UI thread
+  // I/O statistics, under the mmap_stats lock
+  guint64 bytes;
+  guint stalls;
+  gint64 stall_us;
+  gint64 max_stall_us;
+} MappedFile;
+static MappedFile *mapped_file = NULL;
+G_LOCK_DEFINE_STATIC (mmap_stats);
+static MappedFile *
+mapped_file_ref (MappedFile * file)
+{
+  g_atomic_int_inc (&file->refcount);
+  return file;
+}
+static void
+mapped_file_unref (gpointer data)
+{
+  MappedFile *file = (MappedFile *) data;
+  if (!g_atomic_int_dec_and_test (&file->refcount))
+    return;
+  munmap (file->map, file->size);
+  close (file->fd);
+  g_free (file);
+}
+/* A mapped page that cannot be read (the file was truncated, the card was
+   pulled) raises SIGBUS. While a source thread touches its pages it points
+   this at a jump back into mmap_need_data_cb; any other SIGBUS gets the
+   handler that was there before. volatile, or the compiler drops the store
+   before the touch loop. */
+static thread_local sigjmp_buf *volatile mmap_fault_jump = NULL;
+static struct sigaction mmap_previous_sigbus;
+static void
+mmap_sigbus_handler (int sig, siginfo_t * info, void *context)
+{
+  if (mmap_fault_jump)
+    siglongjmp (*mmap_fault_jump, 1);
+  // not ours: put the old handler back and let the access fault again
+  sigaction (SIGBUS, &mmap_previous_sigbus, NULL);
+}
+static void
+install_mmap_sigbus_handler (void)
+{
+  static gsize installed = 0;
+  if (g_once_init_enter (&installed))
+    {
+      struct sigaction action;
+      memset (&action, 0, sizeof (action));
+      action.sa_sigaction = mmap_sigbus_handler;
+      action.sa_flags = SA_SIGINFO;
+      sigemptyset (&action.sa_mask);
+      sigaction (SIGBUS, &action, &mmap_previous_sigbus);
+      g_once_init_leave (&installed, 1);
+    }
+}
+/* The file URI behind an appsrc:// one made by playable_uri */
+static gchar *
+local_file_uri (const gchar * uri)
+{
+  if (g_str_has_prefix (uri, "appsrc://"))
+    return g_strconcat ("file://", uri + strlen ("appsrc://"), NULL);
+  return g_strdup (uri);
+}
+/* Streaming thread: push the next chunk of the mapping. Its pages are
+   touched here, timed, so slow storage shows up as a stall in the source
+   and not as slow decoding further down. A file that shrank or a page
+   that cannot be read ends playback with an error instead of SIGBUS. */
+static void
+mmap_need_data_cb (GstAppSrc * appsrc, guint length, gpointer data)
+{
+  MappedFile *file = (MappedFile *) data;
+  gsize page = sysconf (_SC_PAGESIZE), chunk, at, window;
+  gint64 start, elapsed;
+  volatile guint8 sink = 0;
+  GstBuffer *buffer;
+  sigjmp_buf fault;
+  struct stat st;
+  if (file->offset >= file->size)
+    {
+      gst_app_src_end_of_stream (appsrc);
+      return;
+    }
+  chunk = length == (guint) -1 || length < MMAP_CHUNK ? MMAP_CHUNK : length;
+  chunk = MIN (chunk, file->size - file->offset);
+  // pages past the end of a truncated file fault; do not touch them
+  if (fstat (file->fd, &st) != 0 || (gsize) st.st_size < file->offset + chunk)
+    {
+      GST_ELEMENT_ERROR (appsrc, RESOURCE, READ,
+          ("The file was truncated while playing"), (NULL));
+      return;
+    }
+  start = g_get_monotonic_time ();
+  if (sigsetjmp (fault, 1))
+    {
+      mmap_fault_jump = NULL;
+      GST_ELEMENT_ERROR (appsrc, RESOURCE, READ,
+          ("The file could not be read while playing"),
+          ("SIGBUS reading the mapping near offset %" G_GSIZE_FORMAT,
+              file->offset));
+      return;
+    }
+  mmap_fault_jump = &fault;
+  for (at = file->offset & ~(page - 1); at < file->offset + chunk; at += page)
+    sink += file->map[at];
+  mmap_fault_jump = NULL;
+  elapsed = g_get_monotonic_time () - start;
+  // keep the kernel reading ahead by a few seconds of media; advise again
+  // when half of that has been used up
+  window = CLAMP ((gsize) file->bytes_per_second * MMAP_READAHEAD_SECONDS,
+      MMAP_MIN_READAHEAD, MMAP_MAX_READAHEAD);
+  if (file->offset + chunk + window / 2 > file->readahead_end)
+    {
+      gsize from = MAX (file->readahead_end, file->offset + chunk);
+      gsize to = MIN (file->offset + chunk + window, file->size);
+      if (to > from)
+        posix_fadvise (file->fd, from, to - from, POSIX_FADV_WILLNEED);
+      file->readahead_end = to;
+    }
+  G_LOCK (mmap_stats);
+  file->bytes += chunk;
+  if (elapsed >= MMAP_STALL_US)
+    {
+      file->stalls++;
+      file->stall_us += elapsed;
+      file->max_stall_us = MAX (file->max_stall_us, elapsed);
+    }
+  G_UNLOCK (mmap_stats);
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+      file->map + file->offset, chunk, 0, chunk, mapped_file_ref (file),
+      mapped_file_unref);
+  GST_BUFFER_OFFSET (buffer) = file->offset;
+  GST_BUFFER_OFFSET_END (buffer) = file->offset + chunk;
+  file->offset += chunk;
+  gst_app_src_push_buffer (appsrc, buffer);
+}
+static gboolean
+mmap_seek_data_cb (GstAppSrc * appsrc, guint64 offset, gpointer data)
+{
+  MappedFile *file = (MappedFile *) data;
+  file->offset = offset;
+  file->readahead_end = offset;
+  return TRUE;
+}
+/* playbin made the appsrc for an appsrc:// item: map the file behind it */
+static void
+source_setup_cb (GstElement * playbin, GstElement * source, gpointer data)
+{
+  GstAppSrcCallbacks callbacks = { mmap_need_data_cb, NULL, mmap_seek_data_cb };
+  gchar *uri, *file_uri, *filename;
+  MappedFile *file;
+  struct stat st;
+  int fd;
+  if (!GST_IS_APP_SRC (source))
+    return;
+  uri = gst_uri_handler_get_uri (GST_URI_HANDLER (source));
+  file_uri = local_file_uri (uri);
+  filename = g_filename_from_uri (file_uri, NULL, NULL);
+  fd = filename ? g_open (filename, O_RDONLY, 0) : -1;
+  g_free (filename);
+  g_free (file_uri);
+  g_free (uri);
+  if (fd < 0 || fstat (fd, &st) != 0 || st.st_size == 0)
+    {
+      if (fd >= 0)
+        close (fd);
+      return;
+    }
+  file = g_new0 (MappedFile, 1);
+  file->refcount = 1;
+  file->fd = fd;
+  file->size = st.st_size;
+  file->map = (guint8 *) mmap (NULL, file->size, PROT_READ, MAP_SHARED, fd, 0);
+  if (file->map == MAP_FAILED)
+    {
+      close (fd);
+      g_free (file);
+      return;
+    }
+  install_mmap_sigbus_handler ();
+  // mostly read front to back; let the kernel drop pages behind us early
+  madvise (file->map, file->size, MADV_SEQUENTIAL);
+  posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  g_object_set (source, "stream-type", GST_APP_STREAM_TYPE_RANDOM_ACCESS,
+      "size", (gint64) file->size, "format", GST_FORMAT_BYTES, NULL);
+  gst_app_src_set_callbacks (GST_APP_SRC (source), &callbacks,
+      mapped_file_ref (file), mapped_file_unref);
+  G_LOCK (mmap_stats);
+  if (mapped_file)
+    mapped_file_unref (mapped_file);
+  mapped_file = file;
+  G_UNLOCK (mmap_stats);
+}
+/* Every few seconds: update the bitrate the read-ahead is sized by, and
+   report what the disk delivered since the last report */
+static gboolean
+mmap_report_cb (gpointer data)
+{
+  static gint64 last_report = 0;
+  MappedFile *file;
+  gint64 now = g_get_monotonic_time (), duration;
+  guint64 bytes;
+  guint stalls;
+  gint64 stall_us, max_stall_us;
+  G_LOCK (mmap_stats);
+  file = mapped_file ? mapped_file_ref (mapped_file) : NULL;
+  if (file)
+    {
+      bytes = file->bytes;
+      stalls = file->stalls;
+      stall_us = file->stall_us;
+      max_stall_us = file->max_stall_us;
+      file->bytes = file->stalls = 0;
+      file->stall_us = file->max_stall_us = 0;
+    }
+  G_UNLOCK (mmap_stats);
+  if (!file)
+    return G_SOURCE_CONTINUE;
+  if (gst_element_query_duration (pipeline, GST_FORMAT_TIME, &duration)
+      && duration > 0)
+    file->bytes_per_second = (gint64) gst_util_uint64_scale (file->size,
+        GST_SECOND, duration);
+  if (last_report && bytes > 0)
+    g_print ("mmap source: %.1f MB/s read, %u stalls (%.1f ms total, "
+        "%.1f ms max), read-ahead %.1f MB\n",
+        bytes / 1e6 / ((now - last_report) / 1e6), stalls, stall_us / 1e3,
+        max_stall_us / 1e3,
+        CLAMP ((gsize) file->bytes_per_second * MMAP_READAHEAD_SECONDS,
+            MMAP_MIN_READAHEAD, MMAP_MAX_READAHEAD) / 1e6);
+  last_report = now;
+  mapped_file_unref (file);
+  return G_SOURCE_CONTINUE;
+}
+/* Give a video decoder one thread per core, with frame and slice threading
+   where it offers the choice */
+static void
+hires_element_added_cb (GstBin * bin, GstBin * sub_bin, GstElement * element,
+    gpointer data)
+{
+  GstElementFactory *factory = gst_element_get_factory (element);
+  GObjectClass *klass = G_OBJECT_GET_CLASS (element);
+  gint cores = g_get_num_processors ();
+  if (!factory || !gst_element_factory_list_is_type (factory,
+          GST_ELEMENT_FACTORY_TYPE_DECODER
+          | GST_ELEMENT_FACTORY_TYPE_MEDIA_VIDEO))
+    return;
+  // avdec_*, libde265dec: max-threads; dav1ddec: n-threads; vpxdec: threads
+  if (g_object_class_find_property (klass, "max-threads"))
+    g_object_set (element, "max-threads", cores, NULL);
+  if (g_object_class_find_property (klass, "n-threads"))
+    g_object_set (element, "n-threads", (guint) cores, NULL);
+  if (g_object_class_find_property (klass, "threads"))
+    g_object_set (element, "threads", cores, NULL);
+  if (g_object_class_find_property (klass, "thread-type"))
+    gst_util_set_object_arg (G_OBJECT (element), "thread-type", "frame+slice");
+}
+/* Streaming thread, after the decode-ahead queue: drop a frame that is
+   already too late to be shown on time, rather than spend conversion and
+   display on it and fall further behind. The deadline is the sink's: the
+   running time plus the pipeline latency, which with frame-threaded
+   decoders is several frames, plus HIRES_MAX_LATENESS. data points to the
+   latency, taken from the LATENCY event on its way upstream from the sink;
+   the pad's object lock guards it. */
+static GstPadProbeReturn
+drop_late_cb (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  GstClockTime *pipeline_latency = (GstClockTime *) data;
+  GstElement *element = GST_PAD_PARENT (pad);
+  GstBuffer *buffer;
+  GstClockTime running = GST_CLOCK_TIME_NONE, now, latency;
+  GstEvent *event;
+  GstClock *clock;
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_UPSTREAM)
+    {
+      event = GST_PAD_PROBE_INFO_EVENT (info);
+      if (GST_EVENT_TYPE (event) == GST_EVENT_LATENCY)
+        {
+          gst_event_parse_latency (event, &latency);
+          GST_OBJECT_LOCK (pad);
+          *pipeline_latency = latency;
+          GST_OBJECT_UNLOCK (pad);
+        }
+      return GST_PAD_PROBE_OK;
+    }
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  if (GST_STATE (element) != GST_STATE_PLAYING
+      || !GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+  event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  if (event)
+    {
+      const GstSegment *segment;
+      gst_event_parse_segment (event, &segment);
+      running = gst_segment_to_running_time (segment, GST_FORMAT_TIME,
+          GST_BUFFER_PTS (buffer));
+      gst_event_unref (event);
+    }
+  clock = gst_element_get_clock (element);
+  if (!clock || !GST_CLOCK_TIME_IS_VALID (running))
+    {
+      if (clock)
+        gst_object_unref (clock);
+      return GST_PAD_PROBE_OK;
+    }
+  now = gst_clock_get_time (clock) - gst_element_get_base_time (element);
+  gst_object_unref (clock);
+  GST_OBJECT_LOCK (pad);
+  latency = *pipeline_latency;
+  GST_OBJECT_UNLOCK (pad);
+  if (now > running + latency + HIRES_MAX_LATENESS)
+    {
+      g_atomic_int_inc (&late_frames);
+      return GST_PAD_PROBE_DROP;
+    }
+  return GST_PAD_PROBE_OK;
+}
+/* Puts drop_late_cb on the source pad of a decode-ahead queue */
+static void
+add_drop_late_probe (GstElement * queue)
+{
+  GstPad *pad = gst_element_get_static_pad (queue, "src");
+  gst_pad_add_probe (pad, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER |
+          GST_PAD_PROBE_TYPE_EVENT_UPSTREAM), drop_late_cb,
+      g_new0 (GstClockTime, 1), g_free);
+  gst_object_unref (pad);
+}
+/* The video sink of the high-resolution profile: the decode-ahead queue,
+   the late-frame drop, then conversion and display */
+static GstElement *
+make_hires_video_sink (void)
+{
+  gchar *description = g_strdup_printf ("queue name=decode_ahead "
+      "max-size-buffers=%d max-size-bytes=0 max-size-time=0 ! videoconvert ! "
+      "xvimagesink qos=true max-lateness=%" G_GINT64_FORMAT,
+      HIRES_DECODE_AHEAD, (gint64) HIRES_MAX_LATENESS);
+  GstElement *video_sink = gst_parse_bin_from_description (description, TRUE,
+      NULL);
+  GstElement *queue;
+  g_free (description);
+  if (!video_sink)
+    return NULL;
+  queue = gst_bin_get_by_name (GST_BIN (video_sink), "decode_ahead");
+  add_drop_late_probe (queue);
+  gst_object_unref (queue);
+  return video_sink;
+}
+static gboolean
+report_late_frames_cb (gpointer data)
+{
+  gint dropped = g_atomic_int_and (&late_frames, 0);
+  if (dropped > 0)
+    g_print ("hires: dropped %d late frames\n", dropped);
+  return G_SOURCE_CONTINUE;
+}
+/* Frames reaching the end of a --bench pass */
+typedef struct
+{
+  guint frames;
+  gint64 first_us;
+  gint64 last_us;
+} BenchCount;
+static GstPadProbeReturn
+bench_count_cb (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  BenchCount *count = (BenchCount *) data;
+  count->last_us = g_get_monotonic_time ();
+  if (count->frames++ == 0)
+    count->first_us = count->last_us;
+  return GST_PAD_PROBE_OK;
+}
+/* One --bench pass over uri with the high-resolution profile: decoding as
+   fast as possible, or in real time through the same conversion, QoS and
+   late-frame policy as make_hires_video_sink, with a sink that does not
+   draw. Returns the frames per second that came out, and the nominal rate
+   in *nominal. */
+static gdouble
+bench_pass (const gchar * uri, gboolean real_time, gdouble * nominal)
+{
+  gchar *description = real_time
+      ? g_strdup_printf ("uridecodebin name=decode ! queue name=decode_ahead "
+      "max-size-buffers=%d max-size-bytes=0 max-size-time=0 ! videoconvert ! "
+      "fakevideosink name=sink sync=true qos=true max-lateness=%"
+      G_GINT64_FORMAT, HIRES_DECODE_AHEAD, (gint64) HIRES_MAX_LATENESS)
+      : g_strdup_printf ("uridecodebin name=decode ! queue name=decode_ahead "
+      "max-size-buffers=%d max-size-bytes=0 max-size-time=0 ! "
+      "fakesink name=sink sync=false", HIRES_DECODE_AHEAD);
+  GstElement *bench = gst_parse_launch (description, NULL);
+  GstElement *decode, *queue, *sink;
+  GstCaps *caps;
+  GstPad *pad;
+  GstBus *bench_bus;
+  GstMessage *message;
+  BenchCount count = { 0, 0, 0 };
+  gint num, den;
+  g_free (description);
+  if (!bench)
+    return 0;
+  decode = gst_bin_get_by_name (GST_BIN (bench), "decode");
+  queue = gst_bin_get_by_name (GST_BIN (bench), "decode_ahead");
+  sink = gst_bin_get_by_name (GST_BIN (bench), "sink");
+  caps = gst_caps_new_empty_simple ("video/x-raw");
+  g_object_set (decode, "uri", uri, "caps", caps, "expose-all-streams", FALSE,
+      NULL);
+  gst_caps_unref (caps);
+  g_signal_connect (bench, "deep-element-added",
+      G_CALLBACK (hires_element_added_cb), NULL);
+  if (real_time)
+    add_drop_late_probe (queue);
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, bench_count_cb, &count,
+      NULL);
+  gst_element_set_state (bench, GST_STATE_PLAYING);
+  bench_bus = gst_element_get_bus (bench);
+  message = gst_bus_timed_pop_filtered (bench_bus, BENCH_SECONDS * GST_SECOND,
+      (GstMessageType) (GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  if (message && GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR)
+    {
+      GError *err = NULL;
+      gst_message_parse_error (message, &err, NULL);
+      g_printerr ("Benchmark failed: %s\n", err->message);
+      g_clear_error (&err);
+    }
+  if (message)
+    gst_message_unref (message);
+  caps = gst_pad_get_current_caps (pad);
+  if (caps && gst_structure_get_fraction (gst_caps_get_structure (caps, 0),
+          "framerate", &num, &den) && den > 0)
+    *nominal = (gdouble) num / den;
+  if (caps)
+    gst_caps_unref (caps);
+  gst_element_set_state (bench, GST_STATE_NULL);
+  gst_object_unref (pad);
+  gst_object_unref (bench_bus);
+  gst_object_unref (sink);
+  gst_object_unref (queue);
+  gst_object_unref (decode);
+  gst_object_unref (bench);
+  if (count.frames < 2)
+    return 0;
+  return (count.frames - 1) * 1e6 / (count.last_us - count.first_us);
+}
+/* --bench FILE: how fast the high-resolution profile decodes the file,
+   and how many frames it shows in real time */
+static int
+run_benchmark (const gchar * location)
+{
+  gchar *uri = gst_uri_is_valid (location) ? g_strdup (location)
+      : gst_filename_to_uri (location, NULL);
+  gdouble nominal = 0, decoded, displayed;
+  gint dropped;
+  if (!uri)
+    {
+      g_printerr ("Cannot benchmark %s: not a file or URI\n", location);
+      return 1;
+    }
+  decoded = bench_pass (uri, FALSE, &nominal);
+  g_atomic_int_set (&late_frames, 0);
+  displayed = bench_pass (uri, TRUE, &nominal);
+  dropped = g_atomic_int_get (&late_frames);
+  g_print ("%s\n", location);
+  g_print ("  decoded: %.1f fps with %d threads per decoder\n", decoded,
+      g_get_num_processors ());
+  g_print ("  displayed: %.1f fps of %.2f nominal, %d late frames dropped\n",
+      displayed, nominal, dropped);
+  if (nominal > 0)
+    g_print ("  %s (decoding at %.0f%% of real time)\n",
+        decoded >= nominal ? "keeps up" : "cannot keep up",
+        100 * decoded / nominal);
+  g_free (uri);
+  return 0;
+}
+/* Show the item on screen and its place in the playlist in the title */
+static void
+update_title (void)
+{
+  gchar *uri = NULL, *name, *title;
+  guint index, length;
+  g_object_get (G_OBJECT (pipeline), "current-uri", &uri, NULL);
+  if (!uri)
+    return;
+  G_LOCK (playlist);
+  length = playlist ? playlist->len : 0;
+  for (index = 0; index < length; index++)
+    if (g_strcmp0 (uri, (const gchar *) g_ptr_array_index (playlist, index)) == 0)
+      break;
+  G_UNLOCK (playlist);
+  name = g_path_get_basename (uri);
+  if (length > 1 && index < length)
+    title = g_strdup_printf ("%s (%u/%u)", name, index + 1, length);
+  else
+    title = g_strdup (name);
+  gtk_window_set_title (GTK_WINDOW (main_window), title);
+  {
+    gchar *file_uri = local_file_uri (uri);
+    request_keyframe_index (file_uri);
+    g_free (file_uri);
+  }
+  g_free (title);
+  g_free (name);
+  g_free (uri);
+}
+/* A progressive download: the file queue2 writes for one network item.
+   Complete once queue2 holds the whole resource in one range. */
+typedef struct
+{
+  GstElement *queue;
+  gchar *uri;
+  gchar *file;
+  gboolean complete;
+} Download;
+static Download *download = NULL;
+static gchar *
+download_cache_dir (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "video-gui", "downloads",
+      NULL);
+}
+static gchar *
+cached_download_path (const gchar * uri)
+{
+  gchar *hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, uri, -1);
+  gchar *name = g_strconcat (hash, ".media", NULL);
+  gchar *dir = download_cache_dir ();
+  gchar *path = g_build_filename (dir, name, NULL);
+  g_free (dir);
+  g_free (name);
+  g_free (hash);
+  return path;
+}
+/* The URI to play for uri: its cached copy if it was fully downloaded
+   before, otherwise uri itself */
+static gchar *
+playable_uri (const gchar * uri)
+{
+  gchar *path, *cached = NULL;
+  // the appsrc URI keeps the path, for the source and for display
+  if (mmap_source && g_str_has_prefix (uri, "file://"))
+    return g_strconcat ("appsrc://", uri + strlen ("file://"), NULL);
+  if (!g_str_has_prefix (uri, "http://") && !g_str_has_prefix (uri, "https://"))
+    return g_strdup (uri);
+  path = cached_download_path (uri);
+  if (g_file_test (path, G_FILE_TEST_IS_REGULAR))
+    {
+      // the mtime orders eviction, so it records the last use
+      g_utime (path, NULL);
+      cached = g_filename_to_uri (path, NULL, NULL);
+    }
+  g_free (path);
+  return cached ? cached : g_strdup (uri);
+}
+/* A cached download, for eviction */
+typedef struct
+{
+  gchar *path;
+  gint64 mtime;
+  guint64 size;
+} CachedFile;
+static void
+cached_file_free (gpointer data)
+{
+  g_free (((CachedFile *) data)->path);
+  g_free (data);
+}
+static gint
+compare_mtime (gconstpointer a, gconstpointer b)
+{
+  const CachedFile *x = *(const CachedFile * const *) a;
+  const CachedFile *y = *(const CachedFile * const *) b;
+  return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+/* Delete the least recently used downloads until the rest fit the budget.
+   With stale TRUE, left-over partial files are removed too. */
+static void
+trim_download_cache (gboolean stale)
+{
+  gchar *dir_path = download_cache_dir ();
+  GDir *dir = g_dir_open (dir_path, 0, NULL);
+  GPtrArray *files = g_ptr_array_new_with_free_func (cached_file_free);
+  const gchar *name;
+  guint64 total = 0;
+  guint i;
+  while (dir && (name = g_dir_read_name (dir)))
+    {
+      gchar *path = g_build_filename (dir_path, name, NULL);
+      GStatBuf st;
+      if (stale && g_str_has_prefix (name, "partial-"))
+        g_unlink (path);
+      else if (g_str_has_suffix (name, ".media") && g_stat (path, &st) == 0)
+        {
+          CachedFile *file = g_new (CachedFile, 1);
+          file->path = path;
+          file->mtime = st.st_mtime;
+          file->size = st.st_size;
+          g_ptr_array_add (files, file);
+          total += file->size;
+          continue;
+        }
+      g_free (path);
+    }
+  g_ptr_array_sort (files, compare_mtime);
+  for (i = 0; i < files->len && total > cache_budget; i++)
+    {
+      CachedFile *file = (CachedFile *) g_ptr_array_index (files, i);
+      if (g_unlink (file->path) == 0)
+        total -= file->size;
+    }
+  g_ptr_array_unref (files);
+  if (dir)
+    g_dir_close (dir);
+  g_free (dir_path);
+}
+/* Main thread: a download ended (its item was left, or the player quit).
+   A complete one goes into the cache; anything else is deleted. */
+static void
+finish_download (Download * finished)
+{
+  if (finished->file)
+    {
+      gchar *path = cached_download_path (finished->uri);
+      if (!finished->complete || g_rename (finished->file, path) != 0)
+        g_unlink (finished->file);
+      else
+        trim_download_cache (FALSE);
+      g_free (path);
+    }
+  gst_object_unref (finished->queue);
+  g_free (finished->uri);
+  g_free (finished->file);
+  g_free (finished);
+}
+static gboolean
+finish_download_cb (gpointer data)
+{
+  Download *finished = (Download *) data;
+  if (finished == download)
+    download = NULL;
+  finish_download (finished);
+  return G_SOURCE_REMOVE;
+}
+static gboolean
+start_download_cb (gpointer data)
+{
+  if (download)
+    finish_download (download);
+  download = (Download *) data;
+  return G_SOURCE_REMOVE;
+}
+/* Main thread: note whether queue2 has the whole resource yet */
+static void
+update_download (void)
+{
+  GstQuery *query;
+  gint64 start, stop, total;
+  if (!download || download->complete)
+    return;
+  if (!download->file)
+    g_object_get (download->queue, "temp-location", &download->file, NULL);
+  query = gst_query_new_buffering (GST_FORMAT_BYTES);
+  if (gst_element_query (download->queue, query)
+      && gst_element_query_duration (download->queue, GST_FORMAT_BYTES, &total)
+      && (guint64) total <= ring_buffer_size
+      && gst_query_get_n_buffering_ranges (query) == 1
+      && gst_query_parse_nth_buffering_range (query, 0, &start, &stop))
+    download->complete = start == 0 && stop >= total;
+  gst_query_unref (query);
+}
+/* Streaming thread: playbin made a queue2 for a network source. Point its
+   download file into the cache directory and keep it when done. */
+static void
+element_added_cb (GstBin * bin, GstBin * sub_bin, GstElement * element,
+    gpointer data)
+{
+  GstElementFactory *factory = gst_element_get_factory (element);
+  GstObject *parent;
+  Download *started;
+  gchar *dir, *template_path;
+  if (!factory || g_strcmp0 (GST_OBJECT_NAME (factory), "queue2") != 0)
+    return;
+  dir = download_cache_dir ();
+  g_mkdir_with_parents (dir, 0755);
+  template_path = g_build_filename (dir, "partial-XXXXXX", NULL);
+  g_object_set (element, "temp-template", template_path, "temp-remove", FALSE,
+      NULL);
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (element),
+          "low-watermark"))
+    g_object_set (element, "low-watermark", low_watermark, "high-watermark",
+        high_watermark, NULL);
+  else
+    g_object_set (element, "low-percent", (gint) (low_watermark * 100),
+        "high-percent", (gint) (high_watermark * 100), NULL);
+  g_free (template_path);
+  g_free (dir);
+  // the closest bin with a uri is the source bin for this item
+  started = g_new0 (Download, 1);
+  started->queue = GST_ELEMENT (gst_object_ref (element));
+  for (parent = gst_object_get_parent (GST_OBJECT (element)); parent;)
+    {
+      GstObject *next;
+      if (g_object_class_find_property (G_OBJECT_GET_CLASS (parent), "uri"))
+        {
+          g_object_get (parent, "uri", &started->uri, NULL);
+          gst_object_unref (parent);
+          break;
+        }
+      next = gst_object_get_parent (parent);
+      gst_object_unref (parent);
+      parent = next;
+    }
+  g_idle_add (start_download_cb, started);
+}
+static gboolean
+match_download_cb (gpointer data)
+{
+  GstElement *queue = GST_ELEMENT (data);
+  if (download && download->queue == queue)
+    {
+      update_download ();
+      finish_download_cb (download);
+    }
+  gst_object_unref (queue);
+  return G_SOURCE_REMOVE;
+}
+/* Streaming thread: an item's source is being torn down */
+static void
+element_removed_cb (GstBin * bin, GstBin * sub_bin, GstElement * element,
+    gpointer data)
+{
+  GstElementFactory *factory = gst_element_get_factory (element);
+  if (factory && g_strcmp0 (GST_OBJECT_NAME (factory), "queue2") == 0)
+    g_idle_add (match_download_cb, gst_object_ref (element));
+}
+/* Show or hide the progress of an open; text NULL hides it */
+static void
+show_open_status (const gchar * text, gboolean busy)
+{
+  gtk_widget_set_visible (open_status, text != NULL);
+  gtk_widget_set_visible (open_cancel, busy);
+  gtk_widget_set_visible (open_spinner, busy);
+  if (busy)
+    gtk_spinner_start (GTK_SPINNER (open_spinner));
+  else
+    gtk_spinner_stop (GTK_SPINNER (open_spinner));
+  if (text)
+    gtk_label_set_text (GTK_LABEL (open_status), text);
+}
+/* An open handed to the pipeline's state-change thread */
+typedef struct
+{
+  gint generation;
+  GPtrArray *items;
+} OpenRequest;
+/* Pipeline thread: tear down the current item and preroll the new one.
+   State changes can block (stopping streaming threads, connecting to a
+   server), which is why they are not made on the UI thread. */
+static void
+open_async_cb (GstElement * element, gpointer data)
+{
+  OpenRequest *request = (OpenRequest *) data;
+  G_LOCK (state_change);
+  // a newer open or a cancel came in while this one was queued
+  if (request->generation == g_atomic_int_get (&open_generation))
+    {
+      gst_element_set_state (element, GST_STATE_READY);
+      set_playlist (request->items);
+      request->items = NULL;
+      // messages after this mark are about this open's preroll; an
+      // ASYNC_DONE before it is from an older item or a seek
+      gst_element_post_message (element,
+          gst_message_new_application (GST_OBJECT (element),
+              gst_structure_new ("open-preroll", "generation", G_TYPE_INT,
+                  request->generation, NULL)));
+      gst_element_set_state (element, GST_STATE_PAUSED);
+    }
+  G_UNLOCK (state_change);
+  if (request->items)
+    g_ptr_array_unref (request->items);
+  g_free (request);
+}
+/* Start opening items (URIs, owned by the request) without blocking the
+   UI; playback starts when the preroll is done. Supersedes any open still
+   in progress. */
+static void
+begin_open (GPtrArray * items)
+{
+  OpenRequest *request = g_new0 (OpenRequest, 1);
+  request->generation = g_atomic_int_add (&open_generation, 1) + 1;
+  request->items = items;
+  opening = TRUE;
+  buffering = FALSE;
+  user_paused = FALSE;
+  show_open_status ("Opening...", TRUE);
+  gst_element_call_async (pipeline, open_async_cb, request, NULL);
+}
+/* Pipeline thread: stop, unless an open came after the stop was asked
+   for; data is the open generation at that time */
+static void
+stop_async_cb (GstElement * element, gpointer data)
+{
+  G_LOCK (state_change);
+  if (GPOINTER_TO_INT (data) == g_atomic_int_get (&open_generation))
+    gst_element_set_state (element, GST_STATE_READY);
+  G_UNLOCK (state_change);
+}
+/* Pipeline thread: the playlist played out, go back to its first item and
+   preroll it paused; data is the open generation at the EOS, so a newer
+   open is not undone */
+static void
+rewind_async_cb (GstElement * element, gpointer data)
+{
+  gchar *uri = NULL;
+  G_LOCK (state_change);
+  if (GPOINTER_TO_INT (data) == g_atomic_int_get (&open_generation))
+    {
+      gst_element_set_state (element, GST_STATE_READY);
+      G_LOCK (playlist);
+      playlist_index = 0;
+      if (playlist && playlist->len > 0)
+        uri = g_strdup ((const gchar *) g_ptr_array_index (playlist, 0));
+      G_UNLOCK (playlist);
+      if (uri)
+        g_object_set (G_OBJECT (element), "uri", uri, NULL);
+      gst_element_set_state (element, GST_STATE_PAUSED);
+    }
+  G_UNLOCK (state_change);
+  g_free (uri);
+}
+/* This function is called when the Cancel button of an open is clicked */
+static void
+cancel_open_cb (GtkButton * button, gpointer data)
+{
+  gint generation = g_atomic_int_add (&open_generation, 1) + 1;
+  opening = FALSE;
+  show_open_status (NULL, FALSE);
+  gst_element_call_async (pipeline, stop_async_cb,
+      GINT_TO_POINTER (generation), NULL);
+}
+static gboolean
+bus_cb (GstBus * bus, GstMessage * message, gpointer user_data)
+{
+  switch (GST_MESSAGE_TYPE (message))
+    {
+    case GST_MESSAGE_BUFFERING:
+      {
+        gint percent;
+        gchar *text;
+        gst_message_parse_buffering (message, &percent);
+        update_download ();
+        // pause while the buffer refills, unless the user paused anyway
+        if (percent < 100 && !buffering)
+          {
+            buffering = TRUE;
+            if (!opening && !user_paused)
+              gst_element_set_state (pipeline, GST_STATE_PAUSED);
+          }
+        else if (percent == 100 && buffering)
+          {
+            buffering = FALSE;
+            if (!opening && !user_paused)
+              gst_element_set_state (pipeline, GST_STATE_PLAYING);
+          }
+        text = g_strdup_printf (opening ? "Opening... %d%%" : "Buffering %d%%",
+            percent);
+        show_open_status (opening || buffering ? text : NULL, opening);
+        g_free (text);
+        break;
+      }
+    case GST_MESSAGE_APPLICATION:
+      if (gst_message_has_name (message, "open-preroll"))
+        gst_structure_get_int (gst_message_get_structure (message),
+            "generation", &preroll_generation);
+      break;
+    case GST_MESSAGE_ASYNC_DONE:
+      // the preroll of the latest open finished. Seeks also post this, and
+      // so does the item an open supersedes.
+      if (opening
+          && preroll_generation == g_atomic_int_get (&open_generation))
+        {
+          opening = FALSE;
+          show_open_status (NULL, FALSE);
+          if (!buffering && !user_paused)
+            gst_element_set_state (pipeline, GST_STATE_PLAYING);
+        }
+      break;
+    case GST_MESSAGE_STREAM_START:
+      // posted when the next item actually starts playing, at normal rate
+      playback_rate = 1.0;
+      gtk_label_set_text (GTK_LABEL (rate_label), "");
+      update_title ();
+      break;
+    case GST_MESSAGE_EOS:
+      // rewinding reached the start of the item: back to normal rate
+      // there, paused on its first frame
+      if (playback_rate < 0)
+        {
+          playback_rate = 1.0;
+          gtk_label_set_text (GTK_LABEL (rate_label), "");
+          user_paused = TRUE;
+          gst_element_set_state (pipeline, GST_STATE_PAUSED);
+          seek_to (0, GST_SEEK_FLAG_ACCURATE);
+          break;
+        }
+      // end of a playlist that does not loop; rewind to its first item
+      playback_rate = 1.0;
+      gtk_label_set_text (GTK_LABEL (rate_label), "");
+      gst_element_call_async (pipeline, rewind_async_cb,
+          GINT_TO_POINTER (g_atomic_int_get (&open_generation)), NULL);
+      break;
+    case GST_MESSAGE_ERROR:
+      {
+        GError *err = NULL;
+        gchar *debug = NULL;
+        gst_message_parse_error (message, &err, &debug);
+        g_printerr ("Error from %s: %s\n", GST_OBJECT_NAME (message->src),
+            err->message);
+        if (debug)
+          g_printerr ("%s\n", debug);
+        if (opening)
+          {
+            gchar *text = g_strdup_printf ("Cannot open: %s", err->message);
+            opening = FALSE;
+            show_open_status (text, FALSE);
+            g_free (text);
+          }
+        g_clear_error (&err);
+        g_free (debug);
+        gst_element_call_async (pipeline, stop_async_cb,
+            GINT_TO_POINTER (g_atomic_int_get (&open_generation)), NULL);
+        break;
+      }
+    default:
+      break;
+    }
+  return TRUE;
+}
 /* This function is called when the PLAY button is clicked */
 static void
 play_cb (GtkButton * button, GstElement * pipeline)
 {
+  if (playback_rate != 1.0)
+    set_rate (1.0);
+  user_paused = FALSE;
+  if (!buffering)
+    gst_element_set_state (pipeline, GST_STATE_PLAYING);
+}
+/* These functions are called when the << and >> buttons are clicked. Each
+   click doubles the trick-mode rate, from 2x up to 32x. */
+static void
+rewind_cb (GtkButton * button, gpointer data)
+{
+  user_paused = FALSE;
+  set_rate (playback_rate <= -2.0 ? MAX (playback_rate * 2, -32.0) : -2.0);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+}
+static void
+forward_cb (GtkButton * button, gpointer data)
+{
+  user_paused = FALSE;
+  set_rate (playback_rate >= 2.0 ? MIN (playback_rate * 2, 32.0) : 2.0);
   gst_element_set_state (pipeline, GST_STATE_PLAYING);
 }
 /* This function is called when the PAUSE button is clicked */
 static void
 pause_cb (GtkButton * button, GstElement * pipeline)
 {
+  user_paused = TRUE;
   gst_element_set_state (pipeline, GST_STATE_PAUSED);
 }
-/* This function is called when the PAUSE button is clicked */
+/* This function is called when the open dialog is answered. The files
+   are checked before anything is stopped, so a bad choice leaves the
+   current playback alone. */
+static void
+open_response_cb (GtkDialog * dialog, gint response, gpointer data)
+{
+  if (response == GTK_RESPONSE_ACCEPT)
+    {
+      GSList *filenames, *item;
+      GPtrArray *items = g_ptr_array_new_with_free_func (g_free);
+      gchar *problem = NULL;
+      filenames = gtk_file_chooser_get_filenames (GTK_FILE_CHOOSER (dialog));
+      for (item = filenames; item; item = item->next)
+        {
+          const gchar *filename = (const gchar *) item->data;
+          GError *err = NULL;
+          gchar *uri = NULL;
+          if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR)
+              || g_access (filename, R_OK) != 0)
+            problem = g_strdup_printf ("Cannot read %s", filename);
+          else if (!(uri = gst_filename_to_uri (filename, &err)))
+            problem = g_strdup_printf ("%s: %s", filename, err->message);
+          g_clear_error (&err);
+          if (problem)
+            break;
+          g_ptr_array_add (items, uri);
+        }
+      g_slist_free_full (filenames, g_free);
+      if (problem)
+        {
+          show_open_status (problem, FALSE);
+          g_free (problem);
+          g_ptr_array_unref (items);
+          return;
+        }
+      if (items->len > 0)
+        begin_open (items);
+      else
+        g_ptr_array_unref (items);
+    }
+  gtk_widget_destroy (GTK_WIDGET (dialog));
+}
+/* This function is called when the OPEN button is clicked. The dialog is
+   not modal and playback goes on while it is up. */
 static void
 open_cb (GtkButton * button, GstElement * pipeline)
 {
-  gst_element_set_state (pipeline, GST_STATE_READY);
-  GtkWidget *dialog;
-  GtkFileChooserAction action = GTK_FILE_CHOOSER_ACTION_OPEN;
-  gint res;
-  dialog = gtk_file_chooser_dialog_new ("Open File",
-                    NULL,
-                    action,
+  if (open_dialog)
+    {
+      gtk_window_present (GTK_WINDOW (open_dialog));
+      return;
+    }
+  open_dialog = gtk_file_chooser_dialog_new ("Open File",
+                    GTK_WINDOW (main_window),
+                    GTK_FILE_CHOOSER_ACTION_OPEN,
                     "Cancel",
                     GTK_RESPONSE_CANCEL,
                     "_Open", GTK_RESPONSE_ACCEPT, NULL);
-  res = gtk_dialog_run (GTK_DIALOG (dialog));
-  if (res == GTK_RESPONSE_ACCEPT)
+  // several files make a playlist, played in the order selected
+  gtk_file_chooser_set_select_multiple (GTK_FILE_CHOOSER (open_dialog), TRUE);
+  g_signal_connect (open_dialog, "response", G_CALLBACK (open_response_cb),
+            NULL);
+  g_signal_connect (open_dialog, "destroy",
+            G_CALLBACK (gtk_widget_destroyed), &open_dialog);
+  gtk_widget_show (open_dialog);
+}
+/* One file of the media library. Files the discoverer could not use are
+   kept too, as not playable, so they are only probed again once their size
+   or mtime changes. */
+typedef struct
+{
+  gchar *path;
+  gint64 mtime;
+  guint64 size;
+  guint64 duration;         // nanoseconds
+  guint width;
+  guint height;
+  guint bitrate;            // bits per second, whole file
+  gchar *video_codec;
+  gchar *audio_codec;
+  gboolean playable;
+} LibraryEntry;
+// the index as last loaded or scanned, sorted by path; main thread
+static GPtrArray *library = NULL;
+static gboolean library_scanning = FALSE;
+static void
+library_entry_free (gpointer data)
+{
+  LibraryEntry *entry = (LibraryEntry *) data;
+  g_free (entry->path);
+  g_free (entry->video_codec);
+  g_free (entry->audio_codec);
+  g_free (entry);
+}
+static gint
+compare_library_path (gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0 ((*(LibraryEntry * const *) a)->path,
+      (*(LibraryEntry * const *) b)->path);
+}
+static gchar *
+library_index_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "video-gui",
+      "library.gvariant", NULL);
+}
+/* The directories to scan: [library] directories in
+   ~/.config/video-gui/library.ini, or the user's Videos folder */
+static gchar **
+library_directories (void)
+{
+  gchar *path = g_build_filename (g_get_user_config_dir (), "video-gui",
+      "library.ini", NULL);
+  GKeyFile *config = g_key_file_new ();
+  gchar **directories = NULL;
+  if (g_key_file_load_from_file (config, path, G_KEY_FILE_NONE, NULL))
+    directories = g_key_file_get_string_list (config, "library",
+        "directories", NULL, NULL);
+  if (!directories)
+    {
+      const gchar *videos = g_get_user_special_dir (G_USER_DIRECTORY_VIDEOS);
+      directories = g_new0 (gchar *, 2);
+      directories[0] = videos ? g_strdup (videos)
+          : g_build_filename (g_get_home_dir (), "Videos", NULL);
+    }
+  g_key_file_unref (config);
+  g_free (path);
+  return directories;
+}
+/* The index is a single serialised GVariant, mapped on load, so reading
+   thousands of entries costs one file read and no probing */
+static GPtrArray *
+load_library_index (void)
+{
+  gchar *path = library_index_path ();
+  GMappedFile *mapped = g_mapped_file_new (path, FALSE, NULL);
+  GPtrArray *entries = g_ptr_array_new_with_free_func (library_entry_free);
+  g_free (path);
+  if (mapped)
+    {
+      GBytes *bytes = g_mapped_file_get_bytes (mapped);
+      GVariant *index = g_variant_new_from_bytes (
+          G_VARIANT_TYPE (LIBRARY_INDEX_TYPE), bytes, FALSE);
+      GVariantIter *iter;
+      guint32 version;
+      LibraryEntry entry;
+      g_variant_get (index, "(ua(sxtttuuussb))", &version, &iter);
+      while (version == LIBRARY_INDEX_VERSION
+          && g_variant_iter_next (iter, "(sxtttuuussb)", &entry.path,
+              &entry.mtime, &entry.size, &entry.duration, &entry.width,
+              &entry.height, &entry.bitrate, &entry.video_codec,
+              &entry.audio_codec, &entry.playable))
+        {
+          LibraryEntry *copy = g_new (LibraryEntry, 1);
+          *copy = entry;
+          g_ptr_array_add (entries, copy);
+        }
+      g_variant_iter_free (iter);
+      g_variant_unref (index);
+      g_bytes_unref (bytes);
+      g_mapped_file_unref (mapped);
+    }
+  return entries;
+}
+static void
+save_library_index (GPtrArray * entries)
+{
+  gchar *path = library_index_path ();
+  gchar *dir = g_path_get_dirname (path);
+  GVariantBuilder builder;
+  GVariant *index;
+  guint i;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sxtttuuussb)"));
+  for (i = 0; i < entries->len; i++)
+    {
+      LibraryEntry *entry = (LibraryEntry *) g_ptr_array_index (entries, i);
+      g_variant_builder_add (&builder, "(sxtttuuussb)", entry->path,
+          entry->mtime, entry->size, entry->duration, entry->width,
+          entry->height, entry->bitrate, entry->video_codec,
+          entry->audio_codec, entry->playable);
+    }
+  index = g_variant_ref_sink (g_variant_new ("(ua(sxtttuuussb))",
+          LIBRARY_INDEX_VERSION, &builder));
+  if (g_mkdir_with_parents (dir, 0755) != 0
+      || !g_file_set_contents (path, (const gchar *) g_variant_get_data (index),
+          g_variant_get_size (index), NULL))
+    g_printerr ("Cannot save the media library in %s\n", path);
+  g_variant_unref (index);
+  g_free (dir);
+  g_free (path);
+}
+static gboolean
+is_media_file (const gchar * name)
+{
+  static const gchar *extensions[] = { ".mp4", ".m4v", ".mkv", ".webm",
+    ".mov", ".avi", ".ts", ".mpg", ".mpeg", ".ogv", ".flv", NULL
+  };
+  gchar *lower = g_ascii_strdown (name, -1);
+  gboolean media = FALSE;
+  guint i;
+  for (i = 0; extensions[i] && !media; i++)
+    media = g_str_has_suffix (lower, extensions[i]);
+  g_free (lower);
+  return media;
+}
+/* Probe one file with the discoverer; an entry that is not playable if it
+   has no usable streams or timed out */
+static LibraryEntry *
+discover_library_entry (GstDiscoverer * discoverer, const gchar * path,
+    GStatBuf * st)
+{
+  gchar *uri = g_filename_to_uri (path, NULL, NULL);
+  GstDiscovererInfo *info = uri ? gst_discoverer_discover_uri (discoverer,
+      uri, NULL) : NULL;
+  LibraryEntry *entry = NULL;
+  GList *streams;
+  g_free (uri);
+  if (info && gst_discoverer_info_get_result (info) == GST_DISCOVERER_OK)
+    {
+      entry = g_new0 (LibraryEntry, 1);
+      entry->playable = TRUE;
+      entry->duration = gst_discoverer_info_get_duration (info);
+      streams = gst_discoverer_info_get_video_streams (info);
+      if (streams)
+        {
+          GstDiscovererStreamInfo *stream =
+              (GstDiscovererStreamInfo *) streams->data;
+          GstCaps *caps = gst_discoverer_stream_info_get_caps (stream);
+          entry->width = gst_discoverer_video_info_get_width (
+              GST_DISCOVERER_VIDEO_INFO (stream));
+          entry->height = gst_discoverer_video_info_get_height (
+              GST_DISCOVERER_VIDEO_INFO (stream));
+          entry->video_codec = caps ? gst_pb_utils_get_codec_description (caps)
+              : NULL;
+          if (caps)
+            gst_caps_unref (caps);
+        }
+      gst_discoverer_stream_info_list_free (streams);
+      streams = gst_discoverer_info_get_audio_streams (info);
+      if (streams)
+        {
+          GstCaps *caps = gst_discoverer_stream_info_get_caps (
+              (GstDiscovererStreamInfo *) streams->data);
+          entry->audio_codec = caps ? gst_pb_utils_get_codec_description (caps)
+              : NULL;
+          if (caps)
+            gst_caps_unref (caps);
+        }
+      gst_discoverer_stream_info_list_free (streams);
+      // stream bitrates are often missing; the file's average is not
+      if (entry->duration > 0)
+        entry->bitrate = (guint) gst_util_uint64_scale (st->st_size, 8 * GST_SECOND,
+            entry->duration);
+    }
+  if (info)
+    gst_discoverer_info_unref (info);
+  if (!entry)
+    entry = g_new0 (LibraryEntry, 1);
+  entry->path = g_strdup (path);
+  entry->mtime = st->st_mtime;
+  entry->size = st->st_size;
+  if (!entry->video_codec)
+    entry->video_codec = g_strdup ("");
+  if (!entry->audio_codec)
+    entry->audio_codec = g_strdup ("");
+  return entry;
+}
+/* Add the media files under dir to entries, reusing known entries (the
+   playable ones and the others) whose size and mtime are unchanged. Sets
+   *changed if anything was probed. */
+static void
+scan_library_directory (const gchar * dir_path, GHashTable * known,
+    GstDiscoverer * discoverer, GPtrArray * entries, gboolean * changed)
+{
+  GDir *dir = g_dir_open (dir_path, 0, NULL);
+  const gchar *name;
+  while (dir && (name = g_dir_read_name (dir)))
     {
-      char *filename;
-      char video_loc[100] = "file://";
-      GtkFileChooser *chooser = GTK_FILE_CHOOSER (dialog);
-      filename = gtk_file_chooser_get_filename (chooser);
-      strcat (video_loc, filename);
-      g_object_set (G_OBJECT (pipeline), "uri", video_loc, NULL);
-      gst_element_set_state (pipeline, GST_STATE_PLAYING);
-      g_free (filename);
+      gchar *path;
+      GStatBuf st;
+      if (name[0] == '.')
+        continue;
+      path = g_build_filename (dir_path, name, NULL);
+      // linked directories are not followed, so a link loop cannot trap us
+      if (g_lstat (path, &st) == 0 && S_ISDIR (st.st_mode))
+        scan_library_directory (path, known, discoverer, entries, changed);
+      else if (g_stat (path, &st) == 0 && S_ISREG (st.st_mode)
+          && is_media_file (name))
+        {
+          LibraryEntry *entry = (LibraryEntry *) g_hash_table_lookup (known,
+              path);
+          if (entry && entry->mtime == st.st_mtime
+              && entry->size == (guint64) st.st_size)
+            g_hash_table_steal (known, path);
+          else
+            {
+              entry = discover_library_entry (discoverer, path, &st);
+              *changed = TRUE;
+            }
+          g_ptr_array_add (entries, entry);
+        }
+      g_free (path);
     }
-  gtk_widget_destroy (dialog);
+  if (dir)
+    g_dir_close (dir);
+}
+static gboolean library_ready_cb (gpointer data);
+/* Library thread: bring the index up to date with the directories; only
+   new and modified files are probed */
+static gpointer
+library_scan_thread (gpointer data)
+{
+  GPtrArray *old = load_library_index ();
+  GPtrArray *entries = g_ptr_array_new_with_free_func (library_entry_free);
+  GHashTable *known = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      library_entry_free);
+  GstDiscoverer *discoverer;
+  gchar **directories = library_directories ();
+  gboolean changed = FALSE;
+  guint i;
+  lower_thread_priority ();
+  // the table takes the old entries over, keyed by their own paths
+  g_ptr_array_set_free_func (old, NULL);
+  for (i = 0; i < old->len; i++)
+    {
+      LibraryEntry *entry = (LibraryEntry *) g_ptr_array_index (old, i);
+      g_hash_table_replace (known, entry->path, entry);
+    }
+  g_ptr_array_unref (old);
+  discoverer = gst_discoverer_new (LIBRARY_DISCOVER_TIMEOUT, NULL);
+  for (i = 0; discoverer && directories[i]; i++)
+    scan_library_directory (directories[i], known, discoverer, entries,
+        &changed);
+  // whatever is left in the table was deleted or moved
+  if (g_hash_table_size (known) > 0)
+    changed = TRUE;
+  g_ptr_array_sort (entries, compare_library_path);
+  if (changed)
+    save_library_index (entries);
+  g_hash_table_unref (known);
+  g_strfreev (directories);
+  if (discoverer)
+    g_object_unref (discoverer);
+  g_idle_add (library_ready_cb, entries);
+  return NULL;
+}
+static void
+start_library_scan (void)
+{
+  if (library_scanning)
+    return;
+  library_scanning = TRUE;
+  if (library_status)
+    gtk_label_set_text (GTK_LABEL (library_status), "Scanning...");
+  g_thread_unref (g_thread_new ("library-scan", library_scan_thread, NULL));
+}
+/* This function is called when the RESCAN button is clicked */
+static void
+rescan_cb (GtkButton * button, gpointer data)
+{
+  start_library_scan ();
+}
+/* Fill the browser from the library's playable files; returns how many */
+static guint
+fill_library_store (void)
+{
+  guint i, count = 0;
+  gtk_list_store_clear (library_store);
+  for (i = 0; library && i < library->len; i++)
+    {
+      LibraryEntry *entry = (LibraryEntry *) g_ptr_array_index (library, i);
+      gchar *name;
+      guint seconds;
+      gchar *duration, *resolution, *bitrate;
+      if (!entry->playable)
+        continue;
+      count++;
+      name = g_path_get_basename (entry->path);
+      seconds = (guint) (entry->duration / GST_SECOND);
+      duration = g_strdup_printf ("%u:%02u:%02u", seconds / 3600,
+          seconds / 60 % 60, seconds % 60);
+      resolution = entry->width ? g_strdup_printf ("%ux%u",
+          entry->width, entry->height) : g_strdup ("");
+      bitrate = g_strdup_printf ("%.1f Mb/s", entry->bitrate / 1e6);
+      gtk_list_store_insert_with_values (library_store, NULL, -1,
+          0, name, 1, duration, 2, resolution, 3, entry->video_codec,
+          4, entry->audio_codec, 5, bitrate, 6, entry->path, -1);
+      g_free (bitrate);
+      g_free (resolution);
+      g_free (duration);
+      g_free (name);
+    }
+  return count;
+}
+/* Main thread: a scan finished */
+static gboolean
+library_ready_cb (gpointer data)
+{
+  if (library)
+    g_ptr_array_unref (library);
+  library = (GPtrArray *) data;
+  library_scanning = FALSE;
+  if (library_window)
+    {
+      gchar *text = g_strdup_printf ("%u files", fill_library_store ());
+      gtk_label_set_text (GTK_LABEL (library_status), text);
+      g_free (text);
+    }
+  return G_SOURCE_REMOVE;
+}
+/* This function is called when a row of the library is double-clicked */
+static void
+library_row_activated_cb (GtkTreeView * view, GtkTreePath * path,
+    GtkTreeViewColumn * column, gpointer data)
+{
+  GtkTreeIter iter;
+  gchar *filename, *uri;
+  if (!gtk_tree_model_get_iter (GTK_TREE_MODEL (library_store), &iter, path))
+    return;
+  gtk_tree_model_get (GTK_TREE_MODEL (library_store), &iter, 6, &filename, -1);
+  uri = gst_filename_to_uri (filename, NULL);
+  if (uri)
+    {
+      GPtrArray *items = g_ptr_array_new_with_free_func (g_free);
+      g_ptr_array_add (items, uri);
+      begin_open (items);
+    }
+  g_free (filename);
+}
+/* This function is called when the LIBRARY button is clicked. The browser
+   shows the index as it stands, and a scan brings it up to date behind. */
+static void
+library_cb (GtkButton * button, gpointer data)
+{
+  static const gchar *titles[] = { "Name", "Duration", "Resolution",
+    "Video", "Audio", "Bitrate"
+  };
+  GtkWidget *box, *scroll, *view, *bar, *rescan;
+  guint i, files;
+  if (library_window)
+    {
+      gtk_window_present (GTK_WINDOW (library_window));
+      return;
+    }
+  if (!library)
+    library = load_library_index ();
+  library_window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_title (GTK_WINDOW (library_window), "Library");
+  gtk_window_set_default_size (GTK_WINDOW (library_window), 700, 500);
+  gtk_window_set_transient_for (GTK_WINDOW (library_window),
+      GTK_WINDOW (main_window));
+  g_signal_connect (library_window, "destroy",
+            G_CALLBACK (gtk_widget_destroyed), &library_window);
+  library_store = gtk_list_store_new (7, G_TYPE_STRING, G_TYPE_STRING,
+      G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
+      G_TYPE_STRING);
+  view = gtk_tree_view_new_with_model (GTK_TREE_MODEL (library_store));
+  g_object_unref (library_store);
+  for (i = 0; i < G_N_ELEMENTS (titles); i++)
+    {
+      GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes (
+          titles[i], gtk_cell_renderer_text_new (), "text", i, NULL);
+      gtk_tree_view_column_set_sort_column_id (column, i);
+      gtk_tree_view_column_set_resizable (column, TRUE);
+      gtk_tree_view_append_column (GTK_TREE_VIEW (view), column);
+    }
+  g_signal_connect (view, "row-activated",
+            G_CALLBACK (library_row_activated_cb), NULL);
+  scroll = gtk_scrolled_window_new (NULL, NULL);
+  gtk_container_add (GTK_CONTAINER (scroll), view);
+  library_status = gtk_label_new ("");
+  rescan = gtk_button_new_with_label ("Rescan");
+  g_signal_connect (rescan, "clicked", G_CALLBACK (rescan_cb), NULL);
+  bar = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+  gtk_box_pack_start (GTK_BOX (bar), library_status, TRUE, TRUE, 0);
+  gtk_box_pack_start (GTK_BOX (bar), rescan, FALSE, FALSE, 0);
+  box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+  gtk_box_pack_start (GTK_BOX (box), scroll, TRUE, TRUE, 0);
+  gtk_box_pack_start (GTK_BOX (box), bar, FALSE, FALSE, 0);
+  gtk_container_add (GTK_CONTAINER (library_window), box);
+  files = fill_library_store ();
+  if (library_scanning)
+    gtk_label_set_text (GTK_LABEL (library_status), "Scanning...");
+  else
+    {
+      gchar *text = g_strdup_printf ("%u files", files);
+      gtk_label_set_text (GTK_LABEL (library_status), text);
+      g_free (text);
+    }
+  g_signal_connect (library_window, "destroy",
+            G_CALLBACK (gtk_widget_destroyed), &library_status);
+  gtk_widget_show_all (library_window);
 }
 int
 main (int argc, char *argv[])
 {
+  GPtrArray *startup_items;
   // Initialize GStreamer
   gst_init (&argc, &argv);
+  // --bench FILE runs without a window
+  if (argc > 2 && g_strcmp0 (argv[1], "--bench") == 0)
+    return run_benchmark (argv[2]);
   // init gtk library 
   gtk_init (&argc, &argv);
-  pipeline = gst_element_factory_make ("playbin", "play");
-  g_object_set (G_OBJECT (pipeline), "uri",
-        "http://docs.gstreamer.com/media/sintel_trailer-480p.webm",
-        NULL);
+  // playbin3 keeps compatible decoders across playlist items; playbin only
+  // keeps the sink
+  pipeline = gst_element_factory_make ("playbin3", "play");
+  if (!pipeline)
+    pipeline = gst_element_factory_make ("playbin", "play");
+  g_signal_connect (pipeline, "about-to-finish",
+            G_CALLBACK (about_to_finish_cb), NULL);
+  // progressive download for network media, into the download cache
+  {
+    guint flags;
+    g_object_get (pipeline, "flags", &flags, NULL);
+    g_object_set (pipeline, "flags", flags | PLAY_FLAG_DOWNLOAD, NULL);
+  }
+  g_signal_connect (pipeline, "deep-element-added",
+            G_CALLBACK (element_added_cb), NULL);
+  g_signal_connect (pipeline, "deep-element-removed",
+            G_CALLBACK (element_removed_cb), NULL);
+  // command line: [--loop] [--cache-mb=N] [--ring-mb=N]
+  // [--low-watermark=PERCENT] [--high-watermark=PERCENT] [file or URI]...
+  {
+    GPtrArray *items = g_ptr_array_new_with_free_func (g_free);
+    int i;
+    for (i = 1; i < argc; i++)
+      {
+        gchar *uri;
+        if (g_strcmp0 (argv[i], "--loop") == 0)
+          {
+            playlist_loop = TRUE;
+            continue;
+          }
+        if (g_strcmp0 (argv[i], "--hires") == 0)
+          {
+            hires_profile = TRUE;
+            continue;
+          }
+        if (g_strcmp0 (argv[i], "--mmap") == 0)
+          {
+            mmap_source = TRUE;
+            continue;
+          }
+        if (g_str_has_prefix (argv[i], "--cache-mb="))
+          {
+            cache_budget = g_ascii_strtoull (argv[i] + 11, NULL, 10) << 20;
+            continue;
+          }
+        if (g_str_has_prefix (argv[i], "--ring-mb="))
+          {
+            ring_buffer_size = g_ascii_strtoull (argv[i] + 10, NULL, 10) << 20;
+            continue;
+          }
+        if (g_str_has_prefix (argv[i], "--low-watermark="))
+          {
+            low_watermark = CLAMP (g_ascii_strtod (argv[i] + 16, NULL), 0, 100)
+                / 100;
+            continue;
+          }
+        if (g_str_has_prefix (argv[i], "--high-watermark="))
+          {
+            high_watermark = CLAMP (g_ascii_strtod (argv[i] + 17, NULL), 0, 100)
+                / 100;
+            continue;
+          }
+        uri = gst_uri_is_valid (argv[i]) ? g_strdup (argv[i])
+            : gst_filename_to_uri (argv[i], NULL);
+        if (uri)
+          g_ptr_array_add (items, uri);
+        else
+          g_printerr ("Skipping %s: not a file or URI\n", argv[i]);
+      }
+    if (items->len == 0)
+      g_ptr_array_add (items,
+          g_strdup ("http://docs.gstreamer.com/media/sintel_trailer-480p.webm"));
+    startup_items = items;
+  }
+  g_object_set (pipeline, "ring-buffer-max-size", ring_buffer_size, NULL);
+  trim_download_cache (TRUE);
+  if (mmap_source)
+    {
+      g_signal_connect (pipeline, "source-setup",
+                G_CALLBACK (source_setup_cb), NULL);
+      g_timeout_add_seconds (5, mmap_report_cb, NULL);
+    }
+  if (hires_profile)
+    {
+      GstElement *video_sink = make_hires_video_sink ();
+      if (video_sink)
+        g_object_set (pipeline, "video-sink", video_sink, NULL);
+      g_signal_connect (pipeline, "deep-element-added",
+                G_CALLBACK (hires_element_added_cb), NULL);
+      g_timeout_add_seconds (5, report_late_frames_cb, NULL);
+    }
   bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
-  gst_element_set_state (pipeline, GST_STATE_READY);
+  gst_bus_add_watch (bus, bus_cb, NULL);
+  gst_object_unref (bus);
   main_window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
   gtk_window_set_default_size (GTK_WINDOW (main_window), 800, 600);
   g_signal_connect (main_window, "destroy", G_CALLBACK (gtk_main_quit), NULL);
@@ -97,26 +2407,78 @@ main (int argc, char *argv[])
   Open = gtk_button_new_with_label ("Open");
   g_signal_connect (G_OBJECT (Open), "clicked", G_CALLBACK (open_cb),
             pipeline);
+  Library = gtk_button_new_with_label ("Library");
+  g_signal_connect (G_OBJECT (Library), "clicked", G_CALLBACK (library_cb),
+            NULL);
+  Rewind = gtk_button_new_with_label ("<<");
+  g_signal_connect (G_OBJECT (Rewind), "clicked", G_CALLBACK (rewind_cb),
+            NULL);
+  Forward = gtk_button_new_with_label (">>");
+  g_signal_connect (G_OBJECT (Forward), "clicked", G_CALLBACK (forward_cb),
+            NULL);
+  rate_label = gtk_label_new ("");
+  // seek bar in seconds; its range follows the duration
+  seek_bar = gtk_scale_new_with_range (GTK_ORIENTATION_HORIZONTAL, 0, 1, 1);
+  gtk_scale_set_draw_value (GTK_SCALE (seek_bar), FALSE);
+  g_signal_connect (G_OBJECT (seek_bar), "change-value",
+            G_CALLBACK (seek_bar_cb), NULL);
+  g_timeout_add (200, update_seek_bar_cb, NULL);
+  // hover and scrub thumbnails
+  gtk_widget_add_events (seek_bar,
+      GDK_POINTER_MOTION_MASK | GDK_LEAVE_NOTIFY_MASK);
+  g_signal_connect (G_OBJECT (seek_bar), "motion-notify-event",
+            G_CALLBACK (seek_bar_motion_cb), NULL);
+  g_signal_connect (G_OBJECT (seek_bar), "leave-notify-event",
+            G_CALLBACK (seek_bar_leave_cb), NULL);
+  thumbnail_popover = gtk_popover_new (seek_bar);
+  gtk_popover_set_modal (GTK_POPOVER (thumbnail_popover), FALSE);
+  thumbnail_image = gtk_image_new ();
+  gtk_container_add (GTK_CONTAINER (thumbnail_popover), thumbnail_image);
+  gtk_widget_show (thumbnail_image);
   // add button box to hbox_controller
+  gtk_box_pack_start (GTK_BOX (control), Rewind, TRUE, TRUE, 0);
   gtk_box_pack_start (GTK_BOX (control), Play, TRUE, TRUE, 0);
   gtk_box_pack_start (GTK_BOX (control), Pause, TRUE, TRUE, 0);
+  gtk_box_pack_start (GTK_BOX (control), Forward, TRUE, TRUE, 0);
+  gtk_box_pack_start (GTK_BOX (control), rate_label, FALSE, FALSE, 6);
   gtk_box_pack_start (GTK_BOX (control), Open, TRUE, TRUE, 0);
+  gtk_box_pack_start (GTK_BOX (control), Library, TRUE, TRUE, 0);
+  // progress of an open, shown only while one is running or has failed
+  open_spinner = gtk_spinner_new ();
+  open_status = gtk_label_new ("");
+  open_cancel = gtk_button_new_with_label ("Cancel");
+  g_signal_connect (G_OBJECT (open_cancel), "clicked",
+            G_CALLBACK (cancel_open_cb), NULL);
+  gtk_widget_set_no_show_all (open_spinner, TRUE);
+  gtk_widget_set_no_show_all (open_status, TRUE);
+  gtk_widget_set_no_show_all (open_cancel, TRUE);
+  gtk_box_pack_start (GTK_BOX (control), open_spinner, FALSE, FALSE, 6);
+  gtk_box_pack_start (GTK_BOX (control), open_status, FALSE, FALSE, 6);
+  gtk_box_pack_start (GTK_BOX (control), open_cancel, FALSE, FALSE, 0);
   // add vbox to main window
   gtk_container_add (GTK_CONTAINER (main_window), vbox);
   // add hbox containing video_window to vbox
   gtk_box_pack_start (GTK_BOX (vbox), hbox, TRUE, TRUE, 0);
+  gtk_box_pack_start (GTK_BOX (vbox), seek_bar, FALSE, FALSE, 0);
   gtk_box_pack_start (GTK_BOX (vbox), control, FALSE, FALSE, 0);
   gtk_widget_show_all (main_window);
   gtk_widget_realize (video_window);
-  gst_element_set_state (pipeline, GST_STATE_PLAYING);
-  // set up sync handler for setting the xid once the pipeline is started
+  // set up sync handler for setting the xid before the pipeline is started
   bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
   gst_bus_set_sync_handler (bus, (GstBusSyncHandler) bus_sync_handler, NULL,
                 NULL);
   gst_object_unref (bus);
+  begin_open (startup_items);
+  // bring the media library up to date while the first item plays
+  start_library_scan ();
   // run main loop
   gtk_main ();
   gst_element_set_state (pipeline, GST_STATE_NULL);
+  if (download)
+    {
+      update_download ();
+      finish_download (download);
+    }
   gst_object_unref (pipeline);
   return 0;
 }
@@ -147,4 +2509,6 @@ bus_sync_handler (GstBus * bus, GstMessage * message, gpointer user_data)
     {
       g_warning ("Should have obtained video_window_handle by now!");
     }
+  gst_message_unref (message);
+  return GST_BUS_DROP;
 }
@@ -0,0 +1,484 @@
+#ifndef COLOR_CONVERT_H
+#define COLOR_CONVERT_H
+
+// YUV (BT.601, limited range) to 32-bit RGB conversion for raw V4L2 frames.
+//
+// The output layout is the in-memory layout of QImage::Format_RGB32 /
+// Format_ARGB32 on little-endian machines: B, G, R, 0xff per pixel.
+//
+// All kernels use the same 16-bit fixed-point arithmetic (coefficients scaled
+// by 64, saturating adds), so the SIMD paths are bit-exact with the scalar
+// reference.  The best kernel is picked once at runtime by CPU feature.
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLOR_CONVERT_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define COLOR_CONVERT_NEON 1
+#endif
+
+enum class YuvFormat { YUYV, UYVY, NV12 };
+
+// Plane pointers and strides of one source frame.  Packed formats only use
+// plane 0; NV12 uses plane 0 for luma and plane 1 for interleaved CbCr.
+struct YuvFrame {
+    const uint8_t *plane[2];
+    int stride[2];
+};
+
+// Converts `rows` rows starting at `row` of a `width` pixel wide frame.
+typedef void (*YuvRowsFunc)(const YuvFrame &src, uint8_t *dst, int dstStride,
+                            int width, int row, int rows);
+
+namespace colorconvert {
+
+// Fixed-point coefficients (x64).
+enum {
+    kY = 75,   // 1.164
+    kRV = 102, // 1.596
+    kGU = 25,  // 0.391
+    kGV = 52,  // 0.813
+    kBU = 129, // 2.018
+    kRound = 32
+};
+
+static inline int sat16(int v)
+{
+    return v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+}
+
+static inline uint8_t clampPixel(int v)
+{
+    v >>= 6;
+    return v < 0 ? 0 : (v > 255 ? 255 : uint8_t(v));
+}
+
+static inline void storePixel(uint8_t *out, int y, int u, int v)
+{
+    int yy = (y - 16) * kY + kRound;
+    u -= 128;
+    v -= 128;
+    out[0] = clampPixel(sat16(yy + u * kBU));
+    out[1] = clampPixel(sat16(yy - sat16(u * kGU + v * kGV)));
+    out[2] = clampPixel(sat16(yy + v * kRV));
+    out[3] = 0xff;
+}
+
+// Scalar reference.  Also used for the tails the vector kernels leave over.
+// With an odd width the row ends halfway through the last pixel pair, before
+// its V sample; that pixel reuses the previous pair's V.
+static inline void packedRowScalar(const uint8_t *src, uint8_t *dst, int from, int width, bool uyvy)
+{
+    const int yOff = uyvy ? 1 : 0;
+    const int cOff = uyvy ? 0 : 1;
+    for (int x = from; x < width; x += 2) {
+        const uint8_t *p = src + x * 2;
+        int u = p[cOff];
+        int v = x + 1 < width ? p[cOff + 2] : (x >= 2 ? p[cOff - 2] : 128);
+        storePixel(dst + x * 4, p[yOff], u, v);
+        if (x + 1 < width)
+            storePixel(dst + x * 4 + 4, p[yOff + 2], u, v);
+    }
+}
+
+static inline void nv12RowScalar(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int from, int width)
+{
+    for (int x = from; x < width; ++x) {
+        const uint8_t *c = uv + (x & ~1);
+        storePixel(dst + x * 4, y[x], c[0], c[1]);
+    }
+}
+
+static inline void rowsScalar(YuvFormat format, const YuvFrame &src, uint8_t *dst, int dstStride,
+                              int width, int row, int rows)
+{
+    for (int r = row; r < row + rows; ++r) {
+        uint8_t *out = dst + ptrdiff_t(r) * dstStride;
+        if (format == YuvFormat::NV12)
+            nv12RowScalar(src.plane[0] + ptrdiff_t(r) * src.stride[0],
+                          src.plane[1] + ptrdiff_t(r / 2) * src.stride[1], out, 0, width);
+        else
+            packedRowScalar(src.plane[0] + ptrdiff_t(r) * src.stride[0], out, 0, width,
+                            format == YuvFormat::UYVY);
+    }
+}
+
+static void yuyvRowsScalar(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows)
+{
+    rowsScalar(YuvFormat::YUYV, s, d, ds, w, row, rows);
+}
+
+static void uyvyRowsScalar(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows)
+{
+    rowsScalar(YuvFormat::UYVY, s, d, ds, w, row, rows);
+}
+
+static void nv12RowsScalar(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows)
+{
+    rowsScalar(YuvFormat::NV12, s, d, ds, w, row, rows);
+}
+
+#ifdef COLOR_CONVERT_X86
+
+// ---- SSE2: 16 pixels per iteration ----------------------------------------
+
+// `uv` holds 8 interleaved chroma samples (U0 V0 U1 V1 ...) as int16 and
+// covers 8 pixels.  Splits and duplicates them to one U and one V per pixel,
+// centred around zero.
+static inline void chromaSse2(__m128i uv, __m128i &u, __m128i &v)
+{
+    const __m128i bias = _mm_set1_epi16(128);
+    u = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0));
+    v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+    u = _mm_sub_epi16(u, bias);
+    v = _mm_sub_epi16(v, bias);
+}
+
+static inline void rgbSse2(__m128i y, __m128i u, __m128i v, __m128i &r, __m128i &g, __m128i &b)
+{
+    y = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)), _mm_set1_epi16(kY)),
+                      _mm_set1_epi16(kRound));
+    b = _mm_srai_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(kBU))), 6);
+    g = _mm_srai_epi16(_mm_subs_epi16(y, _mm_adds_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(kGU)),
+                                                        _mm_mullo_epi16(v, _mm_set1_epi16(kGV)))), 6);
+    r = _mm_srai_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(v, _mm_set1_epi16(kRV))), 6);
+}
+
+// Converts 16 pixels: y0/uv0 cover pixels 0-7, y1/uv1 pixels 8-15.
+static inline void store16Sse2(__m128i y0, __m128i uv0, __m128i y1, __m128i uv1, uint8_t *dst)
+{
+    __m128i u, v, r0, g0, b0, r1, g1, b1;
+    chromaSse2(uv0, u, v);
+    rgbSse2(y0, u, v, r0, g0, b0);
+    chromaSse2(uv1, u, v);
+    rgbSse2(y1, u, v, r1, g1, b1);
+
+    const __m128i r = _mm_packus_epi16(r0, r1);
+    const __m128i g = _mm_packus_epi16(g0, g1);
+    const __m128i b = _mm_packus_epi16(b0, b1);
+    const __m128i a = _mm_set1_epi8(char(0xff));
+    const __m128i bgLo = _mm_unpacklo_epi8(b, g), bgHi = _mm_unpackhi_epi8(b, g);
+    const __m128i raLo = _mm_unpacklo_epi8(r, a), raHi = _mm_unpackhi_epi8(r, a);
+    _mm_storeu_si128((__m128i *)(dst + 0), _mm_unpacklo_epi16(bgLo, raLo));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(bgLo, raLo));
+    _mm_storeu_si128((__m128i *)(dst + 32), _mm_unpacklo_epi16(bgHi, raHi));
+    _mm_storeu_si128((__m128i *)(dst + 48), _mm_unpackhi_epi16(bgHi, raHi));
+}
+
+static inline void packedRowsSse2(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows, bool uyvy)
+{
+    const __m128i lowMask = _mm_set1_epi16(0x00ff);
+    for (int r = row; r < row + rows; ++r) {
+        const uint8_t *src = s.plane[0] + ptrdiff_t(r) * s.stride[0];
+        uint8_t *dst = d + ptrdiff_t(r) * ds;
+        int x = 0;
+        for (; x + 16 <= w; x += 16) {
+            const __m128i p0 = _mm_loadu_si128((const __m128i *)(src + x * 2));
+            const __m128i p1 = _mm_loadu_si128((const __m128i *)(src + x * 2 + 16));
+            if (uyvy)
+                store16Sse2(_mm_srli_epi16(p0, 8), _mm_and_si128(p0, lowMask),
+                            _mm_srli_epi16(p1, 8), _mm_and_si128(p1, lowMask), dst + x * 4);
+            else
+                store16Sse2(_mm_and_si128(p0, lowMask), _mm_srli_epi16(p0, 8),
+                            _mm_and_si128(p1, lowMask), _mm_srli_epi16(p1, 8), dst + x * 4);
+        }
+        packedRowScalar(src, dst, x, w, uyvy);
+    }
+}
+
+static void yuyvRowsSse2(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows)
+{
+    packedRowsSse2(s, d, ds, w, row, rows, false);
+}
+
+static void uyvyRowsSse2(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows)
+{
+    packedRowsSse2(s, d, ds, w, row, rows, true);
+}
+
+static void nv12RowsSse2(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows)
+{
+    const __m128i zero = _mm_setzero_si128();
+    for (int r = row; r < row + rows; ++r) {
+        const uint8_t *y = s.plane[0] + ptrdiff_t(r) * s.stride[0];
+        const uint8_t *uv = s.plane[1] + ptrdiff_t(r / 2) * s.stride[1];
+        uint8_t *dst = d + ptrdiff_t(r) * ds;
+        int x = 0;
+        for (; x + 16 <= w; x += 16) {
+            const __m128i yy = _mm_loadu_si128((const __m128i *)(y + x));
+            const __m128i cc = _mm_loadu_si128((const __m128i *)(uv + x));
+            store16Sse2(_mm_unpacklo_epi8(yy, zero), _mm_unpacklo_epi8(cc, zero),
+                        _mm_unpackhi_epi8(yy, zero), _mm_unpackhi_epi8(cc, zero), dst + x * 4);
+        }
+        nv12RowScalar(y, uv, dst, x, w);
+    }
+}
+
+// ---- AVX2: 32 pixels per iteration ----------------------------------------
+//
+// Each 128-bit lane runs the SSE2 algorithm on its own 8 pixels; the final
+// permute restores pixel order after the lane-wise pack/unpack.
+
+__attribute__((target("avx2")))
+static inline void chromaAvx2(__m256i uv, __m256i &u, __m256i &v)
+{
+    const __m256i bias = _mm256_set1_epi16(128);
+    u = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0));
+    v = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+    u = _mm256_sub_epi16(u, bias);
+    v = _mm256_sub_epi16(v, bias);
+}
+
+__attribute__((target("avx2")))
+static inline void rgbAvx2(__m256i y, __m256i u, __m256i v, __m256i &r, __m256i &g, __m256i &b)
+{
+    y = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(16)), _mm256_set1_epi16(kY)),
+                         _mm256_set1_epi16(kRound));
+    b = _mm256_srai_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(u, _mm256_set1_epi16(kBU))), 6);
+    g = _mm256_srai_epi16(_mm256_subs_epi16(y, _mm256_adds_epi16(_mm256_mullo_epi16(u, _mm256_set1_epi16(kGU)),
+                                                                 _mm256_mullo_epi16(v, _mm256_set1_epi16(kGV)))), 6);
+    r = _mm256_srai_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(v, _mm256_set1_epi16(kRV))), 6);
+}
+
+// y0/uv0 cover pixels 0-15 (8 per lane), y1/uv1 pixels 16-31.
+__attribute__((target("avx2")))
+static inline void store32Avx2(__m256i y0, __m256i uv0, __m256i y1, __m256i uv1, uint8_t *dst)
+{
+    __m256i u, v, r0, g0, b0, r1, g1, b1;
+    chromaAvx2(uv0, u, v);
+    rgbAvx2(y0, u, v, r0, g0, b0);
+    chromaAvx2(uv1, u, v);
+    rgbAvx2(y1, u, v, r1, g1, b1);
+
+    // Lane 0 now holds pixels 0-7 and 16-23, lane 1 pixels 8-15 and 24-31.
+    const __m256i r = _mm256_packus_epi16(r0, r1);
+    const __m256i g = _mm256_packus_epi16(g0, g1);
+    const __m256i b = _mm256_packus_epi16(b0, b1);
+    const __m256i a = _mm256_set1_epi8(char(0xff));
+    const __m256i bgLo = _mm256_unpacklo_epi8(b, g), bgHi = _mm256_unpackhi_epi8(b, g);
+    const __m256i raLo = _mm256_unpacklo_epi8(r, a), raHi = _mm256_unpackhi_epi8(r, a);
+    const __m256i o0 = _mm256_unpacklo_epi16(bgLo, raLo); // 0-3   | 8-11
+    const __m256i o1 = _mm256_unpackhi_epi16(bgLo, raLo); // 4-7   | 12-15
+    const __m256i o2 = _mm256_unpacklo_epi16(bgHi, raHi); // 16-19 | 24-27
+    const __m256i o3 = _mm256_unpackhi_epi16(bgHi, raHi); // 20-23 | 28-31
+    _mm256_storeu_si256((__m256i *)(dst + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+    _mm256_storeu_si256((__m256i *)(dst + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+    _mm256_storeu_si256((__m256i *)(dst + 64), _mm256_permute2x128_si256(o2, o3, 0x20));
+    _mm256_storeu_si256((__m256i *)(dst + 96), _mm256_permute2x128_si256(o2, o3, 0x31));
+}
+
+__attribute__((target("avx2")))
+static inline void packedRowsAvx2(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows, bool uyvy)
+{
+    const __m256i lowMask = _mm256_set1_epi16(0x00ff);
+    for (int r = row; r < row + rows; ++r) {
+        const uint8_t *src = s.plane[0] + ptrdiff_t(r) * s.stride[0];
+        uint8_t *dst = d + ptrdiff_t(r) * ds;
+        int x = 0;
+        for (; x + 32 <= w; x += 32) {
+            const __m256i p0 = _mm256_loadu_si256((const __m256i *)(src + x * 2));
+            const __m256i p1 = _mm256_loadu_si256((const __m256i *)(src + x * 2 + 32));
+            if (uyvy)
+                store32Avx2(_mm256_srli_epi16(p0, 8), _mm256_and_si256(p0, lowMask),
+                            _mm256_srli_epi16(p1, 8), _mm256_and_si256(p1, lowMask), dst + x * 4);
+            else
+                store32Avx2(_mm256_and_si256(p0, lowMask), _mm256_srli_epi16(p0, 8),
+                            _mm256_and_si256(p1, lowMask), _mm256_srli_epi16(p1, 8), dst + x * 4);
+        }
+        packedRowScalar(src, dst, x, w, uyvy);
+    }
+}
+
+__attribute__((target("avx2")))
+static void yuyvRowsAvx2(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows)
+{
+    packedRowsAvx2(s, d, ds, w, row, rows, false);
+}
+
+__attribute__((target("avx2")))
+static void uyvyRowsAvx2(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows)
+{
+    packedRowsAvx2(s, d, ds, w, row, rows, true);
+}
+
+__attribute__((target("avx2")))
+static void nv12RowsAvx2(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows)
+{
+    for (int r = row; r < row + rows; ++r) {
+        const uint8_t *y = s.plane[0] + ptrdiff_t(r) * s.stride[0];
+        const uint8_t *uv = s.plane[1] + ptrdiff_t(r / 2) * s.stride[1];
+        uint8_t *dst = d + ptrdiff_t(r) * ds;
+        int x = 0;
+        for (; x + 32 <= w; x += 32) {
+            store32Avx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + x))),
+                        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(uv + x))),
+                        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + x + 16))),
+                        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(uv + x + 16))),
+                        dst + x * 4);
+        }
+        nv12RowScalar(y, uv, dst, x, w);
+    }
+}
+
+#endif // COLOR_CONVERT_X86
+
+#ifdef COLOR_CONVERT_NEON
+
+// ---- NEON: 16 pixels per iteration ----------------------------------------
+
+static inline void store8Neon(int16x8_t y, int16x8_t u, int16x8_t v, uint8x8_t &r, uint8x8_t &g, uint8x8_t &b)
+{
+    y = vaddq_s16(vmulq_n_s16(vsubq_s16(y, vdupq_n_s16(16)), kY), vdupq_n_s16(kRound));
+    u = vsubq_s16(u, vdupq_n_s16(128));
+    v = vsubq_s16(v, vdupq_n_s16(128));
+    b = vqmovun_s16(vshrq_n_s16(vqaddq_s16(y, vmulq_n_s16(u, kBU)), 6));
+    g = vqmovun_s16(vshrq_n_s16(vqsubq_s16(y, vqaddq_s16(vmulq_n_s16(u, kGU), vmulq_n_s16(v, kGV))), 6));
+    r = vqmovun_s16(vshrq_n_s16(vqaddq_s16(y, vmulq_n_s16(v, kRV)), 6));
+}
+
+// `y` holds 16 luma samples, `u`/`v` the 8 chroma samples shared by them.
+static inline void store16Neon(uint8x16_t y, uint8x8_t u, uint8x8_t v, uint8_t *dst)
+{
+    const uint8x8x2_t uu = vzip_u8(u, u);
+    const uint8x8x2_t vv = vzip_u8(v, v);
+    uint8x8x4_t out;
+    out.val[3] = vdup_n_u8(0xff);
+    store8Neon(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y))), vreinterpretq_s16_u16(vmovl_u8(uu.val[0])),
+               vreinterpretq_s16_u16(vmovl_u8(vv.val[0])), out.val[2], out.val[1], out.val[0]);
+    vst4_u8(dst, out);
+    store8Neon(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y))), vreinterpretq_s16_u16(vmovl_u8(uu.val[1])),
+               vreinterpretq_s16_u16(vmovl_u8(vv.val[1])), out.val[2], out.val[1], out.val[0]);
+    vst4_u8(dst + 32, out);
+}
+
+static inline void packedRowsNeon(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows, bool uyvy)
+{
+    for (int r = row; r < row + rows; ++r) {
+        const uint8_t *src = s.plane[0] + ptrdiff_t(r) * s.stride[0];
+        uint8_t *dst = d + ptrdiff_t(r) * ds;
+        int x = 0;
+        for (; x + 16 <= w; x += 16) {
+            // De-interleaves into Y0, U, Y1, V (or U, Y0, V, Y1 for UYVY).
+            const uint8x8x4_t p = vld4_u8(src + x * 2);
+            const uint8x8_t y0 = uyvy ? p.val[1] : p.val[0];
+            const uint8x8_t y1 = uyvy ? p.val[3] : p.val[2];
+            const uint8x8_t u = uyvy ? p.val[0] : p.val[1];
+            const uint8x8_t v = uyvy ? p.val[2] : p.val[3];
+            const uint8x8x2_t yy = vzip_u8(y0, y1);
+            store16Neon(vcombine_u8(yy.val[0], yy.val[1]), u, v, dst + x * 4);
+        }
+        packedRowScalar(src, dst, x, w, uyvy);
+    }
+}
+
+static void yuyvRowsNeon(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows)
+{
+    packedRowsNeon(s, d, ds, w, row, rows, false);
+}
+
+static void uyvyRowsNeon(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows)
+{
+    packedRowsNeon(s, d, ds, w, row, rows, true);
+}
+
+static void nv12RowsNeon(const YuvFrame &s, uint8_t *d, int ds, int w, int row, int rows)
+{
+    for (int r = row; r < row + rows; ++r) {
+        const uint8_t *y = s.plane[0] + ptrdiff_t(r) * s.stride[0];
+        const uint8_t *uv = s.plane[1] + ptrdiff_t(r / 2) * s.stride[1];
+        uint8_t *dst = d + ptrdiff_t(r) * ds;
+        int x = 0;
+        for (; x + 16 <= w; x += 16) {
+            const uint8x8x2_t c = vld2_u8(uv + x);
+            store16Neon(vld1q_u8(y + x), c.val[0], c.val[1], dst + x * 4);
+        }
+        nv12RowScalar(y, uv, dst, x, w);
+    }
+}
+
+#endif // COLOR_CONVERT_NEON
+
+} // namespace colorconvert
+
+enum class ConvertKernel { Scalar, SSE2, AVX2, NEON };
+
+static inline const char *convertKernelName(ConvertKernel kernel)
+{
+    switch (kernel) {
+    case ConvertKernel::SSE2: return "SSE2";
+    case ConvertKernel::AVX2: return "AVX2";
+    case ConvertKernel::NEON: return "NEON";
+    default: return "scalar";
+    }
+}
+
+static inline bool convertKernelSupported(ConvertKernel kernel)
+{
+    switch (kernel) {
+    case ConvertKernel::Scalar:
+        return true;
+#ifdef COLOR_CONVERT_X86
+    case ConvertKernel::SSE2:
+        return __builtin_cpu_supports("sse2");
+    case ConvertKernel::AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef COLOR_CONVERT_NEON
+    case ConvertKernel::NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+// Fastest kernel the running CPU supports.
+static inline ConvertKernel bestConvertKernel()
+{
+    static const ConvertKernel best = [] {
+        const ConvertKernel order[] = {ConvertKernel::AVX2, ConvertKernel::NEON, ConvertKernel::SSE2};
+        for (ConvertKernel k : order)
+            if (convertKernelSupported(k))
+                return k;
+        return ConvertKernel::Scalar;
+    }();
+    return best;
+}
+
+// Row converter for `format` using `kernel`; falls back to the scalar
+// reference when the kernel is not available on this build or CPU.
+static inline YuvRowsFunc yuvRowsFunc(YuvFormat format, ConvertKernel kernel = bestConvertKernel())
+{
+    using namespace colorconvert;
+    if (!convertKernelSupported(kernel))
+        kernel = ConvertKernel::Scalar;
+    switch (kernel) {
+#ifdef COLOR_CONVERT_X86
+    case ConvertKernel::AVX2:
+        return format == YuvFormat::NV12 ? nv12RowsAvx2 : format == YuvFormat::UYVY ? uyvyRowsAvx2 : yuyvRowsAvx2;
+    case ConvertKernel::SSE2:
+        return format == YuvFormat::NV12 ? nv12RowsSse2 : format == YuvFormat::UYVY ? uyvyRowsSse2 : yuyvRowsSse2;
+#endif
+#ifdef COLOR_CONVERT_NEON
+    case ConvertKernel::NEON:
+        return format == YuvFormat::NV12 ? nv12RowsNeon : format == YuvFormat::UYVY ? uyvyRowsNeon : yuyvRowsNeon;
+#endif
+    default:
+        return format == YuvFormat::NV12 ? nv12RowsScalar : format == YuvFormat::UYVY ? uyvyRowsScalar : yuyvRowsScalar;
+    }
+}
+
+// Converts a whole frame into a 32-bit B, G, R, 0xff buffer.
+static inline void convertYuvToRgb32(YuvFormat format, const YuvFrame &src, uint8_t *dst, int dstStride,
+                                     int width, int height, ConvertKernel kernel = bestConvertKernel())
+{
+    yuvRowsFunc(format, kernel)(src, dst, dstStride, width, 0, height);
+}
+
+#endif // COLOR_CONVERT_H
@@ -1,15 +1,36 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <linux/videodev2.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
 #include <QApplication>
 #include <QWidget>
-#include <QLabel>
-#include <QVBoxLayout>
 #include <QImage>
-#include <QPixmap>
+#include <QPainter>
+#include <QPaintEvent>
+#include <QElapsedTimer>
 #include <QDebug>
 #include <QTimer>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "color-convert.h"
+#include "frame-analytics.h"
+
+// The GUI thread is meant to run without heap allocations per frame: frames
+// are converted, decoded and scaled into buffers that are kept.  Check with
+// an external tool rather than in the viewer, e.g.
+//   heaptrack ./webcam_viewer
+// and look at the allocations whose backtrace starts in updateImage() or
+// paintEvent().
 
 class WebcamViewer : public QWidget
 {
@@ -28,29 +49,79 @@ public:
             return;
         }
 
-        // Set up the video format
-        struct v4l2_format format = {};
+        // Set up the video format.  Ask for raw YUYV; the driver may answer
+        // with another format it prefers, which is handled in updateImage().
+        format = {};
         format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         format.fmt.pix.width = 640;
         format.fmt.pix.height = 480;
-        format.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
-        ioctl(fd, VIDIOC_S_FMT, &format);
+        format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+        if (ioctl(fd, VIDIOC_S_FMT, &format) == -1)
+        {
+            qDebug() << "Error: Unable to set the video format.";
+            return;
+        }
 
-        // Set up the GUI
-        QVBoxLayout *layout = new QVBoxLayout(this);
-        QLabel *imageLabel = new QLabel(this);
-        layout->addWidget(imageLabel);
+        // Map the capture buffers and start streaming
+        req.count = 4;
+        req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        req.memory = V4L2_MEMORY_MMAP;
+        if (ioctl(fd, VIDIOC_REQBUFS, &req) == -1 || req.count == 0)
+        {
+            qDebug() << "Error: Unable to request capture buffers.";
+            return;
+        }
+        buffers = new buffer[req.count];
+        for (unsigned int i = 0; i < req.count; ++i)
+        {
+            struct v4l2_buffer buf = {};
+            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buf.memory = V4L2_MEMORY_MMAP;
+            buf.index = i;
+            ioctl(fd, VIDIOC_QUERYBUF, &buf);
+            buffers[i].length = buf.length;
+            buffers[i].start = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+            ioctl(fd, VIDIOC_QBUF, &buf);
+        }
+        enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        ioctl(fd, VIDIOC_STREAMON, &type);
+
+        // Size the display buffer pool for the negotiated format
+        for (QImage &image : displayBuffers)
+            image = QImage(format.fmt.pix.width, format.fmt.pix.height, QImage::Format_RGB32);
+        qDebug() << "Colour conversion kernel:" << convertKernelName(bestConvertKernel());
+
+        // Frames are painted straight from the display buffers
+        setAttribute(Qt::WA_OpaquePaintEvent);
+        statsTimer.start();
+
+        // Pedestrian detection runs beside the display on the remaining cores
+        const int workers = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+        analytics.reset(new AnalyticsPool(workers, [this](const AnalyticsResult &result) {
+            QMetaObject::invokeMethod(this, [this, result] { showDetections(result); }, Qt::QueuedConnection);
+        }));
 
         // Create a timer to update the image periodically
         QTimer *timer = new QTimer(this);
         connect(timer, SIGNAL(timeout()), this, SLOT(updateImage()));
         timer->start(33); // Update every 33 milliseconds (approx 30 fps)
-
-        setLayout(layout);
     }
 
     ~WebcamViewer()
     {
+        // Join the detector threads before anything they report to goes away
+        analytics.reset();
+
+        // Stop streaming and release the capture buffers
+        if (buffers)
+        {
+            enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            ioctl(fd, VIDIOC_STREAMOFF, &type);
+            for (unsigned int i = 0; i < req.count; ++i)
+                munmap(buffers[i].start, buffers[i].length);
+            delete[] buffers;
+        }
+
         // Close the video device
         close(fd);
     }
@@ -62,25 +133,179 @@ public slots:
         struct v4l2_buffer buf = {};
         buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         buf.memory = V4L2_MEMORY_MMAP;
-        ioctl(fd, VIDIOC_DQBUF, &buf);
-
-        // Copy the frame data to a QImage
-        QImage img(
-            buffers[buf.index].start,
-            format.fmt.pix.width,
-            format.fmt.pix.height,
-            format.fmt.pix.bytesperline,
-            QImage::Format_RGB32);
+        if (!buffers || ioctl(fd, VIDIOC_DQBUF, &buf) == -1)
+            return;
 
-        // Display the image
-        QLabel *imageLabel = findChild<QLabel *>();
-        imageLabel->setPixmap(QPixmap::fromImage(img));
+        // Convert the frame data into the next recycled display buffer
+        const int next = (displayIndex + 1) % DisplayBufferCount;
+        QImage &frameImage = displayBuffers[next];
+        const uint8_t *data = static_cast<const uint8_t *>(buffers[buf.index].start);
+        const int width = format.fmt.pix.width;
+        const int height = format.fmt.pix.height;
+        const int stride = format.fmt.pix.bytesperline;
+        switch (format.fmt.pix.pixelformat)
+        {
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY:
+        case V4L2_PIX_FMT_NV12:
+        {
+            YuvFrame src = {{data, data + stride * height}, {stride, stride}};
+            YuvFormat yuv = format.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV ? YuvFormat::YUYV
+                          : format.fmt.pix.pixelformat == V4L2_PIX_FMT_UYVY ? YuvFormat::UYVY
+                                                                            : YuvFormat::NV12;
+            convertYuvToRgb32(yuv, src, frameImage.bits(), frameImage.bytesPerLine(), width, height);
+            break;
+        }
+        case V4L2_PIX_FMT_MJPEG:
+        {
+            // Decoded into a kept BGR image, then expanded into the display
+            // buffer in place; neither is reallocated while the size holds
+            const cv::Mat jpeg(1, int(buf.bytesused), CV_8UC1, const_cast<uint8_t *>(data));
+            cv::imdecode(jpeg, cv::IMREAD_COLOR, &decodedJpeg);
+            if (decodedJpeg.cols == width && decodedJpeg.rows == height)
+            {
+                cv::Mat display(height, width, CV_8UC4, frameImage.bits(), frameImage.bytesPerLine());
+                cv::cvtColor(decodedJpeg, display, cv::COLOR_BGR2BGRA);
+            }
+            break;
+        }
+        default:
+            for (int y = 0; y < height; ++y)
+                memcpy(frameImage.scanLine(y), data + y * stride, std::min(stride, int(frameImage.bytesPerLine())));
+            break;
+        }
 
         // Re-enqueue the buffer
         ioctl(fd, VIDIOC_QBUF, &buf);
+
+        submitForAnalysis(frameImage, int64_t(buf.timestamp.tv_sec) * 1000000 + buf.timestamp.tv_usec);
+
+        ++stats.frames;
+        ++frameNumber;
+
+        // Display the image
+        displayIndex = next;
+        update();
+
+        reportStats();
+    }
+
+protected:
+    void paintEvent(QPaintEvent *) override
+    {
+        QPainter painter(this);
+        const QImage &image = displayBuffers[displayIndex];
+        if (image.isNull())
+            painter.fillRect(rect(), Qt::black);
+        else if (image.size() == size())
+            painter.drawImage(0, 0, image);
+        else
+            painter.drawImage(0, 0, scaledFrame(image));
+
+        // Boxes from the most recent detection, which may be a few frames old
+        if (detections.frameSize.empty())
+            return;
+        const double sx = double(width()) / detections.frameSize.width;
+        const double sy = double(height()) / detections.frameSize.height;
+        painter.setPen(QPen(Qt::green, 2));
+        const QString tag = QString("PTS %1 s").arg(detections.ptsUs / 1e6, 0, 'f', 3);
+        for (const cv::Rect &box : detections.boxes)
+        {
+            QRectF area(box.x * sx, box.y * sy, box.width * sx, box.height * sy);
+            painter.drawRect(area);
+            painter.drawText(area.topLeft() + QPointF(2, -4), tag);
+        }
     }
 
 private:
+    // Scales the current frame to the widget's size into a kept buffer, once
+    // per frame.  Nearest neighbour, as drawImage() does without smoothing,
+    // through column and row tables that are rebuilt only on resize.
+    const QImage &scaledFrame(const QImage &image)
+    {
+        if (scaled.size() != size() || scaledSource != image.size())
+        {
+            scaled = QImage(size(), QImage::Format_RGB32);
+            scaledSource = image.size();
+            scaledColumns.resize(width());
+            scaledRows.resize(height());
+            for (int x = 0; x < width(); ++x)
+                scaledColumns[x] = x * image.width() / width();
+            for (int y = 0; y < height(); ++y)
+                scaledRows[y] = y * image.height() / height();
+            scaledFrameNumber = ~0ul;
+        }
+        if (scaledFrameNumber != frameNumber)
+        {
+            for (int y = 0; y < scaled.height(); ++y)
+            {
+                const QRgb *in = reinterpret_cast<const QRgb *>(image.constScanLine(scaledRows[y]));
+                QRgb *out = reinterpret_cast<QRgb *>(scaled.scanLine(y));
+                for (int x = 0; x < scaled.width(); ++x)
+                    out[x] = in[scaledColumns[x]];
+            }
+            scaledFrameNumber = frameNumber;
+        }
+        return scaled;
+    }
+
+    // Width of the grayscale image handed to the detector; HOG finds people
+    // from 128 pixels tall upwards at this scale
+    enum { AnalysisWidth = 320 };
+
+    // Downscales the frame into `analysisFrame` and converts it into a gray
+    // image from the pool, so neither is allocated per frame.  The display
+    // buffers are always RGB32, which the detector reads in place.
+    void submitForAnalysis(const QImage &image, int64_t ptsUs)
+    {
+        if (!analytics || image.isNull() || image.format() != QImage::Format_RGB32)
+            return;
+        const cv::Mat bgra(image.height(), image.width(), CV_8UC4, const_cast<uchar *>(image.constBits()),
+                           image.bytesPerLine());
+        const cv::Size size(AnalysisWidth, image.height() * AnalysisWidth / image.width());
+        cv::resize(bgra, analysisFrame, size, 0, 0, cv::INTER_AREA);
+        cv::Mat gray = analytics->buffer(size);
+        cv::cvtColor(analysisFrame, gray, cv::COLOR_BGRA2GRAY);
+        analytics->submit(std::move(gray), ptsUs);
+    }
+
+    void showDetections(const AnalyticsResult &result)
+    {
+        // Workers can finish out of order; never go back to an older frame
+        if (result.ptsUs < detections.ptsUs)
+            return;
+        detections = result;
+        update();
+    }
+
+    // Frames delivered since the last report
+    struct FrameStats
+    {
+        unsigned long frames = 0;
+    };
+
+    void reportStats()
+    {
+        if (statsTimer.elapsed() < 1000)
+            return;
+        qDebug().nospace() << "Frames: " << stats.frames / (statsTimer.elapsed() / 1000.0) << " fps";
+        if (analytics)
+        {
+            const AnalyticsPool::Stats detector = analytics->takeStats();
+            const double seconds = statsTimer.elapsed() / 1000.0;
+            const double analysed = std::max(detector.analysed, 1ul);
+            qDebug().nospace() << "Detector: " << detector.analysed / seconds << " fps, "
+                               << detector.skipped << " stale frames skipped, "
+                               << "detect " << detector.totalDetectMs / analysed << " ms avg / "
+                               << detector.maxDetectMs << " ms max, "
+                               << "frame to result " << detector.totalLatencyMs / analysed << " ms avg";
+        }
+        stats = FrameStats();
+        statsTimer.restart();
+    }
+
+    enum { DisplayBufferCount = 3 };
+
     QString videoDevice;
     int fd;
     struct v4l2_format format;
@@ -89,11 +314,102 @@ private:
     {
         void *start;
         size_t length;
-    } *buffers;
+    } *buffers = nullptr;
+    QImage displayBuffers[DisplayBufferCount];
+    int displayIndex = 0;
+    unsigned long frameNumber = 0;  // frames displayed, for scaledFrame()
+    QImage scaled;
+    QSize scaledSource;
+    std::vector<int> scaledColumns;
+    std::vector<int> scaledRows;
+    unsigned long scaledFrameNumber = ~0ul;
+    cv::Mat decodedJpeg;
+    cv::Mat analysisFrame;  // downscaled frame, before gray conversion
+    FrameStats stats;
+    QElapsedTimer statsTimer;
+    AnalyticsResult detections;
+    std::unique_ptr<AnalyticsPool> analytics;
 };
 
+// Checks every colour conversion kernel against the scalar reference and
+// reports its 1080p throughput.  The check also covers odd widths and
+// heights and rows padded past their last pixel on both sides, with buffers
+// sized exactly, so a kernel that reads or writes past a row shows up as a
+// mismatch (or under a memory checker).  Run with --convert-bench.
+static int runConvertBenchmark()
+{
+    struct Case
+    {
+        int width, height;
+        int srcPadding, dstPadding; // bytes past the end of each row
+        bool timed;
+    };
+    const Case cases[] = {
+        {1920, 1080, 0, 0, true}, {1921, 1081, 0, 0, false}, {1283, 721, 64, 32, false},
+        {641, 479, 3, 4, false},  {33, 9, 0, 0, false},      {17, 5, 7, 12, false},
+        {1, 3, 0, 0, false},
+    };
+    const YuvFormat formats[] = {YuvFormat::YUYV, YuvFormat::UYVY, YuvFormat::NV12};
+    const char *formatNames[] = {"YUYV", "UYVY", "NV12"};
+    const ConvertKernel kernels[] = {ConvertKernel::Scalar, ConvertKernel::SSE2, ConvertKernel::AVX2, ConvertKernel::NEON};
+    const int iterations = 100;
+    int failures = 0;
+    for (const Case &c : cases)
+    {
+        const int width = c.width, height = c.height;
+        const int packedStride = width * 2 + c.srcPadding;
+        const int lumaStride = width + c.srcPadding;
+        const int chromaStride = ((width + 1) & ~1) + c.srcPadding;
+        const int dstStride = width * 4 + c.dstPadding;
+        std::vector<uint8_t> packed(size_t(packedStride) * height), luma(size_t(lumaStride) * height),
+            chroma(size_t(chromaStride) * ((height + 1) / 2));
+        std::vector<uint8_t> reference(size_t(dstStride) * height), output(reference.size());
+        for (std::vector<uint8_t> *plane : {&packed, &luma, &chroma})
+            for (uint8_t &byte : *plane)
+                byte = rand();
+
+        for (int f = 0; f < 3; ++f)
+        {
+            YuvFrame src = formats[f] == YuvFormat::NV12
+                               ? YuvFrame{{luma.data(), chroma.data()}, {lumaStride, chromaStride}}
+                               : YuvFrame{{packed.data(), nullptr}, {packedStride, 0}};
+            std::fill(reference.begin(), reference.end(), 0);
+            convertYuvToRgb32(formats[f], src, reference.data(), dstStride, width, height, ConvertKernel::Scalar);
+            for (ConvertKernel kernel : kernels)
+            {
+                if (!convertKernelSupported(kernel))
+                    continue;
+                // The padding must come out as untouched as in the reference
+                std::fill(output.begin(), output.end(), 0);
+                convertYuvToRgb32(formats[f], src, output.data(), dstStride, width, height, kernel);
+                bool exact = output == reference;
+                failures += !exact;
+                if (!c.timed)
+                {
+                    if (!exact)
+                        printf("%s %-6s %dx%d, padding %d/%d: MISMATCH\n", formatNames[f], convertKernelName(kernel),
+                               width, height, c.srcPadding, c.dstPadding);
+                    continue;
+                }
+
+                auto start = std::chrono::steady_clock::now();
+                for (int i = 0; i < iterations; ++i)
+                    convertYuvToRgb32(formats[f], src, output.data(), dstStride, width, height, kernel);
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+                printf("%s %-6s %6.2f ms/frame %7.1f fps  %s\n", formatNames[f], convertKernelName(kernel), ms,
+                       1000.0 / ms, exact ? "matches scalar" : "MISMATCH");
+            }
+        }
+    }
+    printf("Odd sizes and padded strides: %s\n", failures ? "MISMATCH" : "all kernels match scalar");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && strcmp(argv[1], "--convert-bench") == 0)
+        return runConvertBenchmark();
+
     QApplication app(argc, argv);
 
     WebcamViewer viewer;
@@ -0,0 +1,175 @@
+#ifndef FRAME_ANALYTICS_H
+#define FRAME_ANALYTICS_H
+
+// Background frame analytics for the Qt V4L2 viewer.
+//
+// The viewer submits a small grayscale copy of each frame.  Only the newest
+// submission is kept: a frame that is still waiting when the next one
+// arrives is skipped, so a slow detector lags by at most one frame per
+// worker instead of building a backlog.  Each worker runs its own
+// single-threaded OpenCV HOG pedestrian detector, and results are handed to
+// a callback on the worker thread, tagged with the frame's timestamp.
+// Images the workers are done with, and skipped ones, go back to the pool
+// and are handed out again by buffer(), so submitting allocates nothing once
+// the pool has warmed up.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/objdetect.hpp>
+
+// Detections for one analysed frame.  Boxes are in the coordinates of the
+// submitted (downscaled) image.
+struct AnalyticsResult {
+    int64_t ptsUs = 0;          // capture timestamp of the analysed frame
+    cv::Size frameSize;         // size of the analysed image
+    std::vector<cv::Rect> boxes;
+    double detectMs = 0;        // time spent in the detector
+    double latencyMs = 0;       // from submission to result
+};
+
+typedef std::function<void(const AnalyticsResult &)> AnalyticsCallback;
+
+class AnalyticsPool {
+public:
+    // Counters since the last call to takeStats().
+    struct Stats {
+        unsigned long submitted = 0;
+        unsigned long analysed = 0;
+        unsigned long skipped = 0;  // replaced by a newer frame before analysis
+        double totalDetectMs = 0;
+        double maxDetectMs = 0;
+        double totalLatencyMs = 0;
+    };
+
+    AnalyticsPool(int workers, AnalyticsCallback callback)
+        : callback(std::move(callback))
+    {
+        // The pool provides the parallelism; OpenCV's own threads would only
+        // compete with it (and with the capture thread) for the same cores
+        cv::setNumThreads(1);
+        // One image per worker, one waiting and one being filled
+        spare.reserve(std::max(workers, 1) + 2);
+        for (int i = 0; i < std::max(workers, 1); ++i)
+            threads.emplace_back(&AnalyticsPool::run, this);
+    }
+
+    ~AnalyticsPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+    AnalyticsPool(const AnalyticsPool &) = delete;
+    AnalyticsPool &operator=(const AnalyticsPool &) = delete;
+
+    // Returns a CV_8UC1 image of `size` to fill and submit(), reusing one
+    // from the pool when there is one.
+    cv::Mat buffer(cv::Size size)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (!spare.empty()) {
+            cv::Mat image = std::move(spare.back());
+            spare.pop_back();
+            if (image.size() == size && image.type() == CV_8UC1)
+                return image;
+        }
+        return cv::Mat(size, CV_8UC1);
+    }
+
+    // Queues `gray` (CV_8UC1) for analysis, replacing any frame still waiting.
+    // Never blocks on the detector.
+    void submit(cv::Mat gray, int64_t ptsUs)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending) {
+                ++stats.skipped;
+                recycle(std::move(pendingFrame));
+            }
+            pendingFrame = std::move(gray);
+            pendingPts = ptsUs;
+            pendingSubmitted = std::chrono::steady_clock::now();
+            pending = true;
+            ++stats.submitted;
+        }
+        wake.notify_one();
+    }
+
+    Stats takeStats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats taken = stats;
+        stats = Stats();
+        return taken;
+    }
+
+private:
+    // Called with the mutex held
+    void recycle(cv::Mat image)
+    {
+        if (spare.size() < spare.capacity())
+            spare.push_back(std::move(image));
+    }
+
+    void run()
+    {
+        cv::HOGDescriptor hog;
+        hog.setSVMDetector(cv::HOGDescriptor::getDefaultPeopleDetector());
+
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [this] { return stopping || pending; });
+            if (stopping)
+                return;
+            cv::Mat frame = std::move(pendingFrame);
+            AnalyticsResult result;
+            result.ptsUs = pendingPts;
+            auto submitted = pendingSubmitted;
+            pending = false;
+            lock.unlock();
+
+            auto start = std::chrono::steady_clock::now();
+            std::vector<double> weights;
+            hog.detectMultiScale(frame, result.boxes, weights, 0, cv::Size(8, 8), cv::Size(), 1.05, 2);
+            auto end = std::chrono::steady_clock::now();
+            result.frameSize = frame.size();
+            result.detectMs = std::chrono::duration<double, std::milli>(end - start).count();
+            result.latencyMs = std::chrono::duration<double, std::milli>(end - submitted).count();
+            callback(result);
+
+            lock.lock();
+            recycle(std::move(frame));
+            ++stats.analysed;
+            stats.totalDetectMs += result.detectMs;
+            stats.maxDetectMs = std::max(stats.maxDetectMs, result.detectMs);
+            stats.totalLatencyMs += result.latencyMs;
+        }
+    }
+
+    AnalyticsCallback callback;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+    bool pending = false;
+    cv::Mat pendingFrame;
+    std::vector<cv::Mat> spare;  // images to hand out again from buffer()
+    int64_t pendingPts = 0;
+    std::chrono::steady_clock::time_point pendingSubmitted;
+    Stats stats;
+};
+
+#endif // FRAME_ANALYTICS_H
@@ -1,12 +1,39 @@
 #include <gdk/gdkx.h>
+#include <glib/gstdio.h>
+#include <gst/app/gstappsink.h>
 #include <gst/gst.h>
+#include <gst/video/video.h>
 #include <gst/video/videooverlay.h>
 #include <gtk/gtk.h>
+#include <linux/videodev2.h>
+#include <pango/pangocairo.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <iostream>
 
+#include "frame-consumer.h"
+#include "frame-export.h"
+#include "motion-detector.h"
+#include "overlay-blend.h"
+#include "speed-burnin.h"
+#include "telemetry-log.h"
+#include "undistort.h"
+
+// Frozen-camera detection state, updated on the streaming thread
 typedef struct {
+  guint32 lastHash;          // sampled hash of the previous frame
+  guint repeatedFrames;      // consecutive frames with the same hash
+  GstClockTime lastPts;
+  guint stalledTimestamps;   // consecutive frames whose PTS did not advance
+  gint restartPending;       // a restart has been queued on the main loop
+} FrameWatchdog;
+
+typedef struct AppData {
   GtkWidget* main_window;
   GtkWidget* speedLabel;
   GtkWidget* exitButton;
@@ -15,13 +42,84 @@ typedef struct {
   GtkWidget* videoWidget;
   GstElement* pipeline;
   GstElement* videoSink;
+  GstElement* captureCaps;   // capsfilter selecting the camera mode
+  GArray* captureModes;      // CaptureMode entries the camera offers
+  guint captureResizeSource; // pending size-allocate debounce
+  int viewWidth;             // last video widget size, in device pixels
+  int viewHeight;
+  GstElement* roiCrop;       // videocrop used when the sensor cannot crop
+  gboolean roiEnabled;       // show only the lower part of the image
+  gboolean roiSensorCapable; // the device can crop on the sensor
+  gboolean roiOnSensor;      // the pipeline's device is cropped to the region
+  struct v4l2_rect roiBounds; // sensor crop bounds when roiSensorCapable
+  guint busWatch;
+  FrameHub* frameHub;             // in-process frame consumers
+  FrameExportWriter* frameExport; // shared-memory ring for other processes
+  FrameConsumerId frameExportConsumer;
+  FrameConsumerId motionConsumer;
+  gint motionPending;      // set by the motion detector, cleared by the UI
+  guint motionFps;         // frames analysed per second, --motion-fps=N
+  gint64 lastMotionTime;   // monotonic time of the last motion, in us
+  guint recordingControl;  // timer starting and stopping the recording
+  GstElement* recordBin;   // encoder and pre-roll queue, always running
+  GstPad* prerollSrc;      // pre-roll queue output, blocked when idle
+  gulong prerollBlock;     // blocking probe on prerollSrc
+  GstElement* recordMux;   // muxer and file sink, only while recording
+  GstElement* recordSink;
+  gboolean recording;
+  gboolean recordStopping;
+  gint recordFinalizing;   // a stop is closing the file before teardown
+  gint stopGeneration;     // bumped for every stop that waits for a file
+  gboolean stopPending;    // the pipeline comes down once the file is closed
+  guint stopTimeout;       // gives up on the file after a while
+  void (*afterStop)(AppData* app_data);  // run once the pipeline is down
+  gboolean restartRecording; // a watchdog restart was interrupting a file
+  FrameWatchdog watchdog;
+  Undistorter* undistorter;       // remap tables and threads, kept for the run
+  gboolean undistortEnabled;      // the current camera has a calibration
+  LensCalibration lens;
+  GstBufferPool* undistortPool;   // output frames of the undistort stage
+  GThreadPool* undistortBuilder;  // builds remap tables off the streaming thread
+  GMutex undistortLock;           // guards the tables and their generation
+  guint undistortGeneration;      // bumped on every caps change and stop
+  const UndistortLut* undistortLut;       // table for the negotiated size
+  const UndistortLut* undistortChromaLut; // table for the chroma planes
+  GstVideoInfo undistortInfo;     // negotiated layout, in the camera's format
+  gboolean parkingGuideEnabled;   // draw parking guides on the display
+  OverlaySprite* parkingGuide;    // guides for the negotiated display format
+  GstVideoInfo parkingGuideInfo;
+  GstBufferPool* parkingGuidePool; // the video sink's own frames, for copies
+  int currentSpeed;               // latest speed sample, in km/h
+  SpeedLog* speedLog;             // speed samples by pipeline running time
+  DigitAtlas* speedAtlas;         // digits for the recorded frame height
+  int speedTextHeight;            // text height speedAtlas was rendered at
+  TelemetryWriter* telemetry;     // every speed sample, in a ring file;
+                                  // null until it has been opened
+  GThread* telemetryOpen;         // opens the ring file after first paint
+  TelemetryWriter* openedTelemetry; // handed from telemetryOpen to the loop
+  GArray* pendingTelemetry;       // PendingTelemetry taken before that
+  GstVideoInfo burnInInfo;        // recorded frame layout
+  GstSegment burnInSegment;       // maps recorded frame PTS to running time
+  gint64 startupTime;             // monotonic time main() started, in us
+  gulong firstPaintHandler;       // draw handler waiting for the first paint
+  GThread* gstStartup;            // initialises GStreamer after first paint
+  gint gstReady;                  // set once gstStartup has finished
+  gboolean minimalRegistry;       // started with --minimal-registry
+  const gchar* pendingDevice;     // camera chosen before GStreamer was ready
   const gchar* selectedDevice;  // Add this line
 } AppData;
 
+// One raw frame size the camera can deliver; with roiOnSensor, the size of
+// the region of interest alone
+typedef struct {
+  int width;
+  int height;
+} CaptureMode;
+
 // Function declarations
 void destroyWidgets(AppData* app_data);
 int getRandomSpeed();
-void updateSpeedometer(GtkLabel* speedLabel);
+void updateSpeedometer(GtkLabel* speedLabel, int speed);
 void exitProgram(GtkWidget* widget, gpointer data);
 void switchToCameraFeed(GtkWidget* widget, gpointer data);
 void backToMainWindow(GtkWidget* widget, gpointer data);
@@ -32,6 +130,104 @@ void setupCameraFeedForDevice(AppData* app_data, const gchar* device);
 void switchToFrontCamera(GtkWidget* widget, gpointer data);
 void switchToRearCamera(GtkWidget* widget, gpointer data);
 void createCameraSelectionButtons(AppData* app_data);
+GtkWidget* createVideoWidget(AppData* app_data);
+void probeCaptureModes(AppData* app_data, GstCaps* uncropped);
+void matchCaptureToSize(AppData* app_data, int width, int height);
+GtkWidget* createRoiButton(AppData* app_data);
+GstCaps* probeSensorCrop(AppData* app_data);
+void stopPipeline(AppData* app_data);
+void stopPipelineThen(AppData* app_data, void (*then)(AppData* app_data));
+GstElement* createFrameHubBranch(AppData* app_data);
+void startFrameExport(AppData* app_data);
+GstElement* createRecordingBranch(AppData* app_data);
+void startRecording(AppData* app_data);
+void stopRecording(AppData* app_data);
+gboolean finalizeRecording(AppData* app_data);
+void startMotionDetection(AppData* app_data);
+void startFrameWatchdog(AppData* app_data, GstElement* element);
+gboolean restartPipeline(gpointer data);
+gboolean loadLensCalibration(const gchar* device, LensCalibration* lens);
+GstElement* createUndistortStage(AppData* app_data);
+int runUndistortBenchmark();
+int runTelemetryBenchmark();
+int runParkedBenchmark(guint motionFps);
+void drawParkingGuide(cairo_t* cr, int width, int height);
+void addParkingGuide(AppData* app_data, GstElement* element);
+void startSpeedSampling(AppData* app_data);
+void startGStreamerInBackground(AppData* app_data);
+void openTelemetryInBackground(AppData* app_data);
+void loadCameraPlugins();
+gboolean useMinimalRegistry();
+int runStartupBenchmark(const char* self);
+int measureStartup(gboolean freshRegistry);
+int runReplay(const gchar* videoPath, const gchar* telemetryPath);
+DigitAtlas* createDigitAtlas(int height);
+
+// Frames kept in the shared-memory export ring
+#define FRAME_EXPORT_SLOTS 4
+
+// How long a stop waits for the current file to be closed
+#define RECORDING_FINALIZE_TIMEOUT_MS 2000
+
+// Motion detection runs at this rate by default, whatever the camera
+// delivers; --motion-fps=N changes it
+#define MOTION_ANALYSIS_FPS 5
+// Video kept from before motion starts, and recorded after it stops
+#define RECORDING_PREROLL_SECONDS 3
+#define RECORDING_POSTROLL_SECONDS 5
+
+// The camera counts as frozen after this many identical frames, or frames
+// whose timestamp does not advance; the hash samples this many pixels
+#define FROZEN_FRAME_LIMIT 60
+#define WATCHDOG_SAMPLES 256
+
+// Lens calibrations, one group per device path, under the user config dir.
+// Keys: width, height (calibration image size), fx, fy, cx, cy, k1..k4 as
+// produced by cv::fisheye::calibrate, and optionally zoom.
+#define LENS_CALIBRATION_FILE "speedometer/lens-calibration.ini"
+
+// Speed sampling period, and the height of the burnt-in speed as a fraction
+// of the recorded frame height
+#define SPEED_SAMPLE_INTERVAL_MS 1000
+#define SPEED_TEXT_HEIGHT_DIVISOR 18
+
+// Telemetry ring file, under the user data dir: about 12 days of 1 Hz
+// samples, or 17 minutes at 1 kHz. Written to disk once a second.
+#define TELEMETRY_FILE "speedometer/telemetry.ring"
+#define TELEMETRY_RECORDS (1 << 20)
+#define TELEMETRY_SYNC_INTERVAL_MS 1000
+
+// Extended comment tags that records carry: the monotonic time of their first
+// frame, which is where replay starts reading the telemetry, and the boot
+// that time belongs to
+#define RECORDING_START_TAG "speedometer-start"
+#define RECORDING_BOOT_TAG "speedometer-boot"
+
+// Element factories the camera screens use; the startup thread loads their
+// plugins so the first camera screen does not have to
+static const char* const kCameraFactories[] = {
+    "v4l2src", "capsfilter", "videocrop",   "tee",       "queue",
+    "videoconvert", "xvimagesink", "appsink", "x264enc", "h264parse",
+    "matroskamux", "filesink"};
+
+// Plugin files the app needs, for --minimal-registry: capture, display,
+// JPEG cameras, recording (encoder, parser, muxer) and playback for
+// replay, where avdec_h264 from libav decodes the recordings. Replay sets
+// its own video sink and recordings have no audio, so playbin never needs
+// autodetect's sinks. videoconvert is in videoconvertscale from GStreamer
+// 1.22 on. Files that are not installed are skipped.
+static const char* const kMinimalPlugins[] = {
+    "libgstcoreelements.so",  "libgstvideo4linux2.so",
+    "libgstxvimage.so",       "libgstjpeg.so",
+    "libgstplayback.so",      "libgsttypefindfunctions.so",
+    "libgstapp.so",           "libgstvideoconvertscale.so",
+    "libgstvideoconvert.so",  "libgstvideocrop.so",
+    "libgstx264.so",          "libgstvideoparsersbad.so",
+    "libgstmatroska.so",      "libgstlibav.so"};
+
+// Region of interest: the rows above this fraction of the frame are dropped
+#define ROI_TOP_NUMERATOR 1
+#define ROI_TOP_DENOMINATOR 3
 
 // Function to handle GStreamer messages
 static gboolean busCallback(GstBus* bus, GstMessage* message, gpointer data) {
@@ -64,7 +260,8 @@ void setupSpeedUpdateTimer(AppData* app_data) {
         AppData* app_data = static_cast<AppData*>(data);
         // Check if the label is still valid before updating
         if (GTK_IS_LABEL(app_data->speedLabel)) {
-          updateSpeedometer(GTK_LABEL(app_data->speedLabel));
+          updateSpeedometer(GTK_LABEL(app_data->speedLabel),
+                            app_data->currentSpeed);
         }
         return G_SOURCE_CONTINUE;
       },
@@ -77,8 +274,7 @@ int getRandomSpeed() {
 }
 
 // Callback function for updating the speedometer display
-void updateSpeedometer(GtkLabel* speedLabel) {
-  int speed = getRandomSpeed();
+void updateSpeedometer(GtkLabel* speedLabel, int speed) {
   char speedText[5];
   sprintf(speedText, "%02d",
           speed);  // Format the speed to always have two digits
@@ -107,19 +303,15 @@ void setupCameraFeedForDevice(AppData* app_data, const gchar* device) {
                                    GTK_STYLE_PROVIDER(cssProvider),
                                    GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
     
-    if (app_data->pipeline) {
-     gst_element_set_state(GST_ELEMENT(app_data->pipeline), GST_STATE_NULL);
-     gst_object_unref(GST_OBJECT(app_data->pipeline));
-     app_data->pipeline = nullptr;
-    }
+    stopPipeline(app_data);
     // GStreamer initialization
     initializeGStreamer(app_data, device);
     // Drawing area for video feed
-    app_data->videoWidget = gtk_drawing_area_new();
-    gtk_widget_set_size_request(app_data->videoWidget, 640, 480);
+    app_data->videoWidget = createVideoWidget(app_data);
     // Set up the grid to arrange the video feed and back button
     gtk_grid_attach(GTK_GRID(grid), app_data->videoWidget, 0, 0, 2, 1);
-    gtk_grid_attach(GTK_GRID(grid), app_data->backButton, 0, 1, 2, 1);
+    gtk_grid_attach(GTK_GRID(grid), app_data->backButton, 0, 1, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), createRoiButton(app_data), 1, 1, 1, 1);
     // Show all widgets
     gtk_widget_show_all(app_data->main_window);
     // Start the GStreamer pipeline
@@ -132,24 +324,57 @@ void setupCameraFeedForDevice(AppData* app_data, const gchar* device) {
   }
 }
 
+// Function to hold the camera screen until GStreamer has started, or the
+// previous camera's recording has been closed
+static void showCameraStarting(AppData* app_data) {
+  GtkWidget* label = gtk_label_new("Starting camera...");
+  gtk_widget_set_name(label, "speed-label");
+  gtk_container_add(GTK_CONTAINER(app_data->main_window), label);
+  gtk_widget_show_all(app_data->main_window);
+}
+
+// Function to open the selected camera once the current pipeline is down
+static void openSelectedCamera(AppData* app_data) {
+  stopPipelineThen(app_data, [](AppData* app_data) {
+    destroyWidgets(app_data);
+    setupCameraFeedForDevice(app_data, app_data->selectedDevice);
+  });
+}
+
 // Callback function for switching to the front camera feed window
 void switchToFrontCamera(GtkWidget* widget, gpointer data) {
   AppData* app_data = static_cast<AppData*>(data);
   app_data->selectedDevice = "/dev/video0";
+  app_data->roiEnabled = FALSE;
+  app_data->parkingGuideEnabled = FALSE;
   // Destroy existing widgets
   destroyWidgets(app_data);
-  // Setup camera feed for the selected device
-  setupCameraFeedForDevice(app_data, app_data->selectedDevice);
+  showCameraStarting(app_data);
+  // Setup camera feed for the selected device, once GStreamer is up
+  if (!g_atomic_int_get(&app_data->gstReady)) {
+    app_data->pendingDevice = app_data->selectedDevice;
+    return;
+  }
+  openSelectedCamera(app_data);
 }
 
 // Callback function for switching to the rear camera feed window
 void switchToRearCamera(GtkWidget* widget, gpointer data) {
   AppData* app_data = static_cast<AppData*>(data);
   app_data->selectedDevice = "/dev/video1";
+  // The rear view only uses the lower part of the image, with parking
+  // guides drawn over it
+  app_data->roiEnabled = TRUE;
+  app_data->parkingGuideEnabled = TRUE;
   // Destroy existing widgets
   destroyWidgets(app_data);
-  // Setup camera feed for the selected device
-  setupCameraFeedForDevice(app_data, app_data->selectedDevice);
+  showCameraStarting(app_data);
+  // Setup camera feed for the selected device, once GStreamer is up
+  if (!g_atomic_int_get(&app_data->gstReady)) {
+    app_data->pendingDevice = app_data->selectedDevice;
+    return;
+  }
+  openSelectedCamera(app_data);
 }
 
 // Function to destroy existing widgets in the main window
@@ -246,21 +471,16 @@ void switchToCameraFeed(GtkWidget* widget, gpointer data) {
 void backToMainWindow(GtkWidget* widget, gpointer data) {
   AppData* app_data = static_cast<AppData*>(data);
   g_message("Back button clicked. Stopping GStreamer pipeline.");
-  // Stop the GStreamer pipeline and release resources
-  gst_element_set_state(app_data->pipeline, GST_STATE_NULL);
-  gst_object_unref(app_data->pipeline);
-  g_message("GStreamer pipeline stopped. Destroying widgets.");
-  // Remove all widgets from the main window
-  GList *children, *iter;
-  children = gtk_container_get_children(GTK_CONTAINER(app_data->main_window));
-  for (iter = children; iter != NULL; iter = g_list_next(iter)) {
-    gtk_widget_destroy(GTK_WIDGET(iter->data));
-  }
-  g_list_free(children);
-  g_message("Widgets destroyed. Setting up the main window.");
-  // Setup the main window
-  setupMainWindow(app_data);
-  g_message("Main window setup complete.");
+  // Stop the GStreamer pipeline and release resources. A file being
+  // recorded is closed first; the camera screen stays up until then.
+  stopPipelineThen(app_data, [](AppData* app_data) {
+    g_message("GStreamer pipeline stopped. Destroying widgets.");
+    destroyWidgets(app_data);
+    g_message("Widgets destroyed. Setting up the main window.");
+    // Setup the main window
+    setupMainWindow(app_data);
+    g_message("Main window setup complete.");
+  });
 }
 
 // Function to create the main window
@@ -296,11 +516,12 @@ void setupMainWindow(AppData* app_data) {
         AppData* app_data = static_cast<AppData*>(data);
         // Check if the label is still valid before updating
         if (GTK_IS_LABEL(app_data->speedLabel)) {
-          updateSpeedometer(GTK_LABEL(app_data->speedLabel));
+          updateSpeedometer(GTK_LABEL(app_data->speedLabel),
+                            app_data->currentSpeed);
         }
         return G_SOURCE_CONTINUE;
       },
-      &app_data);
+      app_data);
   // Load CSS for styling
   GtkCssProvider* cssProvider = gtk_css_provider_new();
   gtk_css_provider_load_from_path(cssProvider, "styles.css", NULL);
@@ -355,20 +576,16 @@ void setupCameraFeed(AppData* app_data) {
   gtk_style_context_add_provider(styleContextBackButton,
                                  GTK_STYLE_PROVIDER(cssProvider),
                                  GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
-  if (app_data->pipeline) {
-    gst_element_set_state(GST_ELEMENT(app_data->pipeline), GST_STATE_NULL);
-    gst_object_unref(GST_OBJECT(app_data->pipeline));
-    app_data->pipeline = nullptr;
-  }
+  stopPipeline(app_data);
   // GStreamer initialization
   initializeGStreamer(app_data, app_data->selectedDevice);
   // Drawing area for video feed
-  app_data->videoWidget = gtk_drawing_area_new();
-  gtk_widget_set_size_request(app_data->videoWidget, 640, 480);
+  app_data->videoWidget = createVideoWidget(app_data);
   // Set up the grid to arrange the video feed and back button
   GtkWidget* grid = gtk_grid_new();
   gtk_grid_attach(GTK_GRID(grid), app_data->videoWidget, 0, 0, 2, 1);
-  gtk_grid_attach(GTK_GRID(grid), app_data->backButton, 0, 1, 2, 1);
+  gtk_grid_attach(GTK_GRID(grid), app_data->backButton, 0, 1, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), createRoiButton(app_data), 1, 1, 1, 1);
   // Add the grid to the camera feed window
   gtk_container_add(GTK_CONTAINER(app_data->main_window), grid);
   // Show all widgets
@@ -380,38 +597,2399 @@ void setupCameraFeed(AppData* app_data) {
   gst_element_set_state(app_data->pipeline, GST_STATE_PLAYING);
 }
 
+// Function to get the number of rows the region of interest drops from the
+// top of a frame. Kept even so chroma-subsampled formats crop cleanly.
+int roiTopRows(AppData* app_data, int height) {
+  if (!app_data->roiEnabled)
+    return 0;
+  return (height * ROI_TOP_NUMERATOR / ROI_TOP_DENOMINATOR) & ~1;
+}
+
+// Function to get the visible height of a frame after the region of interest
+int roiVisibleHeight(AppData* app_data, int height) {
+  return height - roiTopRows(app_data, height);
+}
+
+// Function to close and reopen the camera source, which is in READY, so it
+// probes the device again; v4l2src keeps the sizes it first found until the
+// device is closed. Returns the source's caps, and its new fd in *fd.
+static GstCaps* reopenSource(GstElement* source, int* fd) {
+  gst_element_set_state(source, GST_STATE_NULL);
+  gst_element_set_state(source, GST_STATE_READY);
+  *fd = -1;
+  g_object_get(G_OBJECT(source), "device-fd", fd, NULL);
+  GstPad* pad = gst_element_get_static_pad(source, "src");
+  GstCaps* caps = gst_pad_query_caps(pad, NULL);
+  gst_object_unref(pad);
+  return caps;
+}
+
+// Function to point the sensor crop at `rect`
+static gboolean setSensorCrop(int fd, const struct v4l2_rect& rect) {
+  struct v4l2_selection selection = {};
+  selection.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  selection.target = V4L2_SEL_TGT_CROP;
+  selection.r = rect;
+  return ioctl(fd, VIDIOC_S_SELECTION, &selection) == 0;
+}
+
+// Function to crop the camera to the region of interest on the sensor, if
+// it can, before its modes are listed. v4l2src only asks for sizes it has
+// probed, so the device is reopened with the crop in place and the crop is
+// kept only if the device then offers sizes it did not offer uncropped.
+// Returns the uncropped caps in that case, for probeCaptureModes to leave
+// out; otherwise the device is left uncropped, videocrop drops the rows and
+// NULL is returned. Must be called with the source in READY, when it has
+// the device open and is not streaming.
+GstCaps* probeSensorCrop(AppData* app_data) {
+  GstElement* source =
+      gst_bin_get_by_name(GST_BIN(app_data->pipeline), "webcam_source");
+  int fd = -1;
+  g_object_get(G_OBJECT(source), "device-fd", &fd, NULL);
+  app_data->roiOnSensor = FALSE;
+  struct v4l2_selection selection = {};
+  selection.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  selection.target = V4L2_SEL_TGT_CROP_BOUNDS;
+  app_data->roiSensorCapable =
+      fd >= 0 && ioctl(fd, VIDIOC_G_SELECTION, &selection) == 0;
+  if (!app_data->roiSensorCapable) {
+    gst_object_unref(source);
+    return NULL;
+  }
+  app_data->roiBounds = selection.r;
+  // Start from the full sensor; an earlier run may have left a crop
+  selection.target = V4L2_SEL_TGT_CROP;
+  if (ioctl(fd, VIDIOC_G_SELECTION, &selection) == 0 &&
+      memcmp(&selection.r, &app_data->roiBounds, sizeof(selection.r)) != 0 &&
+      setSensorCrop(fd, app_data->roiBounds))
+    gst_caps_unref(reopenSource(source, &fd));
+  // A sensor crop would move the image away from the lens calibration
+  if (!app_data->roiEnabled || app_data->undistortEnabled) {
+    gst_object_unref(source);
+    return NULL;
+  }
+  GstPad* pad = gst_element_get_static_pad(source, "src");
+  GstCaps* full = gst_pad_query_caps(pad, NULL);
+  gst_object_unref(pad);
+  struct v4l2_rect crop = app_data->roiBounds;
+  int top = roiTopRows(app_data, crop.height);
+  crop.top += top;
+  crop.height -= top;
+  if (setSensorCrop(fd, crop)) {
+    GstCaps* cropped = reopenSource(source, &fd);
+    // The driver must have kept the crop over the reopen, and offer sizes
+    // for it
+    selection.target = V4L2_SEL_TGT_CROP;
+    gboolean kept = fd >= 0 &&
+                    ioctl(fd, VIDIOC_G_SELECTION, &selection) == 0 &&
+                    selection.r.height == crop.height;
+    for (guint i = 0; kept && i < gst_caps_get_size(cropped); i++) {
+      GstStructure* structure = gst_caps_get_structure(cropped, i);
+      gint width, height;
+      if (!gst_structure_has_name(structure, "video/x-raw") ||
+          !gst_structure_get_int(structure, "width", &width) ||
+          !gst_structure_get_int(structure, "height", &height))
+        continue;
+      GstCaps* size = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT,
+                                          width, "height", G_TYPE_INT, height,
+                                          NULL);
+      app_data->roiOnSensor =
+          app_data->roiOnSensor || !gst_caps_can_intersect(size, full);
+      gst_caps_unref(size);
+    }
+    gst_caps_unref(cropped);
+    if (!app_data->roiOnSensor && fd >= 0 &&
+        setSensorCrop(fd, app_data->roiBounds))
+      gst_caps_unref(reopenSource(source, &fd));
+  }
+  gst_object_unref(source);
+  if (app_data->roiOnSensor)
+    return full;
+  gst_caps_unref(full);
+  g_message("The camera offers no cropped sizes; cropping in the pipeline.");
+  return NULL;
+}
+
+// Called by v4l2src right before it sets the device format, on every
+// (re)negotiation. Keeps the sensor cropped to the region of interest,
+// which some drivers reset along with the format.
+static void onPrepareFormat(GstElement*, gint fd, GstCaps*, gpointer data) {
+  AppData* app_data = static_cast<AppData*>(data);
+  if (!app_data->roiOnSensor)
+    return;
+  struct v4l2_rect crop = app_data->roiBounds;
+  int top = roiTopRows(app_data, crop.height);
+  crop.top += top;
+  crop.height -= top;
+  if (!setSensorCrop(fd, crop))
+    g_warning("Failed to set the sensor crop.");
+}
+
+// Function to create the button that toggles the region of interest
+GtkWidget* createRoiButton(AppData* app_data) {
+  GtkWidget* roiButton = gtk_toggle_button_new_with_label("ROI");
+  gtk_widget_set_name(roiButton, "exit-button");
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(roiButton),
+                               app_data->roiEnabled);
+  g_signal_connect(G_OBJECT(roiButton), "toggled",
+                   G_CALLBACK(+[](GtkToggleButton* button, gpointer data) {
+                     AppData* app_data = static_cast<AppData*>(data);
+                     app_data->roiEnabled =
+                         gtk_toggle_button_get_active(button);
+                     // The sensor crop is set while the device is opened,
+                     // so a camera that has one is opened again
+                     if (app_data->roiSensorCapable &&
+                         !app_data->undistortEnabled)
+                       restartPipeline(app_data);
+                     else
+                       matchCaptureToSize(app_data, app_data->viewWidth,
+                                          app_data->viewHeight);
+                   }),
+                   app_data);
+  return roiButton;
+}
+
+// Function to create the drawing area the video is rendered into. It fills
+// the space it is given, and the capture mode follows its size.
+GtkWidget* createVideoWidget(AppData* app_data) {
+  GtkWidget* videoWidget = gtk_drawing_area_new();
+  gtk_widget_set_hexpand(videoWidget, TRUE);
+  gtk_widget_set_vexpand(videoWidget, TRUE);
+  g_signal_connect(
+      G_OBJECT(videoWidget), "size-allocate",
+      G_CALLBACK(+[](GtkWidget* widget, GdkRectangle*, gpointer data) {
+        AppData* app_data = static_cast<AppData*>(data);
+        // Wait for the allocation to settle before renegotiating
+        if (app_data->captureResizeSource)
+          g_source_remove(app_data->captureResizeSource);
+        app_data->captureResizeSource = g_timeout_add(
+            200,
+            [](gpointer data) -> gboolean {
+              AppData* app_data = static_cast<AppData*>(data);
+              app_data->captureResizeSource = 0;
+              if (GTK_IS_WIDGET(app_data->videoWidget)) {
+                int scale = gtk_widget_get_scale_factor(app_data->videoWidget);
+                matchCaptureToSize(
+                    app_data,
+                    gtk_widget_get_allocated_width(app_data->videoWidget) * scale,
+                    gtk_widget_get_allocated_height(app_data->videoWidget) * scale);
+              }
+              return G_SOURCE_REMOVE;
+            },
+            app_data);
+      }),
+      app_data);
+  g_signal_connect(G_OBJECT(videoWidget), "destroy",
+                   G_CALLBACK(+[](GtkWidget*, gpointer data) {
+                     AppData* app_data = static_cast<AppData*>(data);
+                     if (app_data->captureResizeSource) {
+                       g_source_remove(app_data->captureResizeSource);
+                       app_data->captureResizeSource = 0;
+                     }
+                   }),
+                   app_data);
+  return videoWidget;
+}
+
+// Function to list the raw frame sizes the camera supports, leaving out any
+// in `uncropped` (see probeSensorCrop). The source must be at least in the
+// READY state so the device has been probed.
+void probeCaptureModes(AppData* app_data, GstCaps* uncropped) {
+  if (app_data->captureModes)
+    g_array_set_size(app_data->captureModes, 0);
+  else
+    app_data->captureModes = g_array_new(FALSE, FALSE, sizeof(CaptureMode));
+  GstElement* source =
+      gst_bin_get_by_name(GST_BIN(app_data->pipeline), "webcam_source");
+  GstPad* pad = gst_element_get_static_pad(source, "src");
+  GstCaps* caps = gst_pad_query_caps(pad, NULL);
+  for (guint i = 0; i < gst_caps_get_size(caps); i++) {
+    GstStructure* structure = gst_caps_get_structure(caps, i);
+    CaptureMode mode = {};
+    if (!gst_structure_has_name(structure, "video/x-raw") ||
+        !gst_structure_get_int(structure, "width", &mode.width) ||
+        !gst_structure_get_int(structure, "height", &mode.height))
+      continue;
+    if (uncropped) {
+      GstCaps* size = gst_caps_new_simple(
+          "video/x-raw", "width", G_TYPE_INT, mode.width, "height",
+          G_TYPE_INT, mode.height, NULL);
+      gboolean full = gst_caps_can_intersect(size, uncropped);
+      gst_caps_unref(size);
+      if (full)
+        continue;
+    }
+    gboolean known = FALSE;
+    for (guint j = 0; j < app_data->captureModes->len && !known; j++) {
+      CaptureMode* other = &g_array_index(app_data->captureModes, CaptureMode, j);
+      known = other->width == mode.width && other->height == mode.height;
+    }
+    if (!known)
+      g_array_append_val(app_data->captureModes, mode);
+  }
+  gst_caps_unref(caps);
+  gst_object_unref(pad);
+  gst_object_unref(source);
+}
+
+// Function to pick the smallest camera mode that covers width x height and
+// renegotiate the running pipeline to it. When no mode is large enough the
+// largest one is used and the sink scales it up.
+void matchCaptureToSize(AppData* app_data, int width, int height) {
+  if (width > 1 && height > 1) {
+    app_data->viewWidth = width;
+    app_data->viewHeight = height;
+  }
+  if (!app_data->captureCaps || !app_data->captureModes ||
+      app_data->captureModes->len == 0 || width <= 1 || height <= 1)
+    return;
+  const CaptureMode* best = nullptr;
+  const CaptureMode* largest = nullptr;
+  for (guint i = 0; i < app_data->captureModes->len; i++) {
+    const CaptureMode* mode =
+        &g_array_index(app_data->captureModes, CaptureMode, i);
+    if (!largest || mode->width * mode->height >
+                        largest->width * largest->height)
+      largest = mode;
+    int visibleHeight = app_data->roiOnSensor
+                            ? mode->height
+                            : roiVisibleHeight(app_data, mode->height);
+    if (mode->width >= width && visibleHeight >= height &&
+        (!best || mode->width * mode->height < best->width * best->height))
+      best = mode;
+  }
+  if (!best)
+    best = largest;
+
+  GstCaps* current = nullptr;
+  g_object_get(G_OBJECT(app_data->captureCaps), "caps", &current, NULL);
+  // With sensor cropping the device delivers only the region of interest,
+  // at sizes it offers; otherwise the full mode is captured and videocrop
+  // drops the top rows before anything else touches the frame
+  g_object_set(G_OBJECT(app_data->roiCrop), "top",
+               app_data->roiOnSensor ? 0 : roiTopRows(app_data, best->height),
+               NULL);
+  GstCaps* caps = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT,
+                                      best->width, "height", G_TYPE_INT,
+                                      best->height, NULL);
+  if (!current || !gst_caps_is_equal(current, caps)) {
+    g_message("Capturing %dx%d for a %dx%d view%s.", best->width,
+              best->height, width, height,
+              app_data->roiOnSensor ? ", cropped on the sensor" : "");
+    // Changing the filter caps sends a reconfigure upstream, and v4l2src
+    // switches modes without the pipeline leaving PLAYING
+    g_object_set(G_OBJECT(app_data->captureCaps), "caps", caps, NULL);
+  }
+  gst_caps_unref(caps);
+  if (current)
+    gst_caps_unref(current);
+}
+
 // Function to initialize GStreamer pipeline
 void initializeGStreamer(AppData* app_data, const gchar* device) {
-  if (app_data->pipeline) {
-    gst_element_set_state(GST_ELEMENT(app_data->pipeline), GST_STATE_NULL);
-    gst_object_unref(GST_OBJECT(app_data->pipeline));
-    app_data->pipeline = nullptr;
-}
+  stopPipeline(app_data);
   GstElement* pipeline = gst_pipeline_new("webcam_pipeline");
   GstElement* source = gst_element_factory_make("v4l2src", "webcam_source");
+  app_data->captureCaps = gst_element_factory_make("capsfilter", "capture_caps");
+  app_data->roiCrop = gst_element_factory_make("videocrop", "roi_crop");
+  GstElement* tee = gst_element_factory_make("tee", "frame_tee");
+  GstElement* displayQueue = gst_element_factory_make("queue", "display_queue");
+  GstElement* displayConvert =
+      gst_element_factory_make("videoconvert", "display_convert");
   app_data->videoSink = gst_element_factory_make("xvimagesink", "video_sink");
-  if (!pipeline || !source || !app_data->videoSink) {
+  if (!pipeline || !source || !app_data->captureCaps || !app_data->roiCrop ||
+      !tee || !displayQueue || !displayConvert || !app_data->videoSink) {
     g_error("Failed to create GStreamer elements.");
     return;
   }
   g_object_set(G_OBJECT(source), "device", device, NULL);
-  gst_bin_add_many(GST_BIN(pipeline), source, app_data->videoSink, NULL);
-  if (!gst_element_link(source, app_data->videoSink)) {
+  g_signal_connect(G_OBJECT(source), "prepare-format",
+                   G_CALLBACK(onPrepareFormat), app_data);
+  // The display queue keeps the sink on its own thread, so the other tee
+  // branches never add latency to it
+  g_object_set(G_OBJECT(displayQueue), "max-size-buffers", 2, NULL);
+  gst_bin_add_many(GST_BIN(pipeline), source, app_data->captureCaps,
+                   app_data->roiCrop, tee, displayQueue, displayConvert,
+                   app_data->videoSink, NULL);
+  // Fisheye correction goes before the crop, which works on the corrected
+  // image. The display converter only does work when the sink cannot take
+  // the corrected frames as they are.
+  GstElement* captureEnd = app_data->captureCaps;
+  app_data->undistortEnabled = loadLensCalibration(device, &app_data->lens);
+  if (app_data->undistortEnabled) {
+    GstElement* undistort = createUndistortStage(app_data);
+    gst_bin_add(GST_BIN(pipeline), undistort);
+    gst_element_link(app_data->captureCaps, undistort);
+    captureEnd = undistort;
+  }
+  if (!gst_element_link(source, app_data->captureCaps) ||
+      !gst_element_link_many(captureEnd, app_data->roiCrop, tee, displayQueue,
+                             displayConvert, app_data->videoSink, NULL)) {
     g_error("Failed to link GStreamer elements.");
     gst_object_unref(pipeline);
     return;
   }
   app_data->pipeline = pipeline;
+  // Open the device to find out which modes it offers, and start with the
+  // one matching the window until the video widget has been allocated
+  gst_element_set_state(pipeline, GST_STATE_READY);
+  GstCaps* uncropped = probeSensorCrop(app_data);
+  probeCaptureModes(app_data, uncropped);
+  if (uncropped)
+    gst_caps_unref(uncropped);
+  matchCaptureToSize(
+      app_data, gtk_widget_get_allocated_width(app_data->main_window),
+      gtk_widget_get_allocated_height(app_data->main_window));
+  // Feed the in-process frame consumers, and publish frames to other local
+  // processes through one of them
+  GstElement* hubBranch = createFrameHubBranch(app_data);
+  gst_bin_add(GST_BIN(pipeline), hubBranch);
+  gst_element_link(tee, hubBranch);
+  startFrameWatchdog(app_data, tee);
+  addParkingGuide(app_data, displayConvert);
+  startFrameExport(app_data);
+  // Record while the motion detector sees something
+  GstElement* recordBranch = createRecordingBranch(app_data);
+  if (recordBranch) {
+    gst_bin_add(GST_BIN(pipeline), recordBranch);
+    gst_element_link(tee, recordBranch);
+    startMotionDetection(app_data);
+  }
   // Get the bus for the pipeline and add a watch for messages
   GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(app_data->pipeline));
-  gst_bus_add_watch(bus, busCallback, app_data);
+  app_data->busWatch = gst_bus_add_watch(bus, busCallback, app_data);
+  gst_object_unref(bus);
+}
+
+// Carries a file's EOS from the streaming thread to the main loop
+typedef struct {
+  AppData* app_data;
+  gint generation;
+} RecordingClosed;
+
+// Function to finish a stop that was waiting for the file to be closed:
+// tears the pipeline down and runs what was to follow
+static void completeStop(AppData* app_data, gboolean closed) {
+  app_data->stopPending = FALSE;
+  if (app_data->stopTimeout) {
+    g_source_remove(app_data->stopTimeout);
+    app_data->stopTimeout = 0;
+  }
+  if (closed)
+    g_message("Recording stopped.");
+  else
+    g_warning("The recording was not closed in time and may lack its index.");
+  stopPipeline(app_data);
+  void (*then)(AppData*) = app_data->afterStop;
+  app_data->afterStop = nullptr;
+  if (then)
+    then(app_data);
+}
+
+// Called on the main loop when the file's EOS has reached the file sink
+static gboolean onRecordingClosed(gpointer data) {
+  RecordingClosed* closed = static_cast<RecordingClosed*>(data);
+  AppData* app_data = closed->app_data;
+  if (app_data->stopPending &&
+      closed->generation == g_atomic_int_get(&app_data->stopGeneration))
+    completeStop(app_data, TRUE);
+  g_free(closed);
+  return G_SOURCE_REMOVE;
+}
+
+// Function to stop the camera pipeline, then run `then`. A file being
+// recorded is closed first, which takes a moment; the pipeline keeps
+// running meanwhile and the teardown continues from the file's EOS, or
+// after RECORDING_FINALIZE_TIMEOUT_MS. A later stop only replaces `then`.
+void stopPipelineThen(AppData* app_data, void (*then)(AppData* app_data)) {
+  if (app_data->stopPending) {
+    app_data->afterStop = then;
+    return;
+  }
+  // No new files from here on
+  if (app_data->recordingControl) {
+    g_source_remove(app_data->recordingControl);
+    app_data->recordingControl = 0;
+  }
+  if (!finalizeRecording(app_data)) {
+    stopPipeline(app_data);
+    if (then)
+      then(app_data);
+    return;
+  }
+  app_data->stopPending = TRUE;
+  app_data->afterStop = then;
+  app_data->stopTimeout = g_timeout_add(
+      RECORDING_FINALIZE_TIMEOUT_MS,
+      [](gpointer data) -> gboolean {
+        AppData* app_data = static_cast<AppData*>(data);
+        app_data->stopTimeout = 0;
+        completeStop(app_data, FALSE);
+        return G_SOURCE_REMOVE;
+      },
+      app_data);
+}
+
+// Function to stop the camera pipeline and release everything tied to it,
+// right away. A file still being recorded is cut off; stopPipelineThen
+// closes it first.
+void stopPipeline(AppData* app_data) {
+  if (app_data->recordingControl) {
+    g_source_remove(app_data->recordingControl);
+    app_data->recordingControl = 0;
+  }
+  // A stop waiting for its file is overtaken; its EOS is ignored
+  if (app_data->stopPending) {
+    app_data->stopPending = FALSE;
+    app_data->afterStop = nullptr;
+    if (app_data->stopTimeout) {
+      g_source_remove(app_data->stopTimeout);
+      app_data->stopTimeout = 0;
+    }
+  }
+  g_atomic_int_inc(&app_data->stopGeneration);
+  if (app_data->pipeline) {
+    gst_element_set_state(GST_ELEMENT(app_data->pipeline), GST_STATE_NULL);
+    gst_object_unref(GST_OBJECT(app_data->pipeline));
+    app_data->pipeline = nullptr;
+  }
+  if (app_data->busWatch) {
+    g_source_remove(app_data->busWatch);
+    app_data->busWatch = 0;
+  }
+  if (app_data->frameExportConsumer) {
+    app_data->frameHub->removeConsumer(app_data->frameExportConsumer);
+    app_data->frameExportConsumer = 0;
+  }
+  if (app_data->motionConsumer) {
+    app_data->frameHub->removeConsumer(app_data->motionConsumer);
+    app_data->motionConsumer = 0;
+  }
+  delete app_data->frameExport;
+  app_data->frameExport = nullptr;
+  if (app_data->undistortPool) {
+    gst_buffer_pool_set_active(app_data->undistortPool, FALSE);
+    gst_object_unref(app_data->undistortPool);
+    app_data->undistortPool = nullptr;
+  }
+  g_mutex_lock(&app_data->undistortLock);
+  app_data->undistortGeneration++;
+  app_data->undistortLut = nullptr;
+  app_data->undistortChromaLut = nullptr;
+  g_mutex_unlock(&app_data->undistortLock);
+  delete app_data->parkingGuide;
+  app_data->parkingGuide = nullptr;
+  if (app_data->parkingGuidePool) {
+    gst_buffer_pool_set_active(app_data->parkingGuidePool, FALSE);
+    gst_object_unref(app_data->parkingGuidePool);
+    app_data->parkingGuidePool = nullptr;
+  }
+  // Running times start again with the next pipeline
+  app_data->speedLog->clear();
+  if (app_data->prerollSrc) {
+    gst_object_unref(app_data->prerollSrc);
+    app_data->prerollSrc = nullptr;
+  }
+  app_data->recordBin = nullptr;
+  app_data->recordMux = nullptr;
+  app_data->recordSink = nullptr;
+  app_data->prerollBlock = 0;
+  app_data->recording = FALSE;
+  app_data->recordStopping = FALSE;
+  g_atomic_int_set(&app_data->recordFinalizing, FALSE);
+  app_data->captureCaps = nullptr;
+  app_data->roiCrop = nullptr;
+}
+
+// Function to publish frames through the shared-memory ring. Runs as a frame
+// consumer: each frame is copied into the next ring slot on the consumer's
+// thread, and readers map it from there without copying.
+void startFrameExport(AppData* app_data) {
+  size_t maxFrameSize = 0;
+  for (guint i = 0; app_data->captureModes && i < app_data->captureModes->len;
+       i++) {
+    const CaptureMode* mode =
+        &g_array_index(app_data->captureModes, CaptureMode, i);
+    // Room for up to four bytes per pixel, whatever format is negotiated
+    maxFrameSize = MAX(maxFrameSize, (size_t)mode->width * mode->height * 4);
+  }
+  if (maxFrameSize == 0)
+    return;
+  gchar* socketPath = g_build_filename(g_get_user_runtime_dir(),
+                                       "speedometer-frames.sock", NULL);
+  app_data->frameExport =
+      new FrameExportWriter(socketPath, FRAME_EXPORT_SLOTS, maxFrameSize);
+  g_free(socketPath);
+  if (!app_data->frameExport->isReady()) {
+    g_warning("Failed to set up the shared-memory frame export.");
+    delete app_data->frameExport;
+    app_data->frameExport = nullptr;
+    return;
+  }
+  if (!app_data->frameExport->isWriteSealed())
+    g_warning("This kernel cannot seal the frame export read-only; readers "
+              "could overwrite frames.");
+  FrameExportWriter* writer = app_data->frameExport;
+  app_data->frameExportConsumer = app_data->frameHub->addConsumer(
+      "frame-export", FrameConsumerOptions(), [writer](const FrameRef& frame) {
+        gsize size = gst_buffer_get_size(frame->buffer());
+        guint8* slot = writer->beginFrame(size);
+        if (!slot)
+          return;
+        gst_buffer_extract(frame->buffer(), 0, slot, size);
+        uint32_t stride[GST_VIDEO_MAX_PLANES], offset[GST_VIDEO_MAX_PLANES];
+        for (int i = 0; i < frame->planes(); i++) {
+          stride[i] = frame->stride(i);
+          offset[i] = frame->offset(i);
+        }
+        writer->commitFrame(frame->pts(),
+                            gst_video_format_to_fourcc(frame->format()),
+                            frame->width(), frame->height(), frame->planes(),
+                            stride, offset, size);
+      });
+}
+
+// Called on the hub branch's streaming thread for every frame
+static GstFlowReturn onHubSample(GstAppSink* sink, gpointer data) {
+  AppData* app_data = static_cast<AppData*>(data);
+  GstSample* sample = gst_app_sink_pull_sample(sink);
+  if (!sample)
+    return GST_FLOW_EOS;
+  app_data->frameHub->push(sample);
+  gst_sample_unref(sample);
+  return GST_FLOW_OK;
+}
+
+// Function to create the tee branch that feeds the frame hub. The leaky
+// queue and single-buffer appsink drop frames rather than ever holding up
+// the tee; each consumer then queues and drops on its own thread.
+GstElement* createFrameHubBranch(AppData* app_data) {
+  GstElement* bin = gst_bin_new("frame_hub");
+  GstElement* queue = gst_element_factory_make("queue", NULL);
+  GstElement* sink = gst_element_factory_make("appsink", NULL);
+  g_object_set(G_OBJECT(queue), "leaky", 2, "max-size-buffers", 1, NULL);
+  g_object_set(G_OBJECT(sink), "sync", FALSE, "max-buffers", 1, "drop", TRUE,
+               NULL);
+  GstAppSinkCallbacks callbacks = {};
+  callbacks.new_sample = onHubSample;
+  gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, app_data, NULL);
+  gst_bin_add_many(GST_BIN(bin), queue, sink, NULL);
+  gst_element_link(queue, sink);
+  GstPad* pad = gst_element_get_static_pad(queue, "sink");
+  gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+  gst_object_unref(pad);
+  return bin;
+}
+
+// Function to hash a sparse sample of the frame: WATCHDOG_SAMPLES words at an
+// even stride through the buffer. Any live sensor changes some of them from
+// one frame to the next through noise alone.
+static guint32 sampleFrameHash(const guint8* data, gsize size) {
+  guint32 hash = 2166136261u;  // FNV-1a
+  if (size < sizeof(guint32))
+    return hash;
+  gsize step = MAX(size / WATCHDOG_SAMPLES, sizeof(guint32));
+  for (gsize offset = step / 2; offset + sizeof(guint32) <= size;
+       offset += step) {
+    guint32 word;
+    memcpy(&word, data + offset, sizeof(word));
+    hash = (hash ^ word) * 16777619u;
+  }
+  return hash;
+}
+
+// Checks every frame for a frozen image or stalled timestamps, and queues a
+// pipeline restart when either lasts FROZEN_FRAME_LIMIT frames
+static GstPadProbeReturn onWatchdogBuffer(GstPad*, GstPadProbeInfo* info,
+                                          gpointer data) {
+  AppData* app_data = static_cast<AppData*>(data);
+  FrameWatchdog* watchdog = &app_data->watchdog;
+  GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  GstMapInfo map;
+  if (!gst_buffer_map(buffer, &map, GST_MAP_READ))
+    return GST_PAD_PROBE_OK;
+  guint32 hash = sampleFrameHash(map.data, map.size);
+  gst_buffer_unmap(buffer, &map);
+  if (hash == watchdog->lastHash)
+    watchdog->repeatedFrames++;
+  else
+    watchdog->repeatedFrames = 0;
+  watchdog->lastHash = hash;
+
+  GstClockTime pts = GST_BUFFER_PTS(buffer);
+  if (GST_CLOCK_TIME_IS_VALID(pts) &&
+      GST_CLOCK_TIME_IS_VALID(watchdog->lastPts) && pts <= watchdog->lastPts)
+    watchdog->stalledTimestamps++;
+  else
+    watchdog->stalledTimestamps = 0;
+  if (GST_CLOCK_TIME_IS_VALID(pts))
+    watchdog->lastPts = pts;
+
+  if (watchdog->repeatedFrames < FROZEN_FRAME_LIMIT &&
+      watchdog->stalledTimestamps < FROZEN_FRAME_LIMIT)
+    return GST_PAD_PROBE_OK;
+  if (g_atomic_int_compare_and_exchange(&watchdog->restartPending, FALSE,
+                                        TRUE)) {
+    g_warning("Camera looks frozen (%u repeated frames, %u stalled "
+              "timestamps); restarting the pipeline.",
+              watchdog->repeatedFrames, watchdog->stalledTimestamps);
+    g_idle_add(restartPipeline, app_data);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+// Function to watch the frames entering `element` for a frozen camera
+void startFrameWatchdog(AppData* app_data, GstElement* element) {
+  app_data->watchdog = FrameWatchdog();
+  app_data->watchdog.lastPts = GST_CLOCK_TIME_NONE;
+  GstPad* pad = gst_element_get_static_pad(element, "sink");
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, onWatchdogBuffer,
+                    app_data, NULL);
+  gst_object_unref(pad);
+}
+
+// Function to rebuild the camera pipeline for the current device and resume
+// playback in the existing video widget
+gboolean restartPipeline(gpointer data) {
+  AppData* app_data = static_cast<AppData*>(data);
+  // The camera screen may have been left since the restart was queued
+  if (!app_data->pipeline || !app_data->videoWidget || app_data->stopPending)
+    return G_SOURCE_REMOVE;
+  app_data->restartRecording = app_data->recording;
+  stopPipelineThen(app_data, [](AppData* app_data) {
+    if (!app_data->videoWidget)
+      return;
+    int viewWidth = app_data->viewWidth, viewHeight = app_data->viewHeight;
+    initializeGStreamer(app_data, app_data->selectedDevice);
+    matchCaptureToSize(app_data, viewWidth, viewHeight);
+    gst_video_overlay_set_window_handle(
+        GST_VIDEO_OVERLAY(app_data->videoSink),
+        GDK_WINDOW_XID(gtk_widget_get_window(app_data->videoWidget)));
+    gst_element_set_state(app_data->pipeline, GST_STATE_PLAYING);
+    // The interrupted file was closed first; carry on in a new one
+    if (app_data->restartRecording)
+      startRecording(app_data);
+  });
+  return G_SOURCE_REMOVE;
+}
+
+// Holds the pre-roll queue while nothing is being recorded. When a recording
+// is being stopped, ends the file instead of passing the next buffer on.
+static GstPadProbeReturn onPrerollBlocked(GstPad* pad, GstPadProbeInfo*,
+                                          gpointer data) {
+  AppData* app_data = static_cast<AppData*>(data);
+  if (g_atomic_int_compare_and_exchange(&app_data->recordStopping, TRUE,
+                                        FALSE)) {
+    GstPad* peer = gst_pad_get_peer(pad);
+    if (peer) {
+      gst_pad_send_event(peer, gst_event_new_eos());
+      gst_object_unref(peer);
+    }
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+// Drops buffers until the first keyframe, so every file starts decodable.
+// The file is tagged with the monotonic time of that frame and the boot id,
+// which are what its telemetry is found by on replay.
+static GstPadProbeReturn onWaitForKeyframe(GstPad* pad, GstPadProbeInfo* info,
+                                           gpointer data) {
+  AppData* app_data = static_cast<AppData*>(data);
+  GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+    return GST_PAD_PROBE_DROP;
+  GstEvent* event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+  if (event && app_data->pipeline && app_data->recordMux) {
+    const GstSegment* segment;
+    gst_event_parse_segment(event, &segment);
+    guint64 runningTime = gst_segment_to_running_time(
+        segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+    if (GST_CLOCK_TIME_IS_VALID(runningTime)) {
+      // The system clock is CLOCK_MONOTONIC, like the telemetry
+      gchar* comment = g_strdup_printf(
+          RECORDING_START_TAG "=%" G_GUINT64_FORMAT,
+          gst_element_get_base_time(app_data->pipeline) + runningTime);
+      gst_tag_setter_add_tags(GST_TAG_SETTER(app_data->recordMux),
+                              GST_TAG_MERGE_REPLACE, GST_TAG_EXTENDED_COMMENT,
+                              comment, NULL);
+      g_free(comment);
+      comment = g_strdup_printf(RECORDING_BOOT_TAG "=%s",
+                                telemetryBootId().c_str());
+      gst_tag_setter_add_tags(GST_TAG_SETTER(app_data->recordMux),
+                              GST_TAG_MERGE_APPEND, GST_TAG_EXTENDED_COMMENT,
+                              comment, NULL);
+      g_free(comment);
+    }
+  }
+  if (event)
+    gst_event_unref(event);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+// Function to release the muxer and file sink once the file has been closed
+static gboolean finishRecording(gpointer data) {
+  AppData* app_data = static_cast<AppData*>(data);
+  if (!app_data->recordMux)
+    return G_SOURCE_REMOVE;
+  GstPad* muxPad = gst_pad_get_peer(app_data->prerollSrc);
+  if (muxPad) {
+    gst_pad_unlink(app_data->prerollSrc, muxPad);
+    gst_element_release_request_pad(app_data->recordMux, muxPad);
+    gst_object_unref(muxPad);
+  }
+  gst_element_set_state(app_data->recordSink, GST_STATE_NULL);
+  gst_element_set_state(app_data->recordMux, GST_STATE_NULL);
+  gst_bin_remove_many(GST_BIN(app_data->recordBin), app_data->recordMux,
+                      app_data->recordSink, NULL);
+  app_data->recordMux = nullptr;
+  app_data->recordSink = nullptr;
+  app_data->recording = FALSE;
+  g_message("Recording stopped.");
+  return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn onRecordingEos(GstPad*, GstPadProbeInfo* info,
+                                        gpointer data) {
+  AppData* app_data = static_cast<AppData*>(data);
+  if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) != GST_EVENT_EOS)
+    return GST_PAD_PROBE_OK;
+  // A stop is waiting for this and tears the muxer down with the pipeline
+  if (g_atomic_int_get(&app_data->recordFinalizing)) {
+    RecordingClosed* closed = g_new(RecordingClosed, 1);
+    closed->app_data = app_data;
+    closed->generation = g_atomic_int_get(&app_data->stopGeneration);
+    g_idle_add(onRecordingClosed, closed);
+  } else {
+    g_idle_add(finishRecording, data);
+  }
+  // The file is complete; keep the EOS away from the pipeline
+  return GST_PAD_PROBE_DROP;
+}
+
+// Function to render the digits and the unit label at a text height of
+// `height` pixels. Pango is only used here; frames get a plain blit.
+DigitAtlas* createDigitAtlas(int height) {
+  DigitAtlas* atlas = new DigitAtlas();
+  PangoFontDescription* font = pango_font_description_from_string("Sans Bold");
+  pango_font_description_set_absolute_size(font, height * PANGO_SCALE);
+  // Measure first: every digit gets the width of the widest one
+  cairo_surface_t* scratch = cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+  cairo_t* cr = cairo_create(scratch);
+  PangoLayout* layout = pango_cairo_create_layout(cr);
+  pango_layout_set_font_description(layout, font);
+  int lineHeight = 0;
+  for (char digit = '0'; digit <= '9'; digit++) {
+    PangoRectangle logical;
+    pango_layout_set_text(layout, &digit, 1);
+    pango_layout_get_pixel_extents(layout, NULL, &logical);
+    atlas->digitWidth = MAX(atlas->digitWidth, logical.width);
+    lineHeight = MAX(lineHeight, logical.height);
+  }
+  PangoRectangle unitExtents;
+  pango_layout_set_text(layout, "km/h", -1);
+  pango_layout_get_pixel_extents(layout, NULL, &unitExtents);
+  g_object_unref(layout);
+  cairo_destroy(cr);
+  cairo_surface_destroy(scratch);
+  atlas->height = MAX(lineHeight, unitExtents.height);
+  atlas->unitWidth = unitExtents.width;
+  atlas->spacing = MAX(2, height / 4) & ~1;
+
+  // Render each string into an A8 surface and copy its coverage out
+  auto render = [&](const char* text, int length, int width,
+                    std::vector<uint8_t>& mask, int maskStride, int offset) {
+    cairo_surface_t* surface =
+        cairo_image_surface_create(CAIRO_FORMAT_A8, width, atlas->height);
+    cairo_t* cr = cairo_create(surface);
+    PangoLayout* layout = pango_cairo_create_layout(cr);
+    pango_layout_set_font_description(layout, font);
+    pango_layout_set_text(layout, text, length);
+    PangoRectangle logical;
+    pango_layout_get_pixel_extents(layout, NULL, &logical);
+    // Centred in the cell, so narrow digits line up with wide ones
+    cairo_move_to(cr, (width - logical.width) / 2.0, 0);
+    pango_cairo_show_layout(cr, layout);
+    g_object_unref(layout);
+    cairo_destroy(cr);
+    cairo_surface_flush(surface);
+    const guint8* data = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    for (int y = 0; y < atlas->height; y++)
+      memcpy(&mask[(size_t)y * maskStride + offset], data + (size_t)y * stride,
+             width);
+    cairo_surface_destroy(surface);
+  };
+  atlas->digits.assign((size_t)10 * atlas->digitWidth * atlas->height, 0);
+  for (int digit = 0; digit < 10; digit++) {
+    char text = '0' + digit;
+    render(&text, 1, atlas->digitWidth, atlas->digits, 10 * atlas->digitWidth,
+           digit * atlas->digitWidth);
+  }
+  atlas->unit.assign((size_t)atlas->unitWidth * atlas->height, 0);
+  render("km/h", -1, atlas->unitWidth, atlas->unit, atlas->unitWidth, 0);
+  pango_font_description_free(font);
+  return atlas;
+}
+
+// Called for every buffer and event on its way to the encoder. Burns the
+// speed measured at the frame's running time into its bottom-left corner.
+static GstPadProbeReturn onBurnInData(GstPad*, GstPadProbeInfo* info,
+                                      gpointer data) {
+  AppData* app_data = static_cast<AppData*>(data);
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT) {
+      const GstSegment* segment;
+      gst_event_parse_segment(event, &segment);
+      gst_segment_copy_into(segment, &app_data->burnInSegment);
+    } else if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+      GstCaps* caps;
+      gst_event_parse_caps(event, &caps);
+      if (gst_video_info_from_caps(&app_data->burnInInfo, caps)) {
+        int textHeight = MAX(
+            8, GST_VIDEO_INFO_HEIGHT(&app_data->burnInInfo) /
+                   SPEED_TEXT_HEIGHT_DIVISOR);
+        // Digits only need rendering again when the frame height changes
+        if (!app_data->speedAtlas || app_data->speedTextHeight != textHeight) {
+          delete app_data->speedAtlas;
+          app_data->speedAtlas = createDigitAtlas(textHeight);
+          app_data->speedTextHeight = textHeight;
+        }
+      }
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  const DigitAtlas* atlas = app_data->speedAtlas;
+  GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  guint64 runningTime = gst_segment_to_running_time(
+      &app_data->burnInSegment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+  int speed;
+  if (!atlas || !GST_CLOCK_TIME_IS_VALID(runningTime) ||
+      !app_data->speedLog->lookup(runningTime, &speed))
+    return GST_PAD_PROBE_OK;
+  int width = GST_VIDEO_INFO_WIDTH(&app_data->burnInInfo);
+  int height = GST_VIDEO_INFO_HEIGHT(&app_data->burnInInfo);
+  int x = atlas->spacing, y = (height - atlas->boxHeight() - atlas->spacing) & ~1;
+  if (atlas->boxWidth() + x > width || y < 0)
+    return GST_PAD_PROBE_OK;
+  // Only copies when the converter passed a frame shared with the tee
+  buffer = gst_buffer_make_writable(buffer);
+  GST_PAD_PROBE_INFO_DATA(info) = buffer;
+  GstVideoFrame frame;
+  if (gst_video_frame_map(&frame, &app_data->burnInInfo, buffer,
+                          GST_MAP_WRITE)) {
+    burnInSpeed(*atlas, speed,
+                static_cast<uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(&frame, 0)),
+                GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0),
+                static_cast<uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(&frame, 1)),
+                GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 1),
+                static_cast<uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(&frame, 2)),
+                GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 2), x, y);
+    gst_video_frame_unmap(&frame);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+// A speed sample taken before the telemetry log was open
+typedef struct {
+  gint64 monotonic;
+  gint64 pipelineTime;
+  int speed;
+  guint32 flags;
+} PendingTelemetry;
+
+// Function to log a speed sample, holding it until the log is open
+static void appendTelemetry(AppData* app_data, gint64 monotonic,
+                            gint64 pipelineTime, int speed, guint32 flags) {
+  if (app_data->telemetry) {
+    app_data->telemetry->append(monotonic, pipelineTime, speed, flags);
+    return;
+  }
+  PendingTelemetry sample = {monotonic, pipelineTime, speed, flags};
+  g_array_append_val(app_data->pendingTelemetry, sample);
+}
+
+// Function to start logging to `writer`, beginning with the samples held
+// while it was opened
+static void adoptTelemetry(AppData* app_data, TelemetryWriter* writer) {
+  app_data->telemetry = writer;
+  for (guint i = 0; i < app_data->pendingTelemetry->len; i++) {
+    const PendingTelemetry& sample =
+        g_array_index(app_data->pendingTelemetry, PendingTelemetry, i);
+    writer->append(sample.monotonic, sample.pipelineTime, sample.speed,
+                   sample.flags);
+  }
+  g_array_free(app_data->pendingTelemetry, TRUE);
+  app_data->pendingTelemetry = nullptr;
+}
+
+// Function to open the telemetry log on a thread of its own. Reopening
+// scans the whole ring for the last record and creating it allocates and
+// clears it, tens of megabytes either way, which the first paint should
+// not wait for. Samples are held in the meantime.
+void openTelemetryInBackground(AppData* app_data) {
+  app_data->telemetryOpen = g_thread_new(
+      "telemetry-open",
+      [](gpointer data) -> gpointer {
+        AppData* app_data = static_cast<AppData*>(data);
+        gchar* path =
+            g_build_filename(g_get_user_data_dir(), TELEMETRY_FILE, NULL);
+        gchar* directory = g_path_get_dirname(path);
+        g_mkdir_with_parents(directory, 0755);
+        TelemetryWriter* writer = new TelemetryWriter(
+            path, TELEMETRY_RECORDS, TELEMETRY_SYNC_INTERVAL_MS);
+        if (!writer->isReady())
+          g_warning("Failed to open the telemetry log %s.", path);
+        g_free(directory);
+        g_free(path);
+        app_data->openedTelemetry = writer;
+        g_idle_add(
+            [](gpointer data) -> gboolean {
+              AppData* app_data = static_cast<AppData*>(data);
+              if (!app_data->telemetry)
+                adoptTelemetry(app_data, app_data->openedTelemetry);
+              return G_SOURCE_REMOVE;
+            },
+            app_data);
+        return NULL;
+      },
+      app_data);
+}
+
+// Function to take a speed sample every SPEED_SAMPLE_INTERVAL_MS. Samples
+// are logged against the camera pipeline's running time, which is what the
+// recorded frames are matched by.
+void startSpeedSampling(AppData* app_data) {
+  g_timeout_add(
+      SPEED_SAMPLE_INTERVAL_MS,
+      [](gpointer data) -> gboolean {
+        AppData* app_data = static_cast<AppData*>(data);
+        app_data->currentSpeed = getRandomSpeed();
+        gint64 monotonic = telemetryMonotonicNow();
+        gint64 pipelineTime = -1;
+        guint32 flags = 0;
+        GstElement* pipeline = app_data->pipeline;
+        GstClock* clock = pipeline ? gst_element_get_clock(pipeline) : nullptr;
+        if (clock) {
+          GstClockTime now = gst_clock_get_time(clock);
+          GstClockTime base = gst_element_get_base_time(pipeline);
+          if (now >= base) {
+            pipelineTime = now - base;
+            app_data->speedLog->push(pipelineTime, app_data->currentSpeed);
+          }
+          flags |= kTelemetryCameraRunning;
+          gst_object_unref(clock);
+        }
+        if (app_data->recording)
+          flags |= kTelemetryRecording;
+        appendTelemetry(app_data, monotonic, pipelineTime,
+                        app_data->currentSpeed, flags);
+        return G_SOURCE_CONTINUE;
+      },
+      app_data);
+}
+
+// Called on the main loop when GStreamer is ready: opens the camera screen
+// the user asked for while it was starting
+static gboolean onGStreamerReady(gpointer data) {
+  AppData* app_data = static_cast<AppData*>(data);
+  if (app_data->pendingDevice) {
+    app_data->pendingDevice = nullptr;
+    openSelectedCamera(app_data);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+// Function to initialise GStreamer on a thread of its own, so the registry
+// scan and plugin loading happen after the speed screen is painted rather
+// than before. Options on the command line are not seen by GStreamer this
+// way; the GST_* environment variables still are.
+void startGStreamerInBackground(AppData* app_data) {
+  app_data->gstStartup = g_thread_new(
+      "gst-startup",
+      [](gpointer data) -> gpointer {
+        AppData* app_data = static_cast<AppData*>(data);
+        gint64 start = g_get_monotonic_time();
+        gst_init(NULL, NULL);
+        loadCameraPlugins();
+        g_message("GStreamer ready after %.0f ms (%.0f ms of it loading "
+                  "plugins, %s registry).",
+                  (g_get_monotonic_time() - app_data->startupTime) / 1000.0,
+                  (g_get_monotonic_time() - start) / 1000.0,
+                  app_data->minimalRegistry ? "minimal" : "full");
+        g_atomic_int_set(&app_data->gstReady, TRUE);
+        g_idle_add(onGStreamerReady, app_data);
+        return NULL;
+      },
+      app_data);
+}
+
+// Function to load the plugins behind every element the camera screens use
+void loadCameraPlugins() {
+  for (const char* name : kCameraFactories) {
+    GstElementFactory* factory = gst_element_factory_find(name);
+    if (!factory) {
+      g_warning("No %s element; the camera screens need it.", name);
+      continue;
+    }
+    GstPluginFeature* loaded =
+        gst_plugin_feature_load(GST_PLUGIN_FEATURE(factory));
+    if (loaded)
+      gst_object_unref(loaded);
+    gst_object_unref(factory);
+  }
+}
+
+// Function to make GStreamer see only the plugins in kMinimalPlugins. They
+// are linked into a private directory that replaces the system plugin path,
+// with a registry of its own, so startup scans a dozen plugins instead of
+// every one installed. The links are remade only when one of the plugins
+// was added, removed or replaced; GStreamer rescans a plugin when its file
+// changes. Must run before gst_init and before other threads start.
+gboolean useMinimalRegistry() {
+  const gchar* systemPath = g_getenv("GST_PLUGIN_SYSTEM_PATH_1_0");
+  gchar** dirs;
+  if (systemPath) {
+    dirs = g_strsplit(systemPath, G_SEARCHPATH_SEPARATOR_S, 0);
+  } else {
+    // The pluginsdir of the GStreamer the app was built against, passed as
+    // -DGST_PLUGINS_DIR="\"$(pkg-config --variable=pluginsdir gstreamer-1.0)\""
+#ifdef GST_PLUGINS_DIR
+    dirs = g_new0(gchar*, 2);
+    dirs[0] = g_strdup(GST_PLUGINS_DIR);
+#else
+    g_warning("Built without GST_PLUGINS_DIR and GST_PLUGIN_SYSTEM_PATH_1_0 "
+              "is not set; using the full registry.");
+    return FALSE;
+#endif
+  }
+  // The plugin set, as one "path size mtime" line per plugin found
+  GPtrArray* plugins = g_ptr_array_new_with_free_func(g_free);
+  GString* manifest = g_string_new(NULL);
+  for (const char* name : kMinimalPlugins) {
+    for (int i = 0; dirs[i]; i++) {
+      gchar* path = g_build_filename(dirs[i], name, NULL);
+      GStatBuf st;
+      if (g_stat(path, &st) == 0) {
+        g_string_append_printf(manifest,
+                               "%s %" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n",
+                               path, (gint64)st.st_size, (gint64)st.st_mtime);
+        g_ptr_array_add(plugins, path);
+        break;
+      }
+      g_free(path);
+    }
+  }
+  g_strfreev(dirs);
+  if (plugins->len == 0) {
+    g_warning("None of the plugins for the minimal registry were found; "
+              "using the full registry.");
+    g_ptr_array_unref(plugins);
+    g_string_free(manifest, TRUE);
+    return FALSE;
+  }
+  gchar* base = g_build_filename(g_get_user_cache_dir(), "speedometer",
+                                 "minimal-registry", NULL);
+  gchar* linkDir = g_build_filename(base, "plugins", NULL);
+  gchar* manifestPath = g_build_filename(base, "plugins.list", NULL);
+  gchar* registryPath = g_build_filename(base, "registry.bin", NULL);
+  gchar* previous = nullptr;
+  if (!g_file_get_contents(manifestPath, &previous, NULL, NULL) ||
+      strcmp(previous, manifest->str) != 0) {
+    g_mkdir_with_parents(linkDir, 0755);
+    GDir* dir = g_dir_open(linkDir, 0, NULL);
+    const gchar* name;
+    while (dir && (name = g_dir_read_name(dir))) {
+      gchar* link = g_build_filename(linkDir, name, NULL);
+      g_unlink(link);
+      g_free(link);
+    }
+    if (dir)
+      g_dir_close(dir);
+    for (guint i = 0; i < plugins->len; i++) {
+      const gchar* target = (const gchar*)g_ptr_array_index(plugins, i);
+      gchar* fileName = g_path_get_basename(target);
+      gchar* link = g_build_filename(linkDir, fileName, NULL);
+      if (symlink(target, link) != 0)
+        g_warning("Cannot link %s into %s.", target, linkDir);
+      g_free(link);
+      g_free(fileName);
+    }
+    g_file_set_contents(manifestPath, manifest->str, -1, NULL);
+  }
+  g_setenv("GST_PLUGIN_SYSTEM_PATH_1_0", linkDir, TRUE);
+  g_unsetenv("GST_PLUGIN_PATH_1_0");
+  g_unsetenv("GST_PLUGIN_PATH");
+  g_setenv("GST_REGISTRY_1_0", registryPath, TRUE);
+  // For a dozen plugins the scanner helper process costs more than it saves
+  g_setenv("GST_REGISTRY_FORK", "no", TRUE);
+  g_free(previous);
+  g_free(registryPath);
+  g_free(manifestPath);
+  g_free(linkDir);
+  g_free(base);
+  g_string_free(manifest, TRUE);
+  g_ptr_array_unref(plugins);
+  return TRUE;
+}
+
+// Function to time gst_init and the camera plugin loading in this process,
+// printing milliseconds on stdout. With freshRegistry the registry cache
+// starts empty, as on the first start after an install or update.
+int measureStartup(gboolean freshRegistry) {
+  gchar* registry = nullptr;
+  if (freshRegistry) {
+    int fd =
+        g_file_open_tmp("speedometer-registry-XXXXXX.bin", &registry, NULL);
+    if (fd < 0)
+      return EXIT_FAILURE;
+    close(fd);
+    g_unlink(registry);
+    g_setenv("GST_REGISTRY_1_0", registry, TRUE);
+  }
+  gint64 start = g_get_monotonic_time();
+  gst_init(NULL, NULL);
+  loadCameraPlugins();
+  printf("%.1f\n", (g_get_monotonic_time() - start) / 1000.0);
+  if (registry) {
+    g_unlink(registry);
+    g_free(registry);
+  }
+  return EXIT_SUCCESS;
+}
+
+// Function to report GStreamer startup time with the full and the minimal
+// registry, each with and without a registry cache. Every case runs in
+// fresh processes of this program; the median of three runs is shown. The
+// plugin files stay in the page cache between runs, so "no cache" is the
+// first start after an install, not the first start after boot.
+int runStartupBenchmark(const char* self) {
+  const int kRuns = 3;
+  printf("%-9s %14s %14s\n", "registry", "no cache (ms)", "cached (ms)");
+  for (gboolean minimal : {FALSE, TRUE}) {
+    double medians[2];
+    for (gboolean fresh : {TRUE, FALSE}) {
+      double times[kRuns];
+      for (int run = 0; run < kRuns; run++) {
+        const gchar* args[5] = {self, "--measure-startup", NULL, NULL, NULL};
+        int n = 2;
+        if (minimal)
+          args[n++] = "--minimal-registry";
+        if (fresh)
+          args[n++] = "--fresh-registry";
+        gchar* output = nullptr;
+        gint status = 0;
+        times[run] = -1;
+        // A wait status of 0 is a normal exit with status 0
+        if (g_spawn_sync(NULL, (gchar**)args, NULL, G_SPAWN_SEARCH_PATH, NULL,
+                         NULL, &output, NULL, &status, NULL) &&
+            status == 0)
+          times[run] = g_ascii_strtod(output, NULL);
+        g_free(output);
+      }
+      std::sort(times, times + kRuns);
+      medians[fresh ? 0 : 1] = times[kRuns / 2];
+    }
+    printf("%-9s %14.1f %14.1f\n", minimal ? "minimal" : "full", medians[0],
+           medians[1]);
+  }
+  return EXIT_SUCCESS;
+}
+
+// Sets the encoder's keyframe interval to one second of the negotiated frame
+// rate before the encoder sees the caps
+static GstPadProbeReturn onEncoderCaps(GstPad* pad, GstPadProbeInfo* info,
+                                       gpointer) {
+  GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+  if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+  GstCaps* caps;
+  gst_event_parse_caps(event, &caps);
+  gint numerator = 0, denominator = 1;
+  if (gst_structure_get_fraction(gst_caps_get_structure(caps, 0), "framerate",
+                                 &numerator, &denominator) &&
+      numerator > 0 && denominator > 0) {
+    GstElement* encoder = gst_pad_get_parent_element(pad);
+    g_object_set(G_OBJECT(encoder), "key-int-max",
+                 MAX(1, (numerator + denominator - 1) / denominator), NULL);
+    gst_object_unref(encoder);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+// Function to create the recording branch. Frames are always encoded into a
+// leaky pre-roll queue that holds the last few seconds; the queue's output
+// stays blocked until motion starts a recording. Encoding is what keeps the
+// seconds before the motion, and while parked it costs far more than the
+// motion detector itself; --parked-bench measures both.
+GstElement* createRecordingBranch(AppData* app_data) {
+  GstElement* bin = gst_bin_new("recording");
+  GstElement* queue = gst_element_factory_make("queue", NULL);
+  GstElement* convert = gst_element_factory_make("videoconvert", NULL);
+  GstElement* format = gst_element_factory_make("capsfilter", NULL);
+  GstElement* encoder = gst_element_factory_make("x264enc", NULL);
+  GstElement* parser = gst_element_factory_make("h264parse", NULL);
+  GstElement* preroll = gst_element_factory_make("queue", "preroll");
+  if (!queue || !convert || !format || !encoder || !parser || !preroll) {
+    g_warning("Recording is unavailable: missing encoder elements.");
+    for (GstElement* element :
+         {queue, convert, format, encoder, parser, preroll})
+      if (element)
+        gst_object_unref(element);
+    gst_object_unref(bin);
+    return nullptr;
+  }
+  // Never hold up the tee, even if the encoder falls behind
+  g_object_set(G_OBJECT(queue), "leaky", 2, "max-size-buffers", 4, NULL);
+  gst_util_set_object_arg(G_OBJECT(encoder), "speed-preset", "ultrafast");
+  gst_util_set_object_arg(G_OBJECT(encoder), "tune", "zerolatency");
+  // A keyframe every second, so the pre-roll always contains one. 30 fps
+  // is assumed until the caps give the real frame rate.
+  g_object_set(G_OBJECT(encoder), "key-int-max", 30, NULL);
+  GstPad* encoderSink = gst_element_get_static_pad(encoder, "sink");
+  gst_pad_add_probe(encoderSink, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                    onEncoderCaps, NULL, NULL);
+  gst_object_unref(encoderSink);
+  g_object_set(G_OBJECT(preroll), "leaky", 2, "max-size-buffers", 0,
+               "max-size-bytes", 0, "max-size-time",
+               (guint64)RECORDING_PREROLL_SECONDS * GST_SECOND, NULL);
+  // The speed is burnt into I420 between the converter and the encoder
+  GstCaps* caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING,
+                                      "I420", NULL);
+  g_object_set(G_OBJECT(format), "caps", caps, NULL);
+  gst_caps_unref(caps);
+  gst_bin_add_many(GST_BIN(bin), queue, convert, format, encoder, parser,
+                   preroll, NULL);
+  gst_element_link_many(queue, convert, format, encoder, parser, preroll,
+                        NULL);
+  GstPad* pad = gst_element_get_static_pad(queue, "sink");
+  gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+  gst_object_unref(pad);
+  gst_segment_init(&app_data->burnInSegment, GST_FORMAT_TIME);
+  pad = gst_element_get_static_pad(format, "src");
+  gst_pad_add_probe(pad,
+                    (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER |
+                                      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                    onBurnInData, app_data, NULL);
+  gst_object_unref(pad);
+
+  app_data->recordBin = bin;
+  app_data->prerollSrc = gst_element_get_static_pad(preroll, "src");
+  app_data->prerollBlock = gst_pad_add_probe(
+      app_data->prerollSrc, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+      onPrerollBlocked, app_data, NULL);
+  return bin;
+}
+
+// Function to start writing a new file, beginning with the pre-roll
+void startRecording(AppData* app_data) {
+  if (!app_data->recordBin || app_data->recording)
+    return;
+  const gchar* videos = g_get_user_special_dir(G_USER_DIRECTORY_VIDEOS);
+  gchar* directory =
+      g_build_filename(videos ? videos : g_get_home_dir(), "dashcam", NULL);
+  g_mkdir_with_parents(directory, 0755);
+  GDateTime* now = g_date_time_new_now_local();
+  gchar* name = g_date_time_format(now, "recording-%Y%m%d-%H%M%S.mkv");
+  gchar* location = g_build_filename(directory, name, NULL);
+  g_date_time_unref(now);
+  g_free(name);
+  g_free(directory);
+
+  app_data->recordMux = gst_element_factory_make("matroskamux", NULL);
+  app_data->recordSink = gst_element_factory_make("filesink", NULL);
+  g_object_set(G_OBJECT(app_data->recordSink), "location", location, "async",
+               FALSE, NULL);
+  gst_bin_add_many(GST_BIN(app_data->recordBin), app_data->recordMux,
+                   app_data->recordSink, NULL);
+  gst_element_link(app_data->recordMux, app_data->recordSink);
+  GstPad* sinkPad = gst_element_get_static_pad(app_data->recordSink, "sink");
+  gst_pad_add_probe(sinkPad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                    onRecordingEos, app_data, NULL);
+  gst_object_unref(sinkPad);
+  gst_element_sync_state_with_parent(app_data->recordSink);
+  gst_element_sync_state_with_parent(app_data->recordMux);
+  GstPad* muxPad =
+      gst_element_request_pad_simple(app_data->recordMux, "video_%u");
+  gst_pad_link(app_data->prerollSrc, muxPad);
+  gst_object_unref(muxPad);
+
+  // Let the pre-roll flow, starting at its oldest keyframe
+  gst_pad_add_probe(app_data->prerollSrc, GST_PAD_PROBE_TYPE_BUFFER,
+                    onWaitForKeyframe, app_data, NULL);
+  app_data->recording = TRUE;
+  gst_pad_remove_probe(app_data->prerollSrc, app_data->prerollBlock);
+  app_data->prerollBlock = 0;
+  g_message("Recording to %s.", location);
+  g_free(location);
+}
+
+// Function to end the current file. The pre-roll queue is blocked again and
+// the next buffer it would pass on ends the file instead.
+void stopRecording(AppData* app_data) {
+  if (!app_data->recording || app_data->prerollBlock)
+    return;
+  g_atomic_int_set(&app_data->recordStopping, TRUE);
+  app_data->prerollBlock = gst_pad_add_probe(
+      app_data->prerollSrc, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+      onPrerollBlocked, app_data, NULL);
+}
+
+// Function to start closing the file being recorded before the pipeline is
+// torn down, so it gets its cues and duration. The pre-roll queue is held
+// and EOS is sent straight into the muxer; onRecordingEos reports when it
+// reaches the file sink. Returns FALSE if there is no file to close.
+gboolean finalizeRecording(AppData* app_data) {
+  if (!app_data->pipeline || !app_data->recordMux || !app_data->prerollSrc)
+    return FALSE;
+  g_atomic_int_set(&app_data->recordStopping, FALSE);
+  if (!app_data->prerollBlock)
+    app_data->prerollBlock = gst_pad_add_probe(
+        app_data->prerollSrc, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+        onPrerollBlocked, app_data, NULL);
+  GstPad* muxPad = gst_pad_get_peer(app_data->prerollSrc);
+  if (!muxPad)
+    return FALSE;
+  g_atomic_int_set(&app_data->recordFinalizing, TRUE);
+  gst_pad_send_event(muxPad, gst_event_new_eos());
+  gst_object_unref(muxPad);
+  return TRUE;
+}
+
+// Function to run the motion detector as a frame consumer. Frames are
+// sampled at app_data->motionFps; the result is handed to the UI thread,
+// which starts and stops the recording with pre- and post-roll.
+void startMotionDetection(AppData* app_data) {
+  std::shared_ptr<MotionDetector> detector(new MotionDetector());
+  GstClockTime nextAnalysis = 0;
+  FrameConsumerOptions options;
+  options.maxQueued = 1;
+  options.dropPolicy = FrameDropPolicy::DropOldest;
+  app_data->motionConsumer = app_data->frameHub->addConsumer(
+      "motion", options,
+      [app_data, detector, nextAnalysis](const FrameRef& frame) mutable {
+        GstClockTime pts = frame->pts();
+        if (GST_CLOCK_TIME_IS_VALID(pts)) {
+          if (pts < nextAnalysis)
+            return;
+          nextAnalysis = pts + GST_SECOND / app_data->motionFps;
+        }
+        const GstVideoFrame* video = frame->videoFrame();
+        // Luma, or green as a stand-in for it in RGB frames
+        int component = 0;
+        if (GST_VIDEO_FORMAT_INFO_IS_RGB(video->info.finfo))
+          component = GST_VIDEO_COMP_G;
+        else if (!GST_VIDEO_FORMAT_INFO_IS_YUV(video->info.finfo) &&
+                 !GST_VIDEO_FORMAT_INFO_IS_GRAY(video->info.finfo))
+          return;
+        bool motion = detector->analyse(
+            static_cast<const uint8_t*>(
+                GST_VIDEO_FRAME_COMP_DATA(video, component)),
+            frame->width(), frame->height(),
+            GST_VIDEO_FRAME_COMP_PSTRIDE(video, component),
+            GST_VIDEO_FRAME_COMP_STRIDE(video, component));
+        if (motion)
+          g_atomic_int_set(&app_data->motionPending, TRUE);
+      });
+  app_data->recordingControl = g_timeout_add(
+      1000 / app_data->motionFps,
+      [](gpointer data) -> gboolean {
+        AppData* app_data = static_cast<AppData*>(data);
+        gint64 now = g_get_monotonic_time();
+        if (g_atomic_int_compare_and_exchange(&app_data->motionPending, TRUE,
+                                              FALSE)) {
+          app_data->lastMotionTime = now;
+          startRecording(app_data);
+        } else if (app_data->recording &&
+                   now - app_data->lastMotionTime >
+                       RECORDING_POSTROLL_SECONDS * G_USEC_PER_SEC) {
+          stopRecording(app_data);
+        }
+        return G_SOURCE_CONTINUE;
+      },
+      app_data);
+}
+
+// Function to draw the parking guides for a width x height frame: two lines
+// converging towards the horizon, red near the car, then yellow and green,
+// with a cross mark at each distance step
+void drawParkingGuide(cairo_t* cr, int width, int height) {
+  const struct {
+    double near, far;  // fractions of the frame height, from the top
+    double red, green, blue;
+  } bands[] = {{1.0, 0.8, 0.9, 0.1, 0.1},
+               {0.8, 0.6, 0.95, 0.8, 0.1},
+               {0.6, 0.45, 0.1, 0.8, 0.2}};
+  // Half the distance between the lines, at the bottom and at the horizon
+  const double nearHalf = 0.32, farHalf = 0.14, horizon = 0.45;
+  auto halfWidth = [&](double row) {
+    double t = (1.0 - row) / (1.0 - horizon);
+    return (nearHalf + (farHalf - nearHalf) * t) * width;
+  };
+  cairo_set_line_width(cr, MAX(2.0, height / 120.0));
+  cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+  for (const auto& band : bands) {
+    cairo_set_source_rgba(cr, band.red, band.green, band.blue, 0.85);
+    for (int side = -1; side <= 1; side += 2) {
+      cairo_move_to(cr, width / 2.0 + side * halfWidth(band.near),
+                    band.near * height);
+      cairo_line_to(cr, width / 2.0 + side * halfWidth(band.far),
+                    band.far * height);
+      // Distance mark pointing inwards at the far end of the band
+      cairo_rel_line_to(cr, -side * width * 0.04, 0);
+    }
+    cairo_stroke(cr);
+  }
+}
+
+// Function to get a buffer pool from the video sink, through an allocation
+// query on the pad that feeds it. Frames from the sink's own pool are shown
+// as they are; any other frame the sink copies into one of its own first.
+static GstBufferPool* querySinkPool(GstPad* pad, GstCaps* caps,
+                                    const GstVideoInfo* video) {
+  GstQuery* query = gst_query_new_allocation(caps, TRUE);
+  GstBufferPool* pool = nullptr;
+  if (gst_pad_peer_query(pad, query) &&
+      gst_query_get_n_allocation_pools(query) > 0)
+    gst_query_parse_nth_allocation_pool(query, 0, &pool, NULL, NULL, NULL);
+  gst_query_unref(query);
+  if (!pool)
+    return nullptr;
+  GstStructure* config = gst_buffer_pool_get_config(pool);
+  gst_buffer_pool_config_set_params(config, caps, GST_VIDEO_INFO_SIZE(video),
+                                    2, 0);
+  if (!gst_buffer_pool_set_config(pool, config) ||
+      !gst_buffer_pool_set_active(pool, TRUE)) {
+    gst_object_unref(pool);
+    return nullptr;
+  }
+  return pool;
+}
+
+// Called for every buffer and event leaving the display converter. Caps
+// render the guides for the new frame size and format; each buffer gets the
+// guides blended into their bounding box.
+//
+// When the converter has made a new frame it is the display's own and is
+// drawn on in place. When it passes the camera frame through, that frame is
+// shared with the other tee branches, which must not see the guides; it is
+// then copied into a frame from the sink's pool and drawn on there. That
+// copy is the one the sink would otherwise make itself, so the guides add
+// no full-frame work either way.
+static GstPadProbeReturn onParkingGuideData(GstPad* pad, GstPadProbeInfo* info,
+                                            gpointer data) {
+  AppData* app_data = static_cast<AppData*>(data);
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS)
+      return GST_PAD_PROBE_OK;
+    delete app_data->parkingGuide;
+    app_data->parkingGuide = nullptr;
+    if (app_data->parkingGuidePool) {
+      gst_buffer_pool_set_active(app_data->parkingGuidePool, FALSE);
+      gst_object_unref(app_data->parkingGuidePool);
+      app_data->parkingGuidePool = nullptr;
+    }
+    GstCaps* caps;
+    GstVideoInfo video;
+    gst_event_parse_caps(event, &caps);
+    if (!app_data->parkingGuideEnabled ||
+        !gst_video_info_from_caps(&video, caps))
+      return GST_PAD_PROBE_OK;
+    OverlayFormat format;
+    switch (GST_VIDEO_INFO_FORMAT(&video)) {
+      case GST_VIDEO_FORMAT_BGRx:
+      case GST_VIDEO_FORMAT_BGRA:
+        format = OverlayFormat::BGRx;
+        break;
+      case GST_VIDEO_FORMAT_YUY2:
+        format = OverlayFormat::YUY2;
+        break;
+      case GST_VIDEO_FORMAT_UYVY:
+        format = OverlayFormat::UYVY;
+        break;
+      default:
+        g_warning("No parking guides for %s frames.",
+                  gst_video_format_to_string(GST_VIDEO_INFO_FORMAT(&video)));
+        return GST_PAD_PROBE_OK;
+    }
+    app_data->parkingGuideInfo = video;
+    // Rendered once per frame size; the frames only ever get a blend
+    int width = GST_VIDEO_INFO_WIDTH(&video);
+    int height = GST_VIDEO_INFO_HEIGHT(&video);
+    cairo_surface_t* surface =
+        cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    cairo_t* cr = cairo_create(surface);
+    drawParkingGuide(cr, width, height);
+    cairo_destroy(cr);
+    cairo_surface_flush(surface);
+    app_data->parkingGuide = new OverlaySprite(makeOverlaySprite(
+        cairo_image_surface_get_data(surface),
+        cairo_image_surface_get_stride(surface), width, height, format));
+    cairo_surface_destroy(surface);
+    app_data->parkingGuidePool = querySinkPool(pad, caps, &video);
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (!app_data->parkingGuide || app_data->parkingGuide->empty())
+    return GST_PAD_PROBE_OK;
+  GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  if (!gst_buffer_is_writable(buffer)) {
+    GstBuffer* copy = nullptr;
+    GstVideoFrame in, out;
+    if (!app_data->parkingGuidePool ||
+        gst_buffer_pool_acquire_buffer(app_data->parkingGuidePool, &copy,
+                                       NULL) != GST_FLOW_OK)
+      return GST_PAD_PROBE_OK;  // shown without guides rather than copied twice
+    if (gst_video_frame_map(&in, &app_data->parkingGuideInfo, buffer,
+                            GST_MAP_READ)) {
+      if (gst_video_frame_map(&out, &app_data->parkingGuideInfo, copy,
+                              GST_MAP_WRITE)) {
+        gst_video_frame_copy(&out, &in);
+        gst_video_frame_unmap(&out);
+      }
+      gst_video_frame_unmap(&in);
+    }
+    gst_buffer_copy_into(copy, buffer,
+                         (GstBufferCopyFlags)(GST_BUFFER_COPY_FLAGS |
+                                              GST_BUFFER_COPY_TIMESTAMPS),
+                         0, -1);
+    gst_buffer_unref(buffer);
+    buffer = copy;
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+  }
+  GstVideoFrame frame;
+  if (gst_video_frame_map(&frame, &app_data->parkingGuideInfo, buffer,
+                          GST_MAP_WRITE)) {
+    blendOverlay(*app_data->parkingGuide,
+                 static_cast<uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(&frame, 0)),
+                 GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0));
+    gst_video_frame_unmap(&frame);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+// Function to blend the parking guides into the frames leaving `element`,
+// which must feed the video sink directly
+void addParkingGuide(AppData* app_data, GstElement* element) {
+  GstPad* pad = gst_element_get_static_pad(element, "src");
+  gst_pad_add_probe(pad,
+                    (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER |
+                                      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                    onParkingGuideData, app_data, NULL);
+  gst_object_unref(pad);
+}
+
+// Function to read the fisheye calibration for a device, if it has one
+gboolean loadLensCalibration(const gchar* device, LensCalibration* lens) {
+  gchar* path =
+      g_build_filename(g_get_user_config_dir(), LENS_CALIBRATION_FILE, NULL);
+  GKeyFile* keyFile = g_key_file_new();
+  gboolean found = g_key_file_load_from_file(keyFile, path, G_KEY_FILE_NONE,
+                                             NULL) &&
+                   g_key_file_has_group(keyFile, device);
+  if (found) {
+    GError* error = nullptr;
+    *lens = LensCalibration();
+    lens->width = g_key_file_get_integer(keyFile, device, "width", &error);
+    lens->height = g_key_file_get_integer(keyFile, device, "height", &error);
+    const struct {
+      const gchar* key;
+      double* value;
+    } values[] = {{"fx", &lens->fx}, {"fy", &lens->fy}, {"cx", &lens->cx},
+                  {"cy", &lens->cy}, {"k1", &lens->k1}, {"k2", &lens->k2},
+                  {"k3", &lens->k3}, {"k4", &lens->k4}};
+    for (const auto& entry : values)
+      if (!error)
+        *entry.value = g_key_file_get_double(keyFile, device, entry.key, &error);
+    // The corrected view may be zoomed out to keep more of the edges
+    if (g_key_file_has_key(keyFile, device, "zoom", NULL))
+      lens->zoom = g_key_file_get_double(keyFile, device, "zoom", NULL);
+    if (error || lens->width <= 0 || lens->height <= 0 || lens->fx <= 0 ||
+        lens->fy <= 0 || lens->zoom <= 0) {
+      g_warning("Ignoring the lens calibration for %s in %s: %s", device, path,
+                error ? error->message : "invalid values");
+      found = FALSE;
+    }
+    g_clear_error(&error);
+  }
+  g_key_file_free(keyFile);
+  g_free(path);
+  return found;
+}
+
+// Table sizes for one negotiated format, queued to the table builder
+typedef struct {
+  guint generation;
+  int width, height;              // luma, or the whole frame
+  int chromaWidth, chromaHeight;  // 0 when the format has no chroma planes
+} UndistortTablesJob;
+
+// Runs on the table builder thread. Tables come from the Undistorter's
+// cache, its disk cache, or are built; building a 1080p table takes a few
+// hundred milliseconds, which the streaming thread does not wait for.
+static void buildUndistortTables(gpointer job, gpointer data) {
+  AppData* app_data = static_cast<AppData*>(data);
+  UndistortTablesJob* tables = static_cast<UndistortTablesJob*>(job);
+  g_mutex_lock(&app_data->undistortLock);
+  gboolean stale = tables->generation != app_data->undistortGeneration;
+  g_mutex_unlock(&app_data->undistortLock);
+  if (!stale) {
+    const UndistortLut* luma =
+        app_data->undistorter->lut(app_data->lens, tables->width, tables->height)
+            .get();
+    const UndistortLut* chroma =
+        tables->chromaWidth
+            ? app_data->undistorter
+                  ->lut(app_data->lens, tables->chromaWidth, tables->chromaHeight)
+                  .get()
+            : nullptr;
+    // The Undistorter keeps every table it hands out for the whole run
+    g_mutex_lock(&app_data->undistortLock);
+    if (tables->generation == app_data->undistortGeneration) {
+      app_data->undistortLut = luma;
+      app_data->undistortChromaLut = chroma;
+    }
+    g_mutex_unlock(&app_data->undistortLock);
+  }
+  g_free(tables);
+}
+
+// Function to remap one frame in its own format: each plane through the
+// luma or the chroma table, touching only the bytes of its components
+static void remapFrame(Undistorter* undistorter, const UndistortLut* luma,
+                       const UndistortLut* chroma, GstVideoFrame* in,
+                       GstVideoFrame* out) {
+  auto plane = [&](int index, const UndistortLut* lut,
+                   const RemapLayout& layout) {
+    undistorter->remap(
+        *lut, static_cast<const uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(in, index)),
+        GST_VIDEO_FRAME_PLANE_STRIDE(in, index),
+        static_cast<uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(out, index)),
+        GST_VIDEO_FRAME_PLANE_STRIDE(out, index), layout);
+  };
+  // Pixels outside the lens's view become black in every format
+  RemapLayout y, uv;
+  y.pixelBytes = 1;
+  y.channels = 1;
+  y.fill = 16;
+  uv.fill = 128;
+  switch (GST_VIDEO_FRAME_FORMAT(in)) {
+    case GST_VIDEO_FORMAT_GRAY8:
+      y.fill = 0;
+      plane(0, luma, y);
+      break;
+    case GST_VIDEO_FORMAT_YUY2:
+    case GST_VIDEO_FORMAT_UYVY: {
+      // Luma per pixel, then the chroma pair of each two-pixel group
+      gboolean yuy2 = GST_VIDEO_FRAME_FORMAT(in) == GST_VIDEO_FORMAT_YUY2;
+      y.pixelBytes = 2;
+      y.firstChannel = yuy2 ? 0 : 1;
+      plane(0, luma, y);
+      uv.pixelBytes = 4;
+      uv.firstChannel = yuy2 ? 1 : 0;
+      uv.channels = 2;
+      uv.channelStep = 2;
+      plane(0, chroma, uv);
+      break;
+    }
+    case GST_VIDEO_FORMAT_NV12:
+    case GST_VIDEO_FORMAT_NV21:
+      plane(0, luma, y);
+      uv.pixelBytes = 2;
+      uv.channels = 2;
+      plane(1, chroma, uv);
+      break;
+    case GST_VIDEO_FORMAT_I420:
+    case GST_VIDEO_FORMAT_YV12:
+      plane(0, luma, y);
+      uv.pixelBytes = 1;
+      uv.channels = 1;
+      plane(1, chroma, uv);
+      plane(2, chroma, uv);
+      break;
+    default:
+      // 32-bit RGB in any byte order
+      plane(0, luma, RemapLayout());
+      break;
+  }
+}
+
+// Called for every buffer and event leaving the undistort stage. Caps size
+// the output pool and queue the remap tables for the new size; each buffer
+// is replaced by its corrected copy once the tables are ready, and passes
+// through uncorrected until then.
+static GstPadProbeReturn onUndistortData(GstPad*, GstPadProbeInfo* info,
+                                         gpointer data) {
+  AppData* app_data = static_cast<AppData*>(data);
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS)
+      return GST_PAD_PROBE_OK;
+    GstCaps* caps;
+    GstVideoInfo video;
+    gst_event_parse_caps(event, &caps);
+    if (!gst_video_info_from_caps(&video, caps))
+      return GST_PAD_PROBE_OK;
+    UndistortTablesJob* tables = g_new0(UndistortTablesJob, 1);
+    tables->width = GST_VIDEO_INFO_WIDTH(&video);
+    tables->height = GST_VIDEO_INFO_HEIGHT(&video);
+    if (GST_VIDEO_INFO_IS_YUV(&video)) {
+      tables->chromaWidth = GST_VIDEO_INFO_COMP_WIDTH(&video, 1);
+      tables->chromaHeight = GST_VIDEO_INFO_COMP_HEIGHT(&video, 1);
+    }
+    g_mutex_lock(&app_data->undistortLock);
+    app_data->undistortInfo = video;
+    app_data->undistortLut = nullptr;
+    app_data->undistortChromaLut = nullptr;
+    tables->generation = ++app_data->undistortGeneration;
+    g_mutex_unlock(&app_data->undistortLock);
+    g_thread_pool_push(app_data->undistortBuilder, tables, NULL);
+    if (app_data->undistortPool) {
+      gst_buffer_pool_set_active(app_data->undistortPool, FALSE);
+      gst_object_unref(app_data->undistortPool);
+    }
+    app_data->undistortPool = gst_video_buffer_pool_new();
+    GstStructure* config = gst_buffer_pool_get_config(app_data->undistortPool);
+    gst_buffer_pool_config_set_params(config, caps,
+                                      GST_VIDEO_INFO_SIZE(&video), 4, 0);
+    gst_buffer_pool_set_config(app_data->undistortPool, config);
+    gst_buffer_pool_set_active(app_data->undistortPool, TRUE);
+    return GST_PAD_PROBE_OK;
+  }
+
+  g_mutex_lock(&app_data->undistortLock);
+  const UndistortLut* luma = app_data->undistortLut;
+  const UndistortLut* chroma = app_data->undistortChromaLut;
+  g_mutex_unlock(&app_data->undistortLock);
+  GstBuffer* input = GST_PAD_PROBE_INFO_BUFFER(info);
+  GstBuffer* output = nullptr;
+  if (!luma || (GST_VIDEO_INFO_IS_YUV(&app_data->undistortInfo) && !chroma) ||
+      gst_buffer_pool_acquire_buffer(app_data->undistortPool, &output, NULL) !=
+          GST_FLOW_OK)
+    return GST_PAD_PROBE_OK;
+  GstVideoFrame in, out;
+  if (gst_video_frame_map(&in, &app_data->undistortInfo, input,
+                          GST_MAP_READ)) {
+    if (gst_video_frame_map(&out, &app_data->undistortInfo, output,
+                            GST_MAP_WRITE)) {
+      remapFrame(app_data->undistorter, luma, chroma, &in, &out);
+      gst_video_frame_unmap(&out);
+    }
+    gst_video_frame_unmap(&in);
+  }
+  gst_buffer_copy_into(output, input,
+                       (GstBufferCopyFlags)(GST_BUFFER_COPY_FLAGS |
+                                            GST_BUFFER_COPY_TIMESTAMPS),
+                       0, -1);
+  gst_buffer_unref(input);
+  GST_PAD_PROBE_INFO_DATA(info) = output;
+  return GST_PAD_PROBE_OK;
+}
+
+// Function to create the fisheye correction stage. Frames stay in the
+// camera's format when remapFrame handles it, so nothing downstream has to
+// convert them back; anything else is converted to one it handles.
+GstElement* createUndistortStage(AppData* app_data) {
+  GstElement* bin = gst_bin_new("undistort");
+  GstElement* convert = gst_element_factory_make("videoconvert", NULL);
+  GstElement* filter = gst_element_factory_make("capsfilter", NULL);
+  GstCaps* caps = gst_caps_from_string(
+      "video/x-raw, format=(string){ YUY2, UYVY, NV12, NV21, I420, YV12, "
+      "GRAY8, BGRx, BGRA, RGBx, RGBA, xRGB, ARGB, xBGR, ABGR }");
+  g_object_set(G_OBJECT(filter), "caps", caps, NULL);
+  gst_caps_unref(caps);
+  gst_bin_add_many(GST_BIN(bin), convert, filter, NULL);
+  gst_element_link(convert, filter);
+  GstPad* pad = gst_element_get_static_pad(convert, "sink");
+  gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+  gst_object_unref(pad);
+  pad = gst_element_get_static_pad(filter, "src");
+  gst_pad_add_probe(pad,
+                    (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER |
+                                      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                    onUndistortData, app_data, NULL);
+  gst_element_add_pad(bin, gst_ghost_pad_new("src", pad));
+  gst_object_unref(pad);
+  return bin;
+}
+
+// Function to measure the undistort stage at 720p and 1080p: building a
+// table, loading it from the disk cache, and remapping a frame of each
+// format remapFrame handles with each kernel and thread count. A width that
+// is not a multiple of 4 gives the planar formats padded strides; every
+// kernel is checked against the scalar one. Run with --undistort-bench.
+int runUndistortBenchmark() {
+  gst_init(NULL, NULL);
+  LensCalibration lens;
+  lens.width = 1920;
+  lens.height = 1080;
+  lens.fx = lens.fy = 700;
+  lens.cx = 960;
+  lens.cy = 540;
+  lens.k1 = -0.05;
+  lens.k2 = 0.01;
+  lens.zoom = 0.8;
+  gchar* cacheDir = g_dir_make_tmp("undistort-bench-XXXXXX", NULL);
+  if (!cacheDir)
+    return EXIT_FAILURE;
+  const int maxThreads = (int)g_get_num_processors();
+  const int sizes[][2] = {{1280, 720}, {1918, 1080}, {1920, 1080}};
+  const GstVideoFormat formats[] = {
+      GST_VIDEO_FORMAT_BGRx, GST_VIDEO_FORMAT_GRAY8, GST_VIDEO_FORMAT_I420,
+      GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_YUY2,  GST_VIDEO_FORMAT_UYVY};
+  int failures = 0;
+  for (const auto& size : sizes) {
+    const int width = size[0], height = size[1], iterations = 50;
+    gint64 start = g_get_monotonic_time();
+    Undistorter builder(cacheDir, 1);
+    std::shared_ptr<const UndistortLut> lut = builder.lut(lens, width, height);
+    gint64 built = g_get_monotonic_time();
+    Undistorter loader(cacheDir, 1);
+    loader.lut(lens, width, height);
+    gint64 loaded = g_get_monotonic_time();
+    g_print("%dx%d: table built in %.1f ms, loaded from cache in %.1f ms\n",
+            width, height, (built - start) / 1000.0, (loaded - built) / 1000.0);
+
+    for (GstVideoFormat format : formats) {
+      GstVideoInfo info;
+      gst_video_info_set_format(&info, format, width, height);
+      std::shared_ptr<const UndistortLut> chroma;
+      if (GST_VIDEO_INFO_IS_YUV(&info))
+        chroma = loader.lut(lens, GST_VIDEO_INFO_COMP_WIDTH(&info, 1),
+                            GST_VIDEO_INFO_COMP_HEIGHT(&info, 1));
+      GstBuffer* source = gst_buffer_new_allocate(NULL, info.size, NULL);
+      GstBuffer* reference = gst_buffer_new_allocate(NULL, info.size, NULL);
+      GstBuffer* output = gst_buffer_new_allocate(NULL, info.size, NULL);
+      GstMapInfo map;
+      gst_buffer_map(source, &map, GST_MAP_WRITE);
+      for (gsize i = 0; i < map.size; i++)
+        map.data[i] = (guint8)g_random_int();
+      gst_buffer_unmap(source, &map);
+      GstVideoFrame in, expected, out;
+      gst_video_frame_map(&in, &info, source, GST_MAP_READ);
+      gst_video_frame_map(&expected, &info, reference, GST_MAP_WRITE);
+      gst_video_frame_map(&out, &info, output, GST_MAP_READWRITE);
+      loader.setAvx2(false);
+      remapFrame(&loader, lut.get(), chroma.get(), &in, &expected);
+      g_print(" %s, luma stride %d\n", gst_video_format_to_string(format),
+              GST_VIDEO_FRAME_PLANE_STRIDE(&in, 0));
+      for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        for (gboolean avx2 : {FALSE, TRUE}) {
+          Undistorter undistorter("", threads);
+          undistorter.setAvx2(avx2);
+          if (avx2 && !undistorter.usesAvx2())
+            continue;
+          remapFrame(&undistorter, lut.get(), chroma.get(), &in, &out);
+          gboolean exact = TRUE;
+          for (guint p = 0; p < GST_VIDEO_FRAME_N_PLANES(&out); p++) {
+            // Only the visible bytes of each row; padding is not remapped
+            const int rowBytes =
+                GST_VIDEO_FRAME_COMP_WIDTH(&out, p) *
+                GST_VIDEO_FRAME_COMP_PSTRIDE(&out, p);
+            for (int row = 0; row < GST_VIDEO_FRAME_COMP_HEIGHT(&out, p);
+                 row++) {
+              const int offset = row * GST_VIDEO_FRAME_PLANE_STRIDE(&out, p);
+              exact = exact &&
+                      memcmp((guint8*)GST_VIDEO_FRAME_PLANE_DATA(&out, p) +
+                                 offset,
+                             (guint8*)GST_VIDEO_FRAME_PLANE_DATA(&expected, p) +
+                                 offset,
+                             rowBytes) == 0;
+            }
+          }
+          failures += !exact;
+          gint64 begin = g_get_monotonic_time();
+          for (int i = 0; i < iterations; i++)
+            remapFrame(&undistorter, lut.get(), chroma.get(), &in, &out);
+          double ms = (g_get_monotonic_time() - begin) / 1000.0 / iterations;
+          g_print("  %-6s %2d thread(s): %6.2f ms/frame %7.1f fps  %s\n",
+                  avx2 ? "AVX2" : "scalar", threads, ms, 1000.0 / ms,
+                  exact ? "matches scalar" : "MISMATCH");
+        }
+      }
+      gst_video_frame_unmap(&out);
+      gst_video_frame_unmap(&expected);
+      gst_video_frame_unmap(&in);
+      gst_buffer_unref(output);
+      gst_buffer_unref(reference);
+      gst_buffer_unref(source);
+    }
+  }
+  // Leave nothing behind in the temporary cache
+  GDir* dir = g_dir_open(cacheDir, 0, NULL);
+  if (dir) {
+    const gchar* name;
+    while ((name = g_dir_read_name(dir))) {
+      gchar* file = g_build_filename(cacheDir, name, NULL);
+      g_unlink(file);
+      g_free(file);
+    }
+    g_dir_close(dir);
+  }
+  g_rmdir(cacheDir);
+  g_free(cacheDir);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Function to measure what the camera screen costs while parked, at
+// 640x480: the motion detector at `motionFps`, whose target is under 2% of
+// one core, and the pre-roll encoding, which runs whether or not anything
+// is recorded. The encoding is measured on a live test source at 30 fps,
+// less what the source alone costs. Run with --parked-bench
+// [--motion-fps=N].
+int runParkedBenchmark(guint motionFps) {
+  const int width = 640, height = 480, seconds = 10;
+  // YUY2, the usual webcam format: luma in every other byte. The two
+  // frames differ in one corner, so every analysis sees motion.
+  std::vector<uint8_t> frames[2];
+  for (int f = 0; f < 2; f++) {
+    frames[f].resize((size_t)width * 2 * height);
+    for (size_t i = 0; i < frames[f].size(); i++)
+      frames[f][i] = (uint8_t)(i * 7 + (i / (width * 2)) * 3);
+    for (int y = 0; y < height / 4; y++)
+      memset(&frames[f][(size_t)y * width * 2], f ? 250 : 5, width / 2);
+  }
+  MotionDetector detector;
+  const int analyses = (int)motionFps * seconds;
+  int motion = 0;
+  struct timespec begin, end;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+  for (int i = 0; i < analyses; i++)
+    motion += detector.analyse(frames[i & 1].data(), width, height, 2,
+                               width * 2);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+  double detectorCpu = (end.tv_sec - begin.tv_sec) +
+                       (end.tv_nsec - begin.tv_nsec) / 1e9;
+  g_print("motion detection at %u fps: %.3f ms per frame, %.3f%% of a core "
+          "(target under 2%%), motion in %d of %d frames\n",
+          motionFps, detectorCpu * 1000 / analyses,
+          100 * detectorCpu / seconds, motion, analyses);
+
+  // CPU time of the whole process while `description` runs, per second
+  gst_init(NULL, NULL);
+  auto pipelineCpu = [seconds](const char* description) -> double {
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(description, &error);
+    if (!pipeline) {
+      g_printerr("Cannot run %s: %s\n", description,
+                 error ? error->message : "unknown error");
+      g_clear_error(&error);
+      return -1;
+    }
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    GstBus* bus = gst_element_get_bus(pipeline);
+    GstMessage* message = gst_bus_timed_pop_filtered(
+        bus, seconds * GST_SECOND,
+        (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+    getrusage(RUSAGE_SELF, &after);
+    gboolean failed = message && GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR;
+    if (message)
+      gst_message_unref(message);
+    gst_object_unref(bus);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    if (failed) {
+      g_printerr("%s failed.\n", description);
+      return -1;
+    }
+    auto secondsOf = [](const struct timeval& time) {
+      return time.tv_sec + time.tv_usec / 1e6;
+    };
+    return (secondsOf(after.ru_utime) + secondsOf(after.ru_stime) -
+            secondsOf(before.ru_utime) - secondsOf(before.ru_stime)) /
+           seconds;
+  };
+  const char* source =
+      "videotestsrc is-live=true pattern=ball ! "
+      "video/x-raw,format=YUY2,width=640,height=480,framerate=30/1";
+  gchar* sourceOnly = g_strdup_printf("%s ! fakesink", source);
+  // The recording branch as createRecordingBranch builds it
+  gchar* encoding = g_strdup_printf(
+      "%s ! queue ! videoconvert ! video/x-raw,format=I420 ! "
+      "x264enc speed-preset=ultrafast tune=zerolatency key-int-max=30 ! "
+      "h264parse ! fakesink",
+      source);
+  double sourceCpu = pipelineCpu(sourceOnly);
+  double encodingCpu = pipelineCpu(encoding);
+  g_free(sourceOnly);
+  g_free(encoding);
+  if (sourceCpu < 0 || encodingCpu < 0)
+    return EXIT_FAILURE;
+  g_print("pre-roll encoding at 30 fps: %.1f%% of a core\n",
+          100 * MAX(encodingCpu - sourceCpu, 0.0));
+  return EXIT_SUCCESS;
+}
+
+// Function to check that telemetry appends keep up with 1 kHz sampling:
+// one million appends into a fresh ring of the app's size, with the sync
+// thread running, then one million more into the pages already touched.
+// Reports the time per append, the slowest block of 1000 appends, and page
+// faults, which are the only kernel entries an append can cause. Run with
+// --telemetry-bench.
+int runTelemetryBenchmark() {
+  gchar* directory = g_dir_make_tmp("telemetry-bench-XXXXXX", NULL);
+  if (!directory)
+    return EXIT_FAILURE;
+  gchar* path = g_build_filename(directory, "telemetry.ring", NULL);
+  const int appends = 1000000, block = 1000;
+  gboolean ok;
+  {
+    TelemetryWriter writer(path, TELEMETRY_RECORDS, TELEMETRY_SYNC_INTERVAL_MS);
+    ok = writer.isReady();
+    for (const char* pass : {"fresh ring", "warm ring"}) {
+      if (!ok)
+        break;
+      struct rusage before, after;
+      getrusage(RUSAGE_THREAD, &before);
+      gint64 slowest = 0;
+      gint64 start = telemetryMonotonicNow();
+      for (int i = 0; i < appends; i += block) {
+        gint64 blockStart = telemetryMonotonicNow();
+        for (int j = i; j < i + block; j++)
+          writer.append(blockStart, -1, j % 200, 0);
+        slowest = MAX(slowest, telemetryMonotonicNow() - blockStart);
+      }
+      gint64 elapsed = telemetryMonotonicNow() - start;
+      getrusage(RUSAGE_THREAD, &after);
+      g_print("%-10s %7.1f ns/append, %5.1f M appends/s, slowest %d appends "
+              "%.3f ms, %ld page faults\n",
+              pass, (double)elapsed / appends, appends * 1e3 / elapsed, block,
+              slowest / 1e6,
+              (after.ru_minflt - before.ru_minflt) +
+                  (after.ru_majflt - before.ru_majflt));
+    }
+  }
+  // Everything appended must read back after the writer has closed
+  if (ok) {
+    TelemetryReader reader(path);
+    ok = reader.isReady() &&
+         reader.size() == (size_t)MIN(2 * appends, TELEMETRY_RECORDS);
+    g_print("Read back %zu records: %s\n", reader.size(),
+            ok ? "complete" : "MISSING RECORDS");
+  }
+  g_unlink(path);
+  g_rmdir(directory);
+  g_free(path);
+  g_free(directory);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// State of the replay window
+typedef struct {
+  GtkWidget* speedLabel;
+  GtkWidget* videoWidget;
+  GtkWidget* positionScale;
+  GtkWidget* playButton;
+  GstElement* playbin;
+  GstElement* videoSink;
+  TelemetryReader* telemetry;
+  gint64 startMonotonic;         // first frame's monotonic time, -1 if unknown
+  gchar bootId[TELEMETRY_BOOT_ID_SIZE];  // boot of that time, "" if unknown
+  GstSegment segment;            // of the frames leaving the frame clock
+  GstClockTime firstStreamTime;  // stream time of the first frame
+  gint speed;                    // speed for the frame on screen, -1 if none
+  gint shownSpeed;
+  gdouble rate;
+  gboolean playing;
+  gboolean atEos;                // the end was reached; play starts over
+} ReplayData;
+
+// Replay rates offered, as multiples of real time
+static const gdouble replayRates[] = {0.25, 0.5, 1.0, 2.0, 4.0, 8.0};
+
+// Called as each frame leaves the frame clock, which is when it is shown.
+// Picks the telemetry sample for that frame.
+static GstPadProbeReturn onReplayFrame(GstPad*, GstPadProbeInfo* info,
+                                       gpointer data) {
+  ReplayData* replay = static_cast<ReplayData*>(data);
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT) {
+      const GstSegment* segment;
+      gst_event_parse_segment(event, &segment);
+      gst_segment_copy_into(segment, &replay->segment);
+    }
+    return GST_PAD_PROBE_OK;
+  }
+  guint64 streamTime =
+      gst_segment_to_stream_time(&replay->segment, GST_FORMAT_TIME,
+                                 GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info)));
+  if (!GST_CLOCK_TIME_IS_VALID(streamTime))
+    return GST_PAD_PROBE_OK;
+  // Playback starts at the beginning, so the first frame seen is frame one
+  if (!GST_CLOCK_TIME_IS_VALID(replay->firstStreamTime))
+    replay->firstStreamTime = streamTime;
+  int32_t speed = -1;
+  if (replay->startMonotonic >= 0 && replay->telemetry->isReady())
+    replay->telemetry->sampleAt(
+        replay->bootId,
+        replay->startMonotonic +
+            ((gint64)streamTime - (gint64)replay->firstStreamTime),
+        &speed, NULL);
+  g_atomic_int_set(&replay->speed, speed);
+  return GST_PAD_PROBE_OK;
+}
+
+// Function to seek to `position` at the current replay rate. Above 2x only
+// keyframes are decoded, so high rates do not depend on decoder speed.
+static void seekReplay(ReplayData* replay, gint64 position) {
+  GstSeekFlags flags = GST_SEEK_FLAG_FLUSH;
+  if (replay->rate > 2.0)
+    flags = (GstSeekFlags)(flags | GST_SEEK_FLAG_KEY_UNIT |
+                           GST_SEEK_FLAG_TRICKMODE |
+                           GST_SEEK_FLAG_TRICKMODE_KEY_UNITS);
+  else
+    flags = (GstSeekFlags)(flags | GST_SEEK_FLAG_ACCURATE);
+  replay->atEos = FALSE;
+  gst_element_seek(replay->playbin, replay->rate, GST_FORMAT_TIME, flags,
+                   GST_SEEK_TYPE_SET, MAX(position, 0), GST_SEEK_TYPE_NONE,
+                   GST_CLOCK_TIME_NONE);
+}
+
+static gboolean onReplayMessage(GstBus*, GstMessage* message, gpointer data) {
+  ReplayData* replay = static_cast<ReplayData*>(data);
+  switch (GST_MESSAGE_TYPE(message)) {
+    case GST_MESSAGE_TAG: {
+      GstTagList* tags;
+      gst_message_parse_tag(message, &tags);
+      const gchar* comment;
+      for (guint i = 0; gst_tag_list_peek_string_index(
+               tags, GST_TAG_EXTENDED_COMMENT, i, &comment);
+           i++)
+        if (g_str_has_prefix(comment, RECORDING_START_TAG "="))
+          replay->startMonotonic = g_ascii_strtoll(
+              comment + strlen(RECORDING_START_TAG "="), NULL, 10);
+        else if (g_str_has_prefix(comment, RECORDING_BOOT_TAG "="))
+          g_strlcpy(replay->bootId, comment + strlen(RECORDING_BOOT_TAG "="),
+                    sizeof(replay->bootId));
+      gst_tag_list_unref(tags);
+      break;
+    }
+    case GST_MESSAGE_EOS:
+      // Hold the last frame; seeking or play starts again
+      gst_element_set_state(replay->playbin, GST_STATE_PAUSED);
+      replay->playing = FALSE;
+      replay->atEos = TRUE;
+      gtk_button_set_label(GTK_BUTTON(replay->playButton), "Play");
+      break;
+    case GST_MESSAGE_ERROR: {
+      GError* error = nullptr;
+      gst_message_parse_error(message, &error, NULL);
+      g_critical("Replay failed in %s: %s", GST_OBJECT_NAME(message->src),
+                 error->message);
+      g_error_free(error);
+      gtk_main_quit();
+      break;
+    }
+    default:
+      break;
+  }
+  return TRUE;
+}
+
+// Function to refresh the speed and position shown, at display rate
+static gboolean updateReplayControls(gpointer data) {
+  ReplayData* replay = static_cast<ReplayData*>(data);
+  gint speed = g_atomic_int_get(&replay->speed);
+  if (speed != replay->shownSpeed) {
+    char speedText[8];
+    if (speed >= 0)
+      snprintf(speedText, sizeof(speedText), "%02d", speed);
+    else
+      snprintf(speedText, sizeof(speedText), "--");
+    gtk_label_set_text(GTK_LABEL(replay->speedLabel), speedText);
+    replay->shownSpeed = speed;
+  }
+  gint64 position, duration;
+  if (gst_element_query_duration(replay->playbin, GST_FORMAT_TIME, &duration) &&
+      gst_element_query_position(replay->playbin, GST_FORMAT_TIME, &position)) {
+    GtkAdjustment* adjustment =
+        gtk_range_get_adjustment(GTK_RANGE(replay->positionScale));
+    gtk_adjustment_set_upper(adjustment, (gdouble)duration / GST_SECOND);
+    gtk_adjustment_set_value(adjustment, (gdouble)position / GST_SECOND);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+// Function to replay a recording with the speed from its telemetry, shown
+// frame by frame as the video plays. Run with --replay <file> [telemetry].
+int runReplay(const gchar* videoPath, const gchar* telemetryPath) {
+  ReplayData replay = {};
+  replay.startMonotonic = -1;
+  replay.firstStreamTime = GST_CLOCK_TIME_NONE;
+  replay.speed = replay.shownSpeed = -1;
+  replay.rate = 1.0;
+  gst_segment_init(&replay.segment, GST_FORMAT_TIME);
+  replay.telemetry = new TelemetryReader(telemetryPath);
+  if (!replay.telemetry->isReady())
+    g_warning("No telemetry in %s; replaying video only.", telemetryPath);
+
+  GError* error = nullptr;
+  gchar* uri = gst_filename_to_uri(videoPath, &error);
+  replay.playbin = gst_element_factory_make("playbin", "replay");
+  // The identity element syncs each frame to the clock before passing it
+  // on, so its output is the frame clock the speed display follows
+  GstElement* sinkBin = gst_parse_bin_from_description(
+      "identity name=frame_clock sync=true ! videoconvert ! "
+      "xvimagesink name=replay_sink sync=false",
+      TRUE, NULL);
+  if (!uri || !replay.playbin || !sinkBin) {
+    g_critical("Cannot replay %s: %s", videoPath,
+               error ? error->message : "missing GStreamer elements");
+    g_clear_error(&error);
+    return EXIT_FAILURE;
+  }
+  g_object_set(G_OBJECT(replay.playbin), "uri", uri, "video-sink", sinkBin,
+               NULL);
+  g_free(uri);
+  GstElement* frameClock = gst_bin_get_by_name(GST_BIN(sinkBin), "frame_clock");
+  GstPad* pad = gst_element_get_static_pad(frameClock, "src");
+  gst_pad_add_probe(pad,
+                    (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER |
+                                      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                    onReplayFrame, &replay, NULL);
+  gst_object_unref(pad);
+  gst_object_unref(frameClock);
+  replay.videoSink = gst_bin_get_by_name(GST_BIN(sinkBin), "replay_sink");
+  GstBus* bus = gst_element_get_bus(replay.playbin);
+  guint busWatch = gst_bus_add_watch(bus, onReplayMessage, &replay);
   gst_object_unref(bus);
+
+  GtkWidget* window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_title(GTK_WINDOW(window), "Replay");
+  gtk_window_set_default_size(GTK_WINDOW(window), 800, 600);
+  g_signal_connect(G_OBJECT(window), "destroy", G_CALLBACK(gtk_main_quit),
+                   NULL);
+  GtkWidget* grid = gtk_grid_new();
+  gtk_container_add(GTK_CONTAINER(window), grid);
+  replay.videoWidget = gtk_drawing_area_new();
+  gtk_widget_set_hexpand(replay.videoWidget, TRUE);
+  gtk_widget_set_vexpand(replay.videoWidget, TRUE);
+  replay.speedLabel = gtk_label_new("--");
+  gtk_widget_set_name(replay.speedLabel, "speed-label");
+  replay.playButton = gtk_button_new_with_label("Pause");
+  g_signal_connect(G_OBJECT(replay.playButton), "clicked",
+                   G_CALLBACK(+[](GtkButton* button, gpointer data) {
+                     ReplayData* replay = static_cast<ReplayData*>(data);
+                     replay->playing = !replay->playing;
+                     // At the end, play starts from the beginning
+                     if (replay->playing && replay->atEos)
+                       seekReplay(replay, 0);
+                     gst_element_set_state(replay->playbin,
+                                           replay->playing ? GST_STATE_PLAYING
+                                                           : GST_STATE_PAUSED);
+                     gtk_button_set_label(button,
+                                          replay->playing ? "Pause" : "Play");
+                   }),
+                   &replay);
+  GtkWidget* rateBox = gtk_combo_box_text_new();
+  for (gdouble rate : replayRates) {
+    gchar* text = g_strdup_printf("%gx", rate);
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(rateBox), text);
+    g_free(text);
+    if (rate == 1.0)
+      gtk_combo_box_set_active(
+          GTK_COMBO_BOX(rateBox),
+          gtk_tree_model_iter_n_children(
+              gtk_combo_box_get_model(GTK_COMBO_BOX(rateBox)), NULL) - 1);
+  }
+  g_signal_connect(G_OBJECT(rateBox), "changed",
+                   G_CALLBACK(+[](GtkComboBox* box, gpointer data) {
+                     ReplayData* replay = static_cast<ReplayData*>(data);
+                     gint64 position = 0;
+                     replay->rate = replayRates[gtk_combo_box_get_active(box)];
+                     gst_element_query_position(replay->playbin,
+                                                GST_FORMAT_TIME, &position);
+                     seekReplay(replay, position);
+                   }),
+                   &replay);
+  replay.positionScale =
+      gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0, 1, 0.1);
+  gtk_scale_set_draw_value(GTK_SCALE(replay.positionScale), FALSE);
+  gtk_widget_set_hexpand(replay.positionScale, TRUE);
+  // Only user moves seek; updates from the position timer do not emit this
+  g_signal_connect(G_OBJECT(replay.positionScale), "change-value",
+                   G_CALLBACK(+[](GtkRange*, GtkScrollType, gdouble value,
+                                  gpointer data) -> gboolean {
+                     seekReplay(static_cast<ReplayData*>(data),
+                                (gint64)(value * GST_SECOND));
+                     return FALSE;
+                   }),
+                   &replay);
+  gtk_grid_attach(GTK_GRID(grid), replay.videoWidget, 0, 0, 3, 1);
+  gtk_grid_attach(GTK_GRID(grid), replay.speedLabel, 3, 0, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), replay.playButton, 0, 1, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), rateBox, 1, 1, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), replay.positionScale, 2, 1, 2, 1);
+  gtk_widget_show_all(window);
+
+  gst_video_overlay_set_window_handle(
+      GST_VIDEO_OVERLAY(replay.videoSink),
+      GDK_WINDOW_XID(gtk_widget_get_window(replay.videoWidget)));
+  replay.playing = TRUE;
+  gst_element_set_state(replay.playbin, GST_STATE_PLAYING);
+  guint controlsTimer = g_timeout_add(40, updateReplayControls, &replay);
+  gtk_main();
+
+  g_source_remove(controlsTimer);
+  g_source_remove(busWatch);
+  gst_element_set_state(replay.playbin, GST_STATE_NULL);
+  gst_object_unref(replay.videoSink);
+  gst_object_unref(replay.playbin);
+  delete replay.telemetry;
+  return EXIT_SUCCESS;
 }
 
 int main(int argc, char* argv[]) {
+  gint64 startupTime = g_get_monotonic_time();
+  // Startup flags may come anywhere; they are taken out so the modes below
+  // find their arguments in place
+  gboolean minimalRegistry = FALSE, freshRegistry = FALSE;
+  guint motionFps = MOTION_ANALYSIS_FPS;
+  int kept = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--minimal-registry") == 0)
+      minimalRegistry = TRUE;
+    else if (strcmp(argv[i], "--fresh-registry") == 0)
+      freshRegistry = TRUE;
+    else if (g_str_has_prefix(argv[i], "--motion-fps="))
+      motionFps = CLAMP(atoi(argv[i] + strlen("--motion-fps=")), 1, 60);
+    else
+      argv[kept++] = argv[i];
+  }
+  argc = kept;
+  argv[argc] = NULL;
+  if (minimalRegistry)
+    minimalRegistry = useMinimalRegistry();
+  if (argc > 1 && strcmp(argv[1], "--measure-startup") == 0)
+    return measureStartup(freshRegistry);
+  if (argc > 1 && strcmp(argv[1], "--startup-bench") == 0)
+    return runStartupBenchmark(argv[0]);
+  if (argc > 1 && strcmp(argv[1], "--undistort-bench") == 0)
+    return runUndistortBenchmark();
+  if (argc > 1 && strcmp(argv[1], "--telemetry-bench") == 0)
+    return runTelemetryBenchmark();
+  if (argc > 1 && strcmp(argv[1], "--parked-bench") == 0)
+    return runParkedBenchmark(motionFps);
   gtk_init(&argc, &argv);
-  gst_init(&argc, &argv);
-  AppData app_data;
+  if (argc > 2 && strcmp(argv[1], "--replay") == 0) {
+    gst_init(&argc, &argv);
+    gchar* telemetryPath =
+        argc > 3 ? g_strdup(argv[3])
+                 : g_build_filename(g_get_user_data_dir(), TELEMETRY_FILE,
+                                    NULL);
+    int status = runReplay(argv[2], telemetryPath);
+    g_free(telemetryPath);
+    return status;
+  }
+  AppData app_data = {};
+  app_data.startupTime = startupTime;
+  app_data.minimalRegistry = minimalRegistry;
+  app_data.motionFps = motionFps;
   app_data.main_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
   gtk_window_set_title(GTK_WINDOW(app_data.main_window), "Digital Speedometer");
   gtk_window_set_default_size(GTK_WINDOW(app_data.main_window), 800, 600);
@@ -422,11 +3000,64 @@ int main(int argc, char* argv[]) {
                    G_CALLBACK(gtk_main_quit), NULL);
   // Initialize the selectedDevice member
   app_data.selectedDevice = nullptr;
-  // Setup the main window
+  app_data.frameHub = new FrameHub();
+  app_data.speedLog = new SpeedLog();
+  // The pipelines run on GStreamer's system clock, which is CLOCK_MONOTONIC
+  // like the telemetry, so samples line up with frames. The log itself is
+  // opened after first paint; samples are held until then.
+  app_data.pendingTelemetry =
+      g_array_new(FALSE, FALSE, sizeof(PendingTelemetry));
+  startSpeedSampling(&app_data);
+  // Remap tables are cached on disk across runs; the stage uses every core
+  gchar* lutCache =
+      g_build_filename(g_get_user_cache_dir(), "speedometer", NULL);
+  g_mkdir_with_parents(lutCache, 0755);
+  app_data.undistorter =
+      new Undistorter(lutCache, (int)g_get_num_processors());
+  g_free(lutCache);
+  g_mutex_init(&app_data.undistortLock);
+  app_data.undistortBuilder =
+      g_thread_pool_new(buildUndistortTables, &app_data, 1, FALSE, NULL);
+  // Setup the main window; GStreamer starts once it has been painted
   setupMainWindow(&app_data);
+  app_data.firstPaintHandler = g_signal_connect(
+      G_OBJECT(app_data.main_window), "draw",
+      G_CALLBACK(+[](GtkWidget* widget, cairo_t*, gpointer data) -> gboolean {
+        AppData* app_data = static_cast<AppData*>(data);
+        g_message("First paint after %.0f ms.",
+                  (g_get_monotonic_time() - app_data->startupTime) / 1000.0);
+        g_signal_handler_disconnect(widget, app_data->firstPaintHandler);
+        // Started from an idle callback so it runs after this frame is done
+        g_idle_add(
+            [](gpointer data) -> gboolean {
+              startGStreamerInBackground(static_cast<AppData*>(data));
+              openTelemetryInBackground(static_cast<AppData*>(data));
+              return G_SOURCE_REMOVE;
+            },
+            data);
+        return FALSE;
+      }),
+      &app_data);
   gtk_main();
-  // Clean up GStreamer pipeline
-  gst_element_set_state(app_data.pipeline, GST_STATE_NULL);
-  gst_object_unref(app_data.pipeline);
+  if (app_data.gstStartup)
+    g_thread_join(app_data.gstStartup);
+  // Samples still held go to the log if it opened after the main loop ended
+  if (app_data.telemetryOpen)
+    g_thread_join(app_data.telemetryOpen);
+  if (!app_data.telemetry && app_data.openedTelemetry)
+    adoptTelemetry(&app_data, app_data.openedTelemetry);
+  if (app_data.pendingTelemetry)
+    g_array_free(app_data.pendingTelemetry, TRUE);
+  // Clean up GStreamer pipeline, closing a file being recorded first
+  stopPipelineThen(&app_data, nullptr);
+  while (app_data.stopPending)
+    g_main_context_iteration(NULL, TRUE);
+  // Let a table being built finish before the Undistorter goes
+  g_thread_pool_free(app_data.undistortBuilder, TRUE, TRUE);
+  delete app_data.frameHub;
+  delete app_data.undistorter;
+  delete app_data.speedLog;
+  delete app_data.telemetry;
+  delete app_data.speedAtlas;
   return 0;
 }
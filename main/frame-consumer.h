@@ -0,0 +1,230 @@
+#ifndef FRAME_CONSUMER_H
+#define FRAME_CONSUMER_H
+
+// In-process frame consumers.
+//
+// Code that wants to look at camera frames registers a handler with a
+// FrameHub. The hub is fed from its own tee branch, and every consumer runs
+// on its own thread with its own bounded queue. A consumer that falls behind
+// only drops its own frames. It never slows the display branch or the other
+// consumers.
+//
+// Frames are handed out as FrameRef, a shared pointer to a read-only,
+// already mapped view of the GstBuffer. Nothing is copied; the buffer is
+// released when the last consumer lets go of it.
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <pthread.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Read-only view of one mapped video frame.
+class FrameView {
+ public:
+  // Maps `buffer` for reading with the layout described by `info`. Check
+  // isValid() before use.
+  FrameView(GstBuffer* buffer, const GstVideoInfo* info) {
+    mapped_ = gst_video_frame_map(&frame_, const_cast<GstVideoInfo*>(info),
+                                  buffer, GST_MAP_READ);
+  }
+
+  ~FrameView() {
+    if (mapped_) gst_video_frame_unmap(&frame_);
+  }
+
+  FrameView(const FrameView&) = delete;
+  FrameView& operator=(const FrameView&) = delete;
+
+  bool isValid() const { return mapped_; }
+  GstClockTime pts() const { return GST_BUFFER_PTS(frame_.buffer); }
+  GstVideoFormat format() const { return GST_VIDEO_FRAME_FORMAT(&frame_); }
+  int width() const { return GST_VIDEO_FRAME_WIDTH(&frame_); }
+  int height() const { return GST_VIDEO_FRAME_HEIGHT(&frame_); }
+  int planes() const { return GST_VIDEO_FRAME_N_PLANES(&frame_); }
+  const uint8_t* plane(int i) const {
+    return static_cast<const uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(&frame_, i));
+  }
+  int stride(int i) const { return GST_VIDEO_FRAME_PLANE_STRIDE(&frame_, i); }
+  // Offset of plane i from the start of the buffer
+  size_t offset(int i) const { return GST_VIDEO_FRAME_PLANE_OFFSET(&frame_, i); }
+  const GstVideoInfo* info() const { return &frame_.info; }
+  // For per-component access through the GST_VIDEO_FRAME_COMP_* macros
+  const GstVideoFrame* videoFrame() const { return &frame_; }
+  // Borrowed; valid for as long as the view is alive
+  GstBuffer* buffer() const { return frame_.buffer; }
+
+ private:
+  GstVideoFrame frame_;
+  bool mapped_ = false;
+};
+
+typedef std::shared_ptr<const FrameView> FrameRef;
+
+// What a consumer's queue does when it is full.
+enum class FrameDropPolicy {
+  DropOldest,  // make room by discarding the longest-waiting frame
+  DropNewest,  // keep the queue and discard the incoming frame
+};
+
+struct FrameConsumerOptions {
+  size_t maxQueued = 1;
+  FrameDropPolicy dropPolicy = FrameDropPolicy::DropOldest;
+};
+
+typedef std::function<void(const FrameRef&)> FrameHandler;
+typedef unsigned FrameConsumerId;
+
+class FrameHub {
+ public:
+  FrameHub() = default;
+  ~FrameHub() {
+    std::map<FrameConsumerId, std::unique_ptr<Consumer>> consumers;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      consumers.swap(consumers_);
+    }
+    for (auto& entry : consumers) entry.second->stop();
+  }
+
+  FrameHub(const FrameHub&) = delete;
+  FrameHub& operator=(const FrameHub&) = delete;
+
+  // Starts a consumer thread that calls `handler` for each frame it accepts.
+  FrameConsumerId addConsumer(const std::string& name,
+                              const FrameConsumerOptions& options,
+                              FrameHandler handler) {
+    std::unique_ptr<Consumer> consumer(
+        new Consumer(name, options, std::move(handler)));
+    std::lock_guard<std::mutex> lock(mutex_);
+    FrameConsumerId id = ++lastId_;
+    consumers_[id] = std::move(consumer);
+    return id;
+  }
+
+  // Stops a consumer and waits for its handler to return. Frames still queued
+  // for it are dropped.
+  void removeConsumer(FrameConsumerId id) {
+    std::unique_ptr<Consumer> consumer;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = consumers_.find(id);
+      if (it == consumers_.end()) return;
+      consumer = std::move(it->second);
+      consumers_.erase(it);
+    }
+    consumer->stop();
+  }
+
+  bool hasConsumers() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !consumers_.empty();
+  }
+
+  // Hands a frame to every consumer. Never blocks on a consumer.
+  void push(GstSample* sample) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (consumers_.empty()) return;
+    GstCaps* caps = gst_sample_get_caps(sample);
+    // Caps only change on renegotiation, so the layout is parsed once per caps
+    if (caps && caps != caps_.get()) {
+      if (!gst_video_info_from_caps(&info_, caps)) return;
+      caps_.reset(gst_caps_ref(caps));
+    }
+    if (!caps_) return;
+    auto frame =
+        std::make_shared<const FrameView>(gst_sample_get_buffer(sample), &info_);
+    if (!frame->isValid()) return;
+    for (auto& entry : consumers_) entry.second->offer(frame);
+  }
+
+  // Frames dropped by a consumer's queue since it was added.
+  uint64_t droppedFrames(FrameConsumerId id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = consumers_.find(id);
+    return it == consumers_.end() ? 0 : it->second->dropped();
+  }
+
+ private:
+  struct CapsUnref {
+    void operator()(GstCaps* caps) const { gst_caps_unref(caps); }
+  };
+
+  class Consumer {
+   public:
+    Consumer(const std::string& name, const FrameConsumerOptions& options,
+             FrameHandler handler)
+        : options_(options), handler_(std::move(handler)) {
+      if (options_.maxQueued == 0) options_.maxQueued = 1;
+      thread_ = std::thread([this, name] {
+        pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+        run();
+      });
+    }
+
+    void offer(const FrameRef& frame) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (queue_.size() >= options_.maxQueued) {
+        dropped_++;
+        if (options_.dropPolicy == FrameDropPolicy::DropNewest) return;
+        queue_.pop_front();
+      }
+      queue_.push_back(frame);
+      wake_.notify_one();
+    }
+
+    void stop() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        queue_.clear();
+        wake_.notify_one();
+      }
+      thread_.join();
+    }
+
+    uint64_t dropped() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return dropped_;
+    }
+
+   private:
+    void run() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      for (;;) {
+        wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (stopping_) return;
+        FrameRef frame = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+        handler_(frame);
+        frame.reset();
+        lock.lock();
+      }
+    }
+
+    FrameConsumerOptions options_;
+    FrameHandler handler_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<FrameRef> queue_;
+    uint64_t dropped_ = 0;
+    bool stopping_ = false;
+    std::thread thread_;
+  };
+
+  std::mutex mutex_;
+  std::map<FrameConsumerId, std::unique_ptr<Consumer>> consumers_;
+  FrameConsumerId lastId_ = 0;
+  std::unique_ptr<GstCaps, CapsUnref> caps_;
+  GstVideoInfo info_;
+};
+
+#endif  // FRAME_CONSUMER_H
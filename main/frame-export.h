@@ -0,0 +1,402 @@
+#ifndef FRAME_EXPORT_H
+#define FRAME_EXPORT_H
+
+// Shared-memory export of camera frames to other local processes.
+//
+// The writer owns a memfd holding a header followed by a ring of fixed-size
+// slots. Each slot carries one frame and a small descriptor (timestamp,
+// format, size, plane strides and offsets). Readers connect to a Unix socket,
+// receive the memfd over SCM_RIGHTS, map it and read frames in place,
+// so no copy is made on the reader side. The ring is sealed against new
+// writable mappings, so readers can only map it read-only and cannot corrupt
+// frames for each other; kernels before Linux 5.1 cannot seal that, and
+// there the writer only seals the ring's size (see isWriteSealed()). The one word readers do write, the count of
+// sleeping readers, lives in a separate one-page memfd sent alongside.
+//
+// The writer never waits for readers. Every slot has a sequence counter that
+// is odd while the slot is being written. A reader checks the counter before
+// and after using a slot, and a slow reader simply misses frames. The header's
+// doorbell word is a shared futex that is bumped once per frame, so readers
+// can sleep until the next one is published.
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+
+#define FRAME_EXPORT_MAGIC 0x50584546u  // "FEXP"
+#define FRAME_EXPORT_VERSION 2u
+#define FRAME_EXPORT_MAX_PLANES 4
+
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010  // Linux 5.1
+#endif
+
+// Descriptor at the start of every slot. The frame data follows at
+// FrameExportHeader::dataOffset from the start of the slot.
+struct FrameExportSlot {
+  std::atomic<uint64_t> sequence;  // 2 * frame number, +1 while writing
+  uint64_t pts;                    // buffer PTS as captured, in ns
+  uint32_t fourcc;                 // GStreamer format as a fourcc, e.g. YUY2
+  uint32_t width;
+  uint32_t height;
+  uint32_t planes;
+  uint32_t stride[FRAME_EXPORT_MAX_PLANES];
+  uint32_t offset[FRAME_EXPORT_MAX_PLANES];  // relative to the frame data
+  uint64_t size;                             // bytes of frame data
+};
+
+struct FrameExportHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slotCount;
+  uint32_t dataOffset;  // from slot start to frame data
+  uint64_t slotSize;    // distance between slots
+  uint64_t slotsOffset; // from mapping start to slot 0
+  std::atomic<uint64_t> latest;    // number of the newest frame, 0 if none
+  std::atomic<uint32_t> doorbell;  // futex, bumped once per frame
+  std::atomic<uint32_t> closed;    // set when the writer goes away
+};
+
+// The only memory readers write, mapped from the second memfd
+struct FrameExportControl {
+  std::atomic<uint32_t> waiters;  // readers sleeping on the doorbell
+};
+
+static inline size_t frameExportMappingSize(const FrameExportHeader* header) {
+  return header->slotsOffset + header->slotSize * header->slotCount;
+}
+
+static inline FrameExportSlot* frameExportSlot(FrameExportHeader* header,
+                                               uint64_t frame) {
+  return reinterpret_cast<FrameExportSlot*>(
+      reinterpret_cast<uint8_t*>(header) + header->slotsOffset +
+      header->slotSize * (frame % header->slotCount));
+}
+
+static inline const FrameExportSlot* frameExportSlot(
+    const FrameExportHeader* header, uint64_t frame) {
+  return reinterpret_cast<const FrameExportSlot*>(
+      reinterpret_cast<const uint8_t*>(header) + header->slotsOffset +
+      header->slotSize * (frame % header->slotCount));
+}
+
+static inline const uint8_t* frameExportData(const FrameExportHeader* header,
+                                             const FrameExportSlot* slot) {
+  return reinterpret_cast<const uint8_t*>(slot) + header->dataOffset;
+}
+
+// Publishing side, owned by the camera pipeline.
+class FrameExportWriter {
+ public:
+  FrameExportWriter(const std::string& socketPath, uint32_t slotCount,
+                    size_t maxFrameSize)
+      : socketPath_(socketPath) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t dataOffset = 64 * ((sizeof(FrameExportSlot) + 63) / 64);
+    const size_t slotSize =
+        page * ((dataOffset + maxFrameSize + page - 1) / page);
+    const size_t slotsOffset = page;
+    size_ = slotsOffset + slotSize * slotCount;
+
+    memfd_ = memfd_create("frame-export", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd_ < 0 || ftruncate(memfd_, size_) < 0) return;
+    void* mapping =
+        mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, memfd_, 0);
+    if (mapping == MAP_FAILED) return;
+    // Readers may not grow or shrink the ring under the writer, nor map it
+    // writable; the writer's own mapping stays writable. Older kernels
+    // reject F_SEAL_FUTURE_WRITE with EINVAL and add none of the seals, so
+    // the size seals are tried again on their own. Without them a reader
+    // could truncate the ring and fault the writer, so nothing is exported.
+    writeSealed_ = fcntl(memfd_, F_ADD_SEALS,
+                         F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE |
+                             F_SEAL_SEAL) == 0;
+    if (!writeSealed_ &&
+        (errno != EINVAL ||
+         fcntl(memfd_, F_ADD_SEALS,
+               F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)) {
+      munmap(mapping, size_);
+      return;
+    }
+    header_ = static_cast<FrameExportHeader*>(mapping);
+
+    controlFd_ = memfd_create("frame-export-control",
+                              MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (controlFd_ < 0 || ftruncate(controlFd_, page) < 0 ||
+        fcntl(controlFd_, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+      return;
+    mapping = mmap(nullptr, page, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   controlFd_, 0);
+    if (mapping == MAP_FAILED) return;
+    control_ = static_cast<FrameExportControl*>(mapping);
+    header_->magic = FRAME_EXPORT_MAGIC;
+    header_->version = FRAME_EXPORT_VERSION;
+    header_->slotCount = slotCount;
+    header_->dataOffset = dataOffset;
+    header_->slotSize = slotSize;
+    header_->slotsOffset = slotsOffset;
+    maxFrameSize_ = slotSize - dataOffset;
+
+    listenFd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath_.c_str(),
+            sizeof(address.sun_path) - 1);
+    unlink(socketPath_.c_str());
+    if (listenFd_ < 0 ||
+        bind(listenFd_, reinterpret_cast<sockaddr*>(&address),
+             sizeof(address)) < 0 ||
+        listen(listenFd_, 8) < 0) {
+      return;
+    }
+    acceptThread_ = std::thread(&FrameExportWriter::acceptLoop, this);
+  }
+
+  ~FrameExportWriter() {
+    if (listenFd_ >= 0) {
+      stopping_ = true;
+      shutdown(listenFd_, SHUT_RDWR);
+      if (acceptThread_.joinable()) acceptThread_.join();
+      close(listenFd_);
+      unlink(socketPath_.c_str());
+    }
+    if (header_) {
+      header_->closed.store(1, std::memory_order_release);
+      if (control_) ringDoorbell();
+      munmap(header_, size_);
+    }
+    if (control_) munmap(control_, sysconf(_SC_PAGESIZE));
+    if (controlFd_ >= 0) close(controlFd_);
+    if (memfd_ >= 0) close(memfd_);
+  }
+
+  FrameExportWriter(const FrameExportWriter&) = delete;
+  FrameExportWriter& operator=(const FrameExportWriter&) = delete;
+
+  bool isReady() const {
+    return header_ && control_ && acceptThread_.joinable();
+  }
+
+  // Whether readers are kept from mapping the ring writable
+  bool isWriteSealed() const { return writeSealed_; }
+
+  size_t maxFrameSize() const { return maxFrameSize_; }
+
+  // Claims the next slot and returns where the frame data goes, or nullptr
+  // when the frame does not fit. Must be followed by commitFrame().
+  uint8_t* beginFrame(size_t size) {
+    if (!header_ || size > maxFrameSize_) return nullptr;
+    frame_ = header_->latest.load(std::memory_order_relaxed) + 1;
+    slot_ = frameExportSlot(header_, frame_);
+    slot_->sequence.store(frame_ * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return reinterpret_cast<uint8_t*>(slot_) + header_->dataOffset;
+  }
+
+  // Fills in the descriptor of the slot claimed by beginFrame(), makes it
+  // visible to readers and wakes the ones that are waiting.
+  void commitFrame(uint64_t pts, uint32_t fourcc, uint32_t width,
+                   uint32_t height, uint32_t planes, const uint32_t* stride,
+                   const uint32_t* offset, uint64_t size) {
+    slot_->pts = pts;
+    slot_->fourcc = fourcc;
+    slot_->width = width;
+    slot_->height = height;
+    slot_->planes = planes < FRAME_EXPORT_MAX_PLANES ? planes
+                                                     : FRAME_EXPORT_MAX_PLANES;
+    for (uint32_t i = 0; i < slot_->planes; i++) {
+      slot_->stride[i] = stride[i];
+      slot_->offset[i] = offset[i];
+    }
+    slot_->size = size;
+    slot_->sequence.store(frame_ * 2, std::memory_order_release);
+    header_->latest.store(frame_, std::memory_order_release);
+    ringDoorbell();
+  }
+
+ private:
+  void ringDoorbell() {
+    header_->doorbell.fetch_add(1, std::memory_order_release);
+    // Only pay for the syscall when somebody is asleep
+    if (control_->waiters.load(std::memory_order_acquire) > 0)
+      syscall(SYS_futex, &header_->doorbell, FUTEX_WAKE, INT_MAX, nullptr,
+              nullptr, 0);
+  }
+
+  void acceptLoop() {
+    for (;;) {
+      int client = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client < 0) {
+        if (stopping_ || errno != EINTR) return;
+        continue;
+      }
+      // One message: the mapping size, with the ring and control memfds
+      // attached
+      uint64_t size = size_;
+      int fds[2] = {memfd_, controlFd_};
+      struct iovec iov = {&size, sizeof(size)};
+      char control[CMSG_SPACE(sizeof(fds))] = {};
+      struct msghdr message = {};
+      message.msg_iov = &iov;
+      message.msg_iovlen = 1;
+      message.msg_control = control;
+      message.msg_controllen = sizeof(control);
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+      memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+      sendmsg(client, &message, MSG_NOSIGNAL);
+      close(client);
+    }
+  }
+
+  std::string socketPath_;
+  int memfd_ = -1;
+  int controlFd_ = -1;
+  int listenFd_ = -1;
+  size_t size_ = 0;
+  size_t maxFrameSize_ = 0;
+  bool writeSealed_ = false;
+  FrameExportHeader* header_ = nullptr;
+  FrameExportControl* control_ = nullptr;
+  FrameExportSlot* slot_ = nullptr;
+  uint64_t frame_ = 0;
+  std::atomic<bool> stopping_{false};
+  std::thread acceptThread_;
+};
+
+// Reading side, for analytics processes.
+//
+//   FrameExportReader reader(path);
+//   uint64_t frame = 0;
+//   while (const FrameExportSlot* slot = reader.waitForFrame(&frame, 1000)) {
+//     analyse(reader.data(slot), slot->width, slot->height, slot->stride);
+//     if (!reader.isIntact(slot, frame)) continue;  // overwritten meanwhile
+//   }
+class FrameExportReader {
+ public:
+  explicit FrameExportReader(const std::string& socketPath) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(),
+            sizeof(address.sun_path) - 1);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address),
+                          sizeof(address)) < 0) {
+      if (fd >= 0) close(fd);
+      return;
+    }
+    uint64_t size = 0;
+    struct iovec iov = {&size, sizeof(size)};
+    int fds[2] = {-1, -1};
+    char control[CMSG_SPACE(sizeof(fds))] = {};
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &message, MSG_CMSG_CLOEXEC) == sizeof(size)) {
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+      if (cmsg && cmsg->cmsg_type == SCM_RIGHTS &&
+          cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    }
+    close(fd);
+    if (fds[0] < 0 || fds[1] < 0) {
+      if (fds[0] >= 0) close(fds[0]);
+      return;
+    }
+    const size_t page = sysconf(_SC_PAGESIZE);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fds[0], 0);
+    void* controlMapping =
+        mmap(nullptr, page, PROT_READ | PROT_WRITE, MAP_SHARED, fds[1], 0);
+    close(fds[0]);
+    close(fds[1]);
+    if (mapping == MAP_FAILED || controlMapping == MAP_FAILED) {
+      if (mapping != MAP_FAILED) munmap(mapping, size);
+      if (controlMapping != MAP_FAILED) munmap(controlMapping, page);
+      return;
+    }
+    header_ = static_cast<const FrameExportHeader*>(mapping);
+    control_ = static_cast<FrameExportControl*>(controlMapping);
+    size_ = size;
+    if (header_->magic != FRAME_EXPORT_MAGIC ||
+        header_->version != FRAME_EXPORT_VERSION ||
+        frameExportMappingSize(header_) > size_) {
+      munmap(const_cast<FrameExportHeader*>(header_), size_);
+      munmap(control_, page);
+      header_ = nullptr;
+      control_ = nullptr;
+    }
+  }
+
+  ~FrameExportReader() {
+    if (header_) munmap(const_cast<FrameExportHeader*>(header_), size_);
+    if (control_) munmap(control_, sysconf(_SC_PAGESIZE));
+  }
+
+  FrameExportReader(const FrameExportReader&) = delete;
+  FrameExportReader& operator=(const FrameExportReader&) = delete;
+
+  bool isConnected() const {
+    return header_ && !header_->closed.load(std::memory_order_acquire);
+  }
+
+  // Waits up to timeoutMs for a frame newer than *frame and returns its slot,
+  // updating *frame. Frames published in between are skipped. Returns
+  // nullptr on timeout or when the writer has gone away.
+  const FrameExportSlot* waitForFrame(uint64_t* frame, int timeoutMs) {
+    while (isConnected()) {
+      uint32_t doorbell = header_->doorbell.load(std::memory_order_acquire);
+      uint64_t latest = header_->latest.load(std::memory_order_acquire);
+      if (latest > *frame) {
+        const FrameExportSlot* slot = frameExportSlot(header_, latest);
+        if (slot->sequence.load(std::memory_order_acquire) == latest * 2) {
+          *frame = latest;
+          return slot;
+        }
+      }
+      struct timespec timeout = {timeoutMs / 1000,
+                                 (timeoutMs % 1000) * 1000000L};
+      control_->waiters.fetch_add(1, std::memory_order_acq_rel);
+      long woken = syscall(SYS_futex, &header_->doorbell, FUTEX_WAIT, doorbell,
+                           &timeout, nullptr, 0);
+      control_->waiters.fetch_sub(1, std::memory_order_acq_rel);
+      if (woken < 0 && errno == ETIMEDOUT) return nullptr;
+    }
+    return nullptr;
+  }
+
+  const uint8_t* data(const FrameExportSlot* slot) const {
+    return frameExportData(header_, slot);
+  }
+
+  // True while the writer has not started reusing the slot of `frame`.
+  // Check after reading to know the data was not overwritten meanwhile.
+  bool isIntact(const FrameExportSlot* slot, uint64_t frame) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot->sequence.load(std::memory_order_relaxed) == frame * 2;
+  }
+
+ private:
+  const FrameExportHeader* header_ = nullptr;
+  FrameExportControl* control_ = nullptr;
+  size_t size_ = 0;
+};
+
+#endif  // FRAME_EXPORT_H
@@ -0,0 +1,118 @@
+#ifndef MOTION_DETECTOR_H
+#define MOTION_DETECTOR_H
+
+// Cheap motion detection on a decimated luma plane.
+//
+// Every analysed frame is reduced to one luma sample per `decimation` x
+// `decimation` pixel cell. The result is compared with a slowly adapting
+// background, 8x8 cells at a time, using sum-of-absolute-differences (psadbw
+// on x86). A frame has motion when enough blocks differ from the background
+// by more than the block threshold. At 640x480 with a decimation of 4 that
+// is 19200 samples per frame, a few microseconds of work.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+struct MotionSettings {
+  int decimation = 4;          // source pixels per sample, in each direction
+  int blockThreshold = 12;     // mean abs difference per sample in a block
+  double minBlockFraction = 0.01;  // blocks that must change for motion
+  int backgroundShift = 3;     // background moves 1/2^shift towards a frame
+};
+
+class MotionDetector {
+ public:
+  explicit MotionDetector(const MotionSettings& settings = MotionSettings())
+      : settings_(settings) {}
+
+  // Analyses one frame. `luma` points at the first luma sample, `pixelStride`
+  // is the distance in bytes between horizontally adjacent luma samples (2
+  // for YUY2/UYVY, 1 for planar formats) and `rowStride` the distance between
+  // rows. Returns true when the frame differs from the background.
+  bool analyse(const uint8_t* luma, int width, int height, int pixelStride,
+               int rowStride) {
+    const int d = settings_.decimation;
+    // Whole 8x8 blocks of samples only; a sliver at the edges is ignored
+    const int cols = (width / d) & ~7;
+    const int rows = (height / d) & ~7;
+    if (cols == 0 || rows == 0) return false;
+    if (cols != cols_ || rows != rows_) {
+      cols_ = cols;
+      rows_ = rows;
+      current_.assign(size_t(cols) * rows, 0);
+      background_.clear();
+    }
+
+    for (int y = 0; y < rows; y++) {
+      const uint8_t* src = luma + size_t(y) * d * rowStride;
+      uint8_t* dst = &current_[size_t(y) * cols];
+      for (int x = 0; x < cols; x++) dst[x] = src[size_t(x) * d * pixelStride];
+    }
+
+    if (background_.empty()) {
+      background_ = current_;
+      return false;
+    }
+
+    const int blocks = (cols / 8) * (rows / 8);
+    const int limit = settings_.blockThreshold * 64;
+    int changed = 0;
+    for (int by = 0; by < rows; by += 8)
+      for (int bx = 0; bx < cols; bx += 8)
+        changed += blockSad(bx, by) > limit;
+    lastScore_ = double(changed) / blocks;
+
+    updateBackground();
+    return lastScore_ >= settings_.minBlockFraction;
+  }
+
+  // Fraction of blocks that changed in the last analysed frame
+  double lastScore() const { return lastScore_; }
+
+  void reset() { background_.clear(); }
+
+ private:
+  int blockSad(int bx, int by) const {
+    const uint8_t* a = &current_[size_t(by) * cols_ + bx];
+    const uint8_t* b = &background_[size_t(by) * cols_ + bx];
+#if defined(__SSE2__)
+    __m128i sum = _mm_setzero_si128();
+    for (int y = 0; y < 8; y++) {
+      __m128i va = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + y * cols_));
+      __m128i vb = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + y * cols_));
+      sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+    }
+    return _mm_cvtsi128_si32(sum);
+#else
+    int sum = 0;
+    for (int y = 0; y < 8; y++)
+      for (int x = 0; x < 8; x++)
+        sum += std::abs(a[y * cols_ + x] - b[y * cols_ + x]);
+    return sum;
+#endif
+  }
+
+  void updateBackground() {
+    const int shift = settings_.backgroundShift;
+    for (size_t i = 0; i < background_.size(); i++) {
+      int bg = background_[i] << 8;
+      bg += ((current_[i] << 8) - bg) >> shift;
+      background_[i] = uint8_t((bg + 128) >> 8);
+    }
+  }
+
+  MotionSettings settings_;
+  int cols_ = 0;
+  int rows_ = 0;
+  std::vector<uint8_t> current_;
+  std::vector<uint8_t> background_;
+  double lastScore_ = 0;
+};
+
+#endif  // MOTION_DETECTOR_H
@@ -0,0 +1,178 @@
+#ifndef OVERLAY_BLEND_H
+#define OVERLAY_BLEND_H
+
+// Alpha blending of a static overlay into packed video frames.
+//
+// The overlay is rendered once as premultiplied ARGB32 (cairo's image
+// format). makeOverlaySprite() crops it to the bounding box of its visible
+// pixels. It then converts it to the byte layout of the video format: one
+// premultiplied colour byte and one inverse-alpha byte per frame byte. After
+// that, blending is the same per-byte operation for every packed format,
+//
+//   dst = colour + dst * (255 - alpha) / 255
+//
+// and it only touches the rows and columns the overlay covers. The SSE2
+// path and the scalar path round identically.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum class OverlayFormat {
+  BGRx,  // also BGRA; 4 bytes per pixel
+  YUY2,  // 4 bytes per 2 pixels, Y0 U Y1 V
+  UYVY,  // 4 bytes per 2 pixels, U Y0 V Y1
+};
+
+struct OverlaySprite {
+  int x = 0;  // top-left corner in the frame, in pixels
+  int y = 0;
+  int width = 0;  // in pixels
+  int height = 0;
+  int rowBytes = 0;
+  std::vector<uint8_t> colour;        // premultiplied, frame byte layout
+  std::vector<uint8_t> inverseAlpha;  // 255 - alpha, frame byte layout
+  bool empty() const { return width == 0 || height == 0; }
+};
+
+namespace overlayblend {
+
+// x * y / 255, rounded, for 8-bit x and y
+inline uint8_t mulDiv255(int x, int y) {
+  int t = x * y + 128;
+  return uint8_t((t + (t >> 8)) >> 8);
+}
+
+inline uint8_t clampByte(int v) { return uint8_t(v < 0 ? 0 : (v > 255 ? 255 : v)); }
+
+// BT.601 limited range, applied to premultiplied values; the offsets are
+// premultiplied too so that a transparent pixel stays all zero
+inline void premultipliedYuv(int a, int r, int g, int b, int* y, int* u, int* v) {
+  *y = clampByte(((66 * r + 129 * g + 25 * b + 128) >> 8) + mulDiv255(16, a));
+  *u = clampByte(((-38 * r - 74 * g + 112 * b + 128) >> 8) + mulDiv255(128, a));
+  *v = clampByte(((112 * r - 94 * g - 18 * b + 128) >> 8) + mulDiv255(128, a));
+}
+
+}  // namespace overlayblend
+
+// Crops a premultiplied ARGB32 image (as cairo lays it out in memory:
+// native-endian 0xAARRGGBB) to its visible pixels and converts it for
+// `format`. The image has the size of the frames it will be blended into.
+inline OverlaySprite makeOverlaySprite(const uint8_t* argb, int stride,
+                                       int width, int height,
+                                       OverlayFormat format) {
+  OverlaySprite sprite;
+  auto pixel = [&](int x, int y) {
+    uint32_t value;
+    memcpy(&value, argb + size_t(y) * stride + size_t(x) * 4, 4);
+    return value;
+  };
+  int left = width, right = -1, top = height, bottom = -1;
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+      if (pixel(x, y) >> 24) {
+        left = std::min(left, x);
+        right = std::max(right, x);
+        top = std::min(top, y);
+        bottom = std::max(bottom, y);
+      }
+  if (right < 0) return sprite;
+  // Packed YUV shares chroma between pixel pairs; keep the box on pair
+  // boundaries
+  if (format != OverlayFormat::BGRx) {
+    left &= ~1;
+    right = std::min(right | 1, (width & ~1) - 1);
+  }
+  sprite.x = left;
+  sprite.y = top;
+  sprite.width = right - left + 1;
+  sprite.height = bottom - top + 1;
+  sprite.rowBytes = format == OverlayFormat::BGRx ? sprite.width * 4 : sprite.width * 2;
+  sprite.colour.resize(size_t(sprite.rowBytes) * sprite.height);
+  sprite.inverseAlpha.resize(sprite.colour.size());
+
+  for (int y = 0; y < sprite.height; y++) {
+    uint8_t* colour = &sprite.colour[size_t(y) * sprite.rowBytes];
+    uint8_t* inverse = &sprite.inverseAlpha[size_t(y) * sprite.rowBytes];
+    if (format == OverlayFormat::BGRx) {
+      for (int x = 0; x < sprite.width; x++) {
+        uint32_t p = pixel(left + x, top + y);
+        uint8_t a = p >> 24;
+        uint8_t bytes[4] = {uint8_t(p), uint8_t(p >> 8), uint8_t(p >> 16), a};
+        for (int c = 0; c < 4; c++) {
+          colour[x * 4 + c] = bytes[c];
+          inverse[x * 4 + c] = 255 - a;
+        }
+      }
+      continue;
+    }
+    const int yFirst = format == OverlayFormat::YUY2 ? 0 : 1;
+    const int uFirst = format == OverlayFormat::YUY2 ? 1 : 0;
+    for (int x = 0; x < sprite.width; x += 2) {
+      int ys[2], us[2], vs[2], as[2];
+      for (int i = 0; i < 2; i++) {
+        uint32_t p = pixel(left + x + i, top + y);
+        as[i] = p >> 24;
+        overlayblend::premultipliedYuv(as[i], (p >> 16) & 0xff, (p >> 8) & 0xff,
+                                       p & 0xff, &ys[i], &us[i], &vs[i]);
+      }
+      uint8_t* c = colour + x * 2;
+      uint8_t* inv = inverse + x * 2;
+      c[yFirst] = ys[0];
+      c[yFirst + 2] = ys[1];
+      c[uFirst] = (us[0] + us[1] + 1) / 2;
+      c[uFirst + 2] = (vs[0] + vs[1] + 1) / 2;
+      inv[yFirst] = 255 - as[0];
+      inv[yFirst + 2] = 255 - as[1];
+      inv[uFirst] = inv[uFirst + 2] = 255 - (as[0] + as[1] + 1) / 2;
+    }
+  }
+  return sprite;
+}
+
+inline void blendOverlayBytes(const uint8_t* colour, const uint8_t* inverse,
+                              uint8_t* dst, int count) {
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i half = _mm_set1_epi16(128);
+  for (; i + 16 <= count; i += 16) {
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inverse + i));
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colour + i));
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero),
+                                               _mm_unpacklo_epi8(a, zero)),
+                               half);
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero),
+                                               _mm_unpackhi_epi8(a, zero)),
+                               half);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_adds_epu8(_mm_packus_epi16(lo, hi), c));
+  }
+#endif
+  for (; i < count; i++)
+    dst[i] = uint8_t(std::min(colour[i] + overlayblend::mulDiv255(dst[i], inverse[i]), 255));
+}
+
+// Blends the sprite into a frame of the format it was made for. Only the
+// sprite's bounding box is read or written.
+inline void blendOverlay(const OverlaySprite& sprite, uint8_t* frame,
+                         int stride) {
+  const int bytesPerPixel = sprite.rowBytes / std::max(sprite.width, 1);
+  for (int y = 0; y < sprite.height; y++) {
+    size_t offset = size_t(y) * sprite.rowBytes;
+    blendOverlayBytes(&sprite.colour[offset], &sprite.inverseAlpha[offset],
+                      frame + size_t(sprite.y + y) * stride +
+                          size_t(sprite.x) * bytesPerPixel,
+                      sprite.rowBytes);
+  }
+}
+
+#endif  // OVERLAY_BLEND_H
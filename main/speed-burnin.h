@@ -0,0 +1,128 @@
+#ifndef SPEED_BURNIN_H
+#define SPEED_BURNIN_H
+
+// Vehicle speed burnt into recorded I420 frames.
+//
+// Speed samples are logged with the pipeline running time they were taken
+// at. Each frame shows the last sample taken at or before the frame's own
+// running time, so the footage matches the telemetry even when frames are
+// encoded late. The text is blitted from a digit atlas that is rendered
+// once per frame height. Only the luma of the overlay rectangle is blended;
+// its chroma is set to grey so the text stays neutral on any background.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// Timestamped speed samples, written by the UI thread and read by the
+// streaming thread.
+class SpeedLog {
+ public:
+  // `time` is a pipeline running time in nanoseconds and must not go
+  // backwards.
+  void push(uint64_t time, int speed) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    samples_[next_ % kCapacity] = Sample{time, speed};
+    next_++;
+  }
+
+  // The speed at `time`: the newest sample not after it. Fails when every
+  // sample kept is newer than `time`, or there are none.
+  bool lookup(uint64_t time, int* speed) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t count = std::min(next_, size_t(kCapacity));
+    for (size_t i = 1; i <= count; i++) {
+      const Sample& sample = samples_[(next_ - i) % kCapacity];
+      if (sample.time <= time) {
+        *speed = sample.speed;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    next_ = 0;
+  }
+
+ private:
+  // Several seconds of samples, more than any frame lags behind
+  enum { kCapacity = 64 };
+  struct Sample {
+    uint64_t time;
+    int speed;
+  };
+  std::mutex mutex_;
+  Sample samples_[kCapacity] = {};
+  size_t next_ = 0;
+};
+
+// Coverage masks (0 = background, 255 = ink) for the digits 0-9, all the
+// same width, and for the unit label.
+struct DigitAtlas {
+  int height = 0;
+  int digitWidth = 0;
+  int unitWidth = 0;
+  int spacing = 0;  // between the number and the unit, and around the text
+  std::vector<uint8_t> digits;  // 10 glyphs side by side, 10 * digitWidth wide
+  std::vector<uint8_t> unit;
+
+  bool empty() const { return height == 0; }
+  // Size of the rectangle burnInSpeed() draws, for a 3-digit speed
+  int boxWidth() const { return 3 * digitWidth + unitWidth + 3 * spacing; }
+  int boxHeight() const { return height + 2 * spacing; }
+};
+
+namespace burnin {
+
+// Ink is drawn at white (235) over a background dimmed to a quarter
+inline void blitGlyph(const uint8_t* mask, int maskStride, int width,
+                      int height, uint8_t* luma, int lumaStride) {
+  for (int y = 0; y < height; y++) {
+    const uint8_t* m = mask + size_t(y) * maskStride;
+    uint8_t* d = luma + size_t(y) * lumaStride;
+    for (int x = 0; x < width; x++)
+      if (m[x]) d[x] = uint8_t(d[x] + ((235 - d[x]) * m[x] + 127) / 255);
+  }
+}
+
+}  // namespace burnin
+
+// Draws `speed` and the unit into the I420 frame with its top-left corner
+// at (x, y). The rectangle must lie inside the frame; x and y should be even.
+inline void burnInSpeed(const DigitAtlas& atlas, int speed, uint8_t* luma,
+                        int lumaStride, uint8_t* u, int uStride, uint8_t* v,
+                        int vStride, int x, int y) {
+  const int width = atlas.boxWidth() & ~1;
+  const int height = atlas.boxHeight() & ~1;
+  // Dim the box so the text reads on a bright scene, and make it grey
+  for (int row = 0; row < height; row++) {
+    uint8_t* d = luma + size_t(y + row) * lumaStride + x;
+    for (int col = 0; col < width; col++) d[col] = uint8_t(12 + (d[col] >> 2));
+  }
+  for (int row = 0; row < height / 2; row++) {
+    memset(u + size_t(y / 2 + row) * uStride + x / 2, 128, width / 2);
+    memset(v + size_t(y / 2 + row) * vStride + x / 2, 128, width / 2);
+  }
+
+  speed = std::max(0, std::min(speed, 999));
+  const int digitStride = 10 * atlas.digitWidth;
+  uint8_t* pen = luma + size_t(y + atlas.spacing) * lumaStride + x + atlas.spacing;
+  // Right-aligned in three digit cells
+  const int digits = speed >= 100 ? 3 : speed >= 10 ? 2 : 1;
+  pen += (3 - digits) * atlas.digitWidth;
+  for (int divisor = digits == 3 ? 100 : digits == 2 ? 10 : 1; divisor > 0; divisor /= 10) {
+    const int digit = speed / divisor % 10;
+    burnin::blitGlyph(&atlas.digits[size_t(digit) * atlas.digitWidth], digitStride,
+                      atlas.digitWidth, atlas.height, pen, lumaStride);
+    pen += atlas.digitWidth;
+  }
+  pen += atlas.spacing;
+  burnin::blitGlyph(atlas.unit.data(), atlas.unitWidth, atlas.unitWidth,
+                    atlas.height, pen, lumaStride);
+}
+
+#endif  // SPEED_BURNIN_H
@@ -0,0 +1,392 @@
+#ifndef TELEMETRY_LOG_H
+#define TELEMETRY_LOG_H
+
+// Telemetry recorder: fixed-size binary records in a memory-mapped ring file.
+//
+// The file is preallocated once: a one-page header followed by `capacity`
+// records. Appending a record is a few stores into the mapping, with no
+// system call. A background thread msyncs the written range periodically.
+//
+// Crash safety comes from ordering. A record's sequence number is stored
+// last, with release semantics, so a record with a non-zero sequence is
+// complete. The header's `committed` count is updated after that. When a
+// file is reopened, the records are scanned for the highest sequence, so a
+// header that lags behind (crash between the two stores, or before the last
+// msync) is repaired rather than trusted.
+//
+// Times are CLOCK_MONOTONIC nanoseconds, the clock GStreamer's system clock
+// runs on, so a record can be placed on a video pipeline's timeline as
+// monotonic - base time. The pipeline running time at the sample is stored
+// as well, when the writer knows it.
+//
+// Monotonic time restarts at every boot, so the header also lists the boots
+// the records were written in: the kernel's boot id and the first sequence
+// written in that boot. Readers look samples up by boot id and time, and a
+// time from one boot never matches a sample from another.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define TELEMETRY_LOG_MAGIC 0x474f4c54u  // "TLOG"
+#define TELEMETRY_LOG_VERSION 2u
+#define TELEMETRY_LOG_HEADER_SIZE 4096
+// Boots remembered in the header; records from older boots are ignored
+#define TELEMETRY_LOG_BOOTS 64
+#define TELEMETRY_BOOT_ID_SIZE 40  // a UUID as text, NUL-padded
+
+// Set in TelemetryRecord::flags
+enum TelemetryFlags : uint32_t {
+  kTelemetryCameraRunning = 1u << 0,  // a camera pipeline was playing
+  kTelemetryRecording = 1u << 1,      // video was being recorded
+};
+
+struct TelemetryRecord {
+  std::atomic<uint64_t> sequence;  // 1-based record number, 0 while empty
+  int64_t monotonicNs;             // CLOCK_MONOTONIC at the sample
+  int64_t pipelineNs;              // pipeline running time, -1 if none
+  int32_t speed;                   // km/h
+  uint32_t flags;                  // TelemetryFlags
+};
+
+struct TelemetryBoot {
+  char bootId[TELEMETRY_BOOT_ID_SIZE];
+  uint64_t firstSequence;  // first record written in this boot
+};
+
+struct TelemetryLogHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t recordSize;
+  uint32_t reserved;
+  uint64_t capacity;                 // records in the ring
+  int64_t createdRealtimeNs;         // CLOCK_REALTIME when created, and
+  int64_t createdMonotonicNs;        // CLOCK_MONOTONIC at the same moment
+  std::atomic<uint64_t> committed;   // sequence of the newest record
+  uint64_t bootCount;                // boots ever listed; the newest
+                                     // TELEMETRY_LOG_BOOTS are kept in
+  TelemetryBoot boots[TELEMETRY_LOG_BOOTS];  // boots[n % TELEMETRY_LOG_BOOTS]
+};
+
+static_assert(sizeof(TelemetryLogHeader) <= TELEMETRY_LOG_HEADER_SIZE,
+              "the telemetry header must fit its page");
+
+static inline int64_t telemetryMonotonicNow() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);  // vDSO; not a system call
+  return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// The kernel's id for the current boot, or "" if it cannot be read
+static inline std::string telemetryBootId() {
+  char id[TELEMETRY_BOOT_ID_SIZE] = {};
+  int fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return std::string();
+  ssize_t length = read(fd, id, sizeof(id) - 1);
+  close(fd);
+  while (length > 0 && (id[length - 1] == '\n' || id[length - 1] == '\0'))
+    length--;
+  return std::string(id, length > 0 ? size_t(length) : 0);
+}
+
+static inline size_t telemetryLogFileSize(uint64_t capacity) {
+  return TELEMETRY_LOG_HEADER_SIZE + capacity * sizeof(TelemetryRecord);
+}
+
+static inline TelemetryRecord* telemetryRecords(TelemetryLogHeader* header) {
+  return reinterpret_cast<TelemetryRecord*>(
+      reinterpret_cast<uint8_t*>(header) + TELEMETRY_LOG_HEADER_SIZE);
+}
+
+class TelemetryWriter {
+ public:
+  // Opens or creates the ring file at `path`. An existing file with the same
+  // capacity is continued; anything else is replaced. Check isReady().
+  TelemetryWriter(const std::string& path, uint64_t capacity,
+                  int syncIntervalMs)
+      : capacity_(capacity), syncInterval_(syncIntervalMs) {
+    const size_t size = telemetryLogFileSize(capacity);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    struct stat info;
+    bool reuse = fstat(fd, &info) == 0 && size_t(info.st_size) == size;
+    // Reserve the blocks now, so a full disk fails here and not on a page
+    // fault halfway through a drive
+    if (!reuse && (ftruncate(fd, 0) != 0 || posix_fallocate(fd, 0, size) != 0)) {
+      close(fd);
+      return;
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return;
+    header_ = static_cast<TelemetryLogHeader*>(mapping);
+    size_ = size;
+    if (reuse && header_->magic == TELEMETRY_LOG_MAGIC &&
+        header_->version == TELEMETRY_LOG_VERSION &&
+        header_->recordSize == sizeof(TelemetryRecord) &&
+        header_->capacity == capacity) {
+      recover();
+    } else {
+      memset(mapping, 0, size);
+      header_->version = TELEMETRY_LOG_VERSION;
+      header_->recordSize = sizeof(TelemetryRecord);
+      header_->capacity = capacity;
+      struct timespec realtime;
+      clock_gettime(CLOCK_REALTIME, &realtime);
+      header_->createdMonotonicNs = telemetryMonotonicNow();
+      header_->createdRealtimeNs = int64_t(realtime.tv_sec) * 1000000000 + realtime.tv_nsec;
+      // The magic goes in last, once the header is whole
+      msync(header_, TELEMETRY_LOG_HEADER_SIZE, MS_SYNC);
+      header_->magic = TELEMETRY_LOG_MAGIC;
+      msync(header_, TELEMETRY_LOG_HEADER_SIZE, MS_SYNC);
+    }
+    noteBoot();
+    syncedThrough_ = next_;
+    syncThread_ = std::thread(&TelemetryWriter::syncLoop, this);
+  }
+
+  ~TelemetryWriter() {
+    if (!header_) return;
+    {
+      std::lock_guard<std::mutex> lock(syncMutex_);
+      stopping_ = true;
+    }
+    syncWake_.notify_one();
+    syncThread_.join();
+    sync();
+    munmap(header_, size_);
+  }
+
+  TelemetryWriter(const TelemetryWriter&) = delete;
+  TelemetryWriter& operator=(const TelemetryWriter&) = delete;
+
+  bool isReady() const { return header_ != nullptr; }
+
+  // Appends one sample. Must be called from one thread at a time; costs a
+  // handful of stores and no system call.
+  void append(int64_t monotonicNs, int64_t pipelineNs, int32_t speed,
+              uint32_t flags) {
+    if (!header_) return;
+    const uint64_t sequence = next_.load(std::memory_order_relaxed) + 1;
+    TelemetryRecord* record = &telemetryRecords(header_)[(sequence - 1) % capacity_];
+    // Invalidate the slot before overwriting the record it held
+    record->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    record->monotonicNs = monotonicNs;
+    record->pipelineNs = pipelineNs;
+    record->speed = speed;
+    record->flags = flags;
+    record->sequence.store(sequence, std::memory_order_release);
+    header_->committed.store(sequence, std::memory_order_release);
+    next_.store(sequence, std::memory_order_release);
+  }
+
+  // Writes everything appended so far to disk.
+  void sync() {
+    if (!header_) return;
+    const uint64_t through = next_.load(std::memory_order_acquire);
+    std::lock_guard<std::mutex> lock(flushMutex_);
+    if (through == syncedThrough_) return;
+    // Only the pages holding new records, plus the header
+    const uint64_t first = syncedThrough_;
+    if (through - first >= capacity_) {
+      msync(header_, size_, MS_SYNC);
+    } else {
+      syncRecords(first % capacity_, std::min(through - first, capacity_ - first % capacity_));
+      if ((first % capacity_) + (through - first) > capacity_)
+        syncRecords(0, (first % capacity_) + (through - first) - capacity_);
+      msync(header_, TELEMETRY_LOG_HEADER_SIZE, MS_SYNC);
+    }
+    syncedThrough_ = through;
+  }
+
+ private:
+  void recover() {
+    uint64_t newest = 0;
+    TelemetryRecord* records = telemetryRecords(header_);
+    for (uint64_t i = 0; i < capacity_; i++)
+      newest = std::max(newest, records[i].sequence.load(std::memory_order_relaxed));
+    header_->committed.store(newest, std::memory_order_relaxed);
+    next_.store(newest, std::memory_order_relaxed);
+  }
+
+  // Lists the current boot in the header, unless the last writer ran in it
+  // too. Done before this writer appends anything.
+  void noteBoot() {
+    const std::string id = telemetryBootId();
+    const uint64_t count = header_->bootCount;
+    if (count > 0 &&
+        strncmp(header_->boots[(count - 1) % TELEMETRY_LOG_BOOTS].bootId,
+                id.c_str(), TELEMETRY_BOOT_ID_SIZE) == 0)
+      return;
+    TelemetryBoot* boot = &header_->boots[count % TELEMETRY_LOG_BOOTS];
+    memset(boot->bootId, 0, sizeof(boot->bootId));
+    strncpy(boot->bootId, id.c_str(), sizeof(boot->bootId) - 1);
+    boot->firstSequence = next_.load(std::memory_order_relaxed) + 1;
+    // Counted only once the entry is whole
+    msync(header_, TELEMETRY_LOG_HEADER_SIZE, MS_SYNC);
+    header_->bootCount = count + 1;
+    msync(header_, TELEMETRY_LOG_HEADER_SIZE, MS_SYNC);
+  }
+
+  void syncRecords(uint64_t firstIndex, uint64_t count) {
+    if (count == 0) return;
+    const uintptr_t page = uintptr_t(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = uintptr_t(&telemetryRecords(header_)[firstIndex]);
+    uintptr_t end = begin + count * sizeof(TelemetryRecord);
+    begin &= ~(page - 1);
+    msync(reinterpret_cast<void*>(begin), end - begin, MS_SYNC);
+  }
+
+  void syncLoop() {
+    std::unique_lock<std::mutex> lock(syncMutex_);
+    while (!stopping_) {
+      syncWake_.wait_for(lock, std::chrono::milliseconds(syncInterval_));
+      if (stopping_) break;
+      lock.unlock();
+      sync();
+      lock.lock();
+    }
+  }
+
+  uint64_t capacity_;
+  int syncInterval_;
+  TelemetryLogHeader* header_ = nullptr;
+  size_t size_ = 0;
+  std::atomic<uint64_t> next_{0};  // sequence of the last appended record
+  std::mutex flushMutex_;
+  uint64_t syncedThrough_ = 0;
+  std::mutex syncMutex_;
+  std::condition_variable syncWake_;
+  bool stopping_ = false;
+  std::thread syncThread_;
+};
+
+// Read-only snapshot of a telemetry ring, for looking samples up by time.
+class TelemetryReader {
+ public:
+  explicit TelemetryReader(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat info;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && size_t(info.st_size) >= TELEMETRY_LOG_HEADER_SIZE)
+      mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return;
+    auto* header = static_cast<TelemetryLogHeader*>(mapping);
+    if (header->magic == TELEMETRY_LOG_MAGIC &&
+        header->version == TELEMETRY_LOG_VERSION &&
+        header->recordSize == sizeof(TelemetryRecord) &&
+        telemetryLogFileSize(header->capacity) <= size_t(info.st_size)) {
+      load(header);
+      ready_ = true;
+    }
+    munmap(mapping, info.st_size);
+  }
+
+  bool isReady() const { return ready_; }
+  size_t size() const { return samples_.size(); }
+
+  // The sample in effect at `monotonicNs` in the boot `bootId`: the newest
+  // one not after it. The log is split into runs, one per writer session,
+  // and the most recent run of that boot that started before the time is
+  // used. A time more than one sample interval after the run's last sample
+  // is not covered by it. An empty `bootId` (a recording that does not
+  // name its boot) matches runs of any boot.
+  bool sampleAt(const char* bootId, int64_t monotonicNs, int32_t* speed,
+                uint32_t* flags) const {
+    for (auto run = runs_.rbegin(); run != runs_.rend(); ++run) {
+      if (bootId[0] && bootIds_[run->boot] != bootId) continue;
+      auto first = samples_.begin() + run->begin;
+      auto last = samples_.begin() + run->end;
+      if (first == last || monotonicNs < first->monotonicNs) continue;
+      // The interval the run ended with; a single sample covers only itself
+      const int64_t interval =
+          last - first > 1 ? (last - 1)->monotonicNs - (last - 2)->monotonicNs : 0;
+      if (monotonicNs > (last - 1)->monotonicNs + interval) continue;
+      auto it = std::upper_bound(
+          first, last, monotonicNs,
+          [](int64_t time, const Sample& sample) { return time < sample.monotonicNs; });
+      --it;
+      *speed = it->speed;
+      if (flags) *flags = it->flags;
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  struct Sample {
+    int64_t monotonicNs;
+    int32_t speed;
+    uint32_t flags;
+  };
+
+  struct Run {
+    size_t begin, end;  // samples_ range
+    size_t boot;        // index into bootIds_
+  };
+
+  void load(const TelemetryLogHeader* header) {
+    const TelemetryRecord* records =
+        telemetryRecords(const_cast<TelemetryLogHeader*>(header));
+    const uint64_t capacity = header->capacity;
+    uint64_t newest = 0;
+    for (uint64_t i = 0; i < capacity; i++)
+      newest = std::max(newest, records[i].sequence.load(std::memory_order_acquire));
+    const uint64_t oldest = newest > capacity ? newest - capacity + 1 : 1;
+    // The boots still listed, oldest first
+    const uint64_t bootCount = header->bootCount;
+    const uint64_t firstBoot =
+        bootCount > TELEMETRY_LOG_BOOTS ? bootCount - TELEMETRY_LOG_BOOTS : 0;
+    std::vector<uint64_t> bootStarts;
+    for (uint64_t n = firstBoot; n < bootCount; n++) {
+      const TelemetryBoot& boot = header->boots[n % TELEMETRY_LOG_BOOTS];
+      bootIds_.push_back(std::string(
+          boot.bootId, strnlen(boot.bootId, sizeof(boot.bootId))));
+      bootStarts.push_back(boot.firstSequence);
+    }
+    size_t boot = 0;
+    for (uint64_t sequence = oldest; sequence <= newest && newest; sequence++) {
+      const TelemetryRecord& record = records[(sequence - 1) % capacity];
+      if (record.sequence.load(std::memory_order_acquire) != sequence) continue;
+      Sample sample = {record.monotonicNs, record.speed, record.flags};
+      // A writer may be overwriting this record right now
+      if (record.sequence.load(std::memory_order_acquire) != sequence) continue;
+      // Records from before the oldest boot still listed cannot be placed
+      if (bootStarts.empty() || sequence < bootStarts[0]) continue;
+      bool newBoot = false;
+      while (boot + 1 < bootStarts.size() && bootStarts[boot + 1] <= sequence) {
+        boot++;
+        newBoot = true;
+      }
+      if (runs_.empty() || newBoot || runs_.back().boot != boot ||
+          sample.monotonicNs < samples_.back().monotonicNs)
+        runs_.push_back({samples_.size(), samples_.size(), boot});
+      samples_.push_back(sample);
+      runs_.back().end = samples_.size();
+    }
+  }
+
+  bool ready_ = false;
+  std::vector<Sample> samples_;  // in sequence order
+  std::vector<Run> runs_;
+  std::vector<std::string> bootIds_;  // the header's boots, oldest first
+};
+
+#endif  // TELEMETRY_LOG_H
@@ -0,0 +1,574 @@
+#ifndef UNDISTORT_H
+#define UNDISTORT_H
+
+// Fisheye lens correction for raw video frames.
+//
+// The lens model is the equidistant fisheye model used by OpenCV's
+// cv::fisheye (camera matrix plus k1..k4). For every output pixel, the
+// source position is computed once into a remap table. Each entry holds the
+// index of the top-left source pixel and 6-bit bilinear weights. Tables are
+// built once per calibration and resolution. They are cached in memory and
+// on disk, so switching cameras or capture modes is a lookup.
+//
+// The remap works on one plane at a time and on any byte layout that
+// RemapLayout describes, so YUV frames are corrected in their own format:
+// luma through the table at frame size, chroma through a table at the
+// chroma plane's size. It runs in row bands across a small thread pool. On
+// x86 with AVX2 it uses 8-pixel gathers and maddubs/madd bilinear filtering:
+// a kernel for whole 32-bit pixels, and one for the bytes of 1-, 2- and
+// 4-byte pixels that a RemapLayout picks out (YUV planes and packed YUV).
+// The scalar path uses the same fixed-point arithmetic, so all of them give
+// identical output.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UNDISTORT_X86 1
+#endif
+
+// Intrinsics and distortion of one lens, measured at calibration size.
+struct LensCalibration {
+  int width = 0;   // image size the calibration was made at
+  int height = 0;
+  double fx = 0, fy = 0, cx = 0, cy = 0;
+  double k1 = 0, k2 = 0, k3 = 0, k4 = 0;
+  double zoom = 1.0;  // focal length of the corrected view, relative to fx
+};
+
+// Remap table for one calibration at one resolution.
+struct UndistortLut {
+  int width = 0;
+  int height = 0;
+  std::vector<int32_t> index;   // top-left source pixel, row * width + col
+  // Weight pairs as bytes: 64 - wx, wx, 64 - wy, wy. All zero for output
+  // pixels that have no source, which come out black.
+  std::vector<uint32_t> weights;
+};
+
+// Which bytes of a plane are remapped: pixels are `pixelBytes` apart, and
+// `channels` bytes of each, starting at `firstChannel` and `channelStep`
+// apart, are interpolated. Other bytes are left to another pass. Output
+// pixels without a source are set to `fill`.
+struct RemapLayout {
+  int pixelBytes = 4;
+  int firstChannel = 0;
+  int channels = 4;
+  int channelStep = 1;
+  uint8_t fill = 0;
+};
+
+namespace undistort {
+
+enum { kFracBits = 6, kOne = 1 << kFracBits };
+
+// Everything the table depends on, as text; hashed into the cache key
+inline std::string lutKey(const LensCalibration& lens, int width, int height) {
+  char key[512];
+  snprintf(key, sizeof(key),
+           "%d %d %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %d %d",
+           lens.width, lens.height, lens.fx, lens.fy, lens.cx, lens.cy,
+           lens.k1, lens.k2, lens.k3, lens.k4, lens.zoom, width, height);
+  return key;
+}
+
+inline uint64_t hashKey(const std::string& key) {
+  uint64_t hash = 14695981039346656037ull;  // FNV-1a
+  for (unsigned char c : key) hash = (hash ^ c) * 1099511628211ull;
+  return hash;
+}
+
+// Builds the table for frames of width x height. The calibration is scaled
+// to that size, which assumes the capture mode shows the same field of view.
+inline std::shared_ptr<UndistortLut> buildLut(const LensCalibration& lens,
+                                              int width, int height) {
+  auto lut = std::make_shared<UndistortLut>();
+  lut->width = width;
+  lut->height = height;
+  lut->index.assign(size_t(width) * height, 0);
+  lut->weights.assign(size_t(width) * height, 0);
+  const double sx = double(width) / lens.width;
+  const double sy = double(height) / lens.height;
+  const double fx = lens.fx * sx, fy = lens.fy * sy;
+  const double cx = lens.cx * sx, cy = lens.cy * sy;
+  const double newFx = fx * lens.zoom, newFy = fy * lens.zoom;
+  for (int v = 0; v < height; v++) {
+    for (int u = 0; u < width; u++) {
+      const double x = (u - cx) / newFx;
+      const double y = (v - cy) / newFy;
+      const double r = std::sqrt(x * x + y * y);
+      const double theta = std::atan(r);
+      const double t2 = theta * theta;
+      const double thetaD =
+          theta * (1 + t2 * (lens.k1 + t2 * (lens.k2 + t2 * (lens.k3 + t2 * lens.k4))));
+      const double scale = r > 1e-8 ? thetaD / r : 1.0;
+      const double srcX = fx * x * scale + cx;
+      const double srcY = fy * y * scale + cy;
+      if (!(srcX >= 0 && srcY >= 0 && srcX <= width - 1 && srcY <= height - 1))
+        continue;
+      // Keep the 2x2 neighbourhood inside the frame; the last column or row
+      // is reached with a full weight on the far sample
+      int x0 = std::min(int(srcX), width - 2);
+      int y0 = std::min(int(srcY), height - 2);
+      int wx = int(std::lround((srcX - x0) * kOne));
+      int wy = int(std::lround((srcY - y0) * kOne));
+      wx = std::min(wx, int(kOne));
+      wy = std::min(wy, int(kOne));
+      size_t i = size_t(v) * width + u;
+      lut->index[i] = y0 * width + x0;
+      lut->weights[i] = uint32_t(kOne - wx) | uint32_t(wx) << 8 |
+                        uint32_t(kOne - wy) << 16 | uint32_t(wy) << 24;
+    }
+  }
+  return lut;
+}
+
+struct LutFileHeader {
+  char magic[4];  // "ULUT"
+  uint32_t version;
+  uint64_t keyHash;
+  int32_t width;
+  int32_t height;
+};
+
+inline std::shared_ptr<UndistortLut> loadLut(const std::string& path,
+                                             uint64_t keyHash, int width,
+                                             int height) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return nullptr;
+  std::shared_ptr<UndistortLut> lut;
+  LutFileHeader header;
+  const size_t count = size_t(width) * height;
+  if (read(fd, &header, sizeof(header)) == ssize_t(sizeof(header)) &&
+      memcmp(header.magic, "ULUT", 4) == 0 && header.version == 1 &&
+      header.keyHash == keyHash && header.width == width &&
+      header.height == height) {
+    auto loaded = std::make_shared<UndistortLut>();
+    loaded->width = width;
+    loaded->height = height;
+    loaded->index.resize(count);
+    loaded->weights.resize(count);
+    if (read(fd, loaded->index.data(), count * 4) == ssize_t(count * 4) &&
+        read(fd, loaded->weights.data(), count * 4) == ssize_t(count * 4))
+      lut = loaded;
+  }
+  close(fd);
+  return lut;
+}
+
+// Written to a temporary name and renamed, so a reader never sees half a file
+inline bool saveLut(const std::string& path, uint64_t keyHash,
+                    const UndistortLut& lut) {
+  std::string temporary = path + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  LutFileHeader header = {{'U', 'L', 'U', 'T'}, 1, keyHash, lut.width, lut.height};
+  const size_t bytes = lut.index.size() * 4;
+  bool ok = write(fd, &header, sizeof(header)) == ssize_t(sizeof(header)) &&
+            write(fd, lut.index.data(), bytes) == ssize_t(bytes) &&
+            write(fd, lut.weights.data(), bytes) == ssize_t(bytes);
+  ok = close(fd) == 0 && ok;
+  if (ok) ok = rename(temporary.c_str(), path.c_str()) == 0;
+  if (!ok) unlink(temporary.c_str());
+  return ok;
+}
+
+inline uint8_t blendChannel(const uint8_t* p00, const uint8_t* p01,
+                            const uint8_t* p10, const uint8_t* p11, int c,
+                            uint32_t w) {
+  const int hx0 = w & 0xff, hx1 = (w >> 8) & 0xff;
+  const int vy0 = (w >> 16) & 0xff, vy1 = w >> 24;
+  const int top = p00[c] * hx0 + p01[c] * hx1;
+  const int bottom = p10[c] * hx0 + p11[c] * hx1;
+  return uint8_t((top * vy0 + bottom * vy1 + (1 << (2 * kFracBits - 1))) >>
+                 (2 * kFracBits));
+}
+
+// Remaps columns [firstColumn, lastColumn) of one output row
+inline void remapColumnsScalar(const UndistortLut& lut, const uint8_t* src,
+                               int srcStride, uint8_t* dst, int dstStride,
+                               int y, int firstColumn, int lastColumn,
+                               const RemapLayout& layout) {
+  const int bytes = layout.pixelBytes;
+  const bool packed = srcStride == lut.width * bytes;
+  const int32_t* index = &lut.index[size_t(y) * lut.width];
+  const uint32_t* weights = &lut.weights[size_t(y) * lut.width];
+  uint8_t* out = dst + size_t(y) * dstStride;
+  for (int x = firstColumn; x < lastColumn; x++) {
+    const int i = index[x];
+    const uint8_t* p00 =
+        packed ? src + size_t(i) * bytes
+               : src + size_t(i / lut.width) * srcStride + size_t(i % lut.width) * bytes;
+    const uint8_t* p10 = p00 + srcStride;
+    for (int k = 0; k < layout.channels; k++) {
+      const int c = layout.firstChannel + k * layout.channelStep;
+      out[x * bytes + c] =
+          weights[x] ? blendChannel(p00, p00 + bytes, p10, p10 + bytes, c, weights[x])
+                     : layout.fill;
+    }
+  }
+}
+
+inline void remapRowsScalar(const UndistortLut& lut, const uint8_t* src,
+                            int srcStride, uint8_t* dst, int dstStride,
+                            int firstRow, int rows, int firstColumn = 0,
+                            const RemapLayout& layout = RemapLayout()) {
+  for (int y = firstRow; y < firstRow + rows; y++)
+    remapColumnsScalar(lut, src, srcStride, dst, dstStride, y, firstColumn,
+                       lut.width, layout);
+}
+
+#if UNDISTORT_X86
+// Source pixel index in the LUT is row * width + col; the gathers address
+// the frame as row * (stride / 4) + col, so the stride must equal width * 4.
+__attribute__((target("avx2"))) inline void remapRowsAvx2(
+    const UndistortLut& lut, const uint8_t* src, int srcStride, uint8_t* dst,
+    int dstStride, int firstRow, int rows) {
+  const int* top = reinterpret_cast<const int*>(src);
+  const int* bottom = reinterpret_cast<const int*>(src + srcStride);
+  const __m256i round = _mm256_set1_epi32(1 << (2 * kFracBits - 1));
+  const __m256i low16 = _mm256_set1_epi32(0xffff);
+  const int vectorWidth = lut.width & ~7;
+  for (int y = firstRow; y < firstRow + rows; y++) {
+    const int32_t* index = &lut.index[size_t(y) * lut.width];
+    const uint32_t* weights = &lut.weights[size_t(y) * lut.width];
+    uint8_t* out = dst + size_t(y) * dstStride;
+    for (int x = 0; x < vectorWidth; x += 8) {
+      __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + x));
+      __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + x));
+      __m256i p00 = _mm256_i32gather_epi32(top, idx, 4);
+      __m256i p01 = _mm256_i32gather_epi32(top + 1, idx, 4);
+      __m256i p10 = _mm256_i32gather_epi32(bottom, idx, 4);
+      __m256i p11 = _mm256_i32gather_epi32(bottom + 1, idx, 4);
+      // Horizontal byte weights (64 - wx, wx) twice per lane; vertical word
+      // weights (64 - wy, wy) once per lane
+      __m256i hx = _mm256_and_si256(w, low16);
+      hx = _mm256_or_si256(hx, _mm256_slli_epi32(hx, 16));
+      __m256i vy = _mm256_srli_epi32(w, 16);
+      vy = _mm256_or_si256(_mm256_and_si256(vy, _mm256_set1_epi32(0xff)),
+                           _mm256_slli_epi32(_mm256_srli_epi32(vy, 8), 16));
+      // Pixels 0,1 | 4,5 and 2,3 | 6,7, one 16-bit value per channel
+      __m256i hxLo = _mm256_unpacklo_epi32(hx, hx), hxHi = _mm256_unpackhi_epi32(hx, hx);
+      __m256i topLo = _mm256_maddubs_epi16(_mm256_unpacklo_epi8(p00, p01), hxLo);
+      __m256i topHi = _mm256_maddubs_epi16(_mm256_unpackhi_epi8(p00, p01), hxHi);
+      __m256i bottomLo = _mm256_maddubs_epi16(_mm256_unpacklo_epi8(p10, p11), hxLo);
+      __m256i bottomHi = _mm256_maddubs_epi16(_mm256_unpackhi_epi8(p10, p11), hxHi);
+      // One pixel per 128-bit lane, one 32-bit value per channel
+      __m256i r0 = _mm256_madd_epi16(_mm256_unpacklo_epi16(topLo, bottomLo),
+                                     _mm256_shuffle_epi32(vy, 0x00));
+      __m256i r1 = _mm256_madd_epi16(_mm256_unpackhi_epi16(topLo, bottomLo),
+                                     _mm256_shuffle_epi32(vy, 0x55));
+      __m256i r2 = _mm256_madd_epi16(_mm256_unpacklo_epi16(topHi, bottomHi),
+                                     _mm256_shuffle_epi32(vy, 0xaa));
+      __m256i r3 = _mm256_madd_epi16(_mm256_unpackhi_epi16(topHi, bottomHi),
+                                     _mm256_shuffle_epi32(vy, 0xff));
+      r0 = _mm256_srli_epi32(_mm256_add_epi32(r0, round), 2 * kFracBits);
+      r1 = _mm256_srli_epi32(_mm256_add_epi32(r1, round), 2 * kFracBits);
+      r2 = _mm256_srli_epi32(_mm256_add_epi32(r2, round), 2 * kFracBits);
+      r3 = _mm256_srli_epi32(_mm256_add_epi32(r3, round), 2 * kFracBits);
+      __m256i pixels = _mm256_packus_epi16(_mm256_packs_epi32(r0, r1),
+                                           _mm256_packs_epi32(r2, r3));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x * 4), pixels);
+    }
+    if (vectorWidth < lut.width)
+      remapRowsScalar(lut, src, srcStride, dst, dstStride, y, 1, vectorWidth);
+  }
+}
+
+// The layouts remapRowsAvx2Channels handles: 1-, 2- or 4-byte pixels
+inline bool channelKernelFits(const RemapLayout& layout) {
+  return layout.pixelBytes == 1 || layout.pixelBytes == 2 ||
+         layout.pixelBytes == 4;
+}
+
+// Remaps the bytes `layout` picks out of 1-, 2- or 4-byte pixels, 8 output
+// pixels at a time and one channel after another. Each gather reads the 4
+// bytes at a source pixel's channel, which hold the right-hand neighbour's
+// byte too when pixels are 1 or 2 bytes; a group whose filter reaches the
+// last source row is done in scalar code, so no read runs off the plane.
+// The other bytes of the output pixels are kept. Any stride works: rows are
+// recovered from the table's indices.
+__attribute__((target("avx2"))) inline void remapRowsAvx2Channels(
+    const UndistortLut& lut, const uint8_t* src, int srcStride, uint8_t* dst,
+    int dstStride, int firstRow, int rows, const RemapLayout& layout) {
+  const int bytes = layout.pixelBytes;
+  const int width = lut.width;
+  const int padding = srcStride - width * bytes;
+  // Indices past this one filter from the last row
+  const __m256i lastRows = _mm256_set1_epi32((lut.height - 2) * width - 1);
+  const __m256i widthVec = _mm256_set1_epi32(width);
+  const __m256 inverseWidth = _mm256_set1_ps(1.0f / width);
+  const __m256i round = _mm256_set1_epi32(1 << (2 * kFracBits - 1));
+  const __m256i low16 = _mm256_set1_epi32(0xffff);
+  const __m256i lowByte = _mm256_set1_epi32(0xff);
+  const __m256i fill = _mm256_set1_epi32(layout.fill);
+  // Moves byte 0 and byte `bytes` of each 32-bit word into bytes 0 and 1
+  const __m256i pairBytes =
+      bytes == 2 ? _mm256_setr_epi8(0, 2, -1, -1, 4, 6, -1, -1, 8, 10, -1, -1,
+                                    12, 14, -1, -1, 0, 2, -1, -1, 4, 6, -1, -1,
+                                    8, 10, -1, -1, 12, 14, -1, -1)
+                 : _mm256_setr_epi8(0, 1, -1, -1, 4, 5, -1, -1, 8, 9, -1, -1,
+                                    12, 13, -1, -1, 0, 1, -1, -1, 4, 5, -1, -1,
+                                    8, 9, -1, -1, 12, 13, -1, -1);
+  const int vectorWidth = width & ~7;
+  for (int y = firstRow; y < firstRow + rows; y++) {
+    const int32_t* index = &lut.index[size_t(y) * width];
+    const uint32_t* weights = &lut.weights[size_t(y) * width];
+    uint8_t* out = dst + size_t(y) * dstStride;
+    for (int x = 0; x < vectorWidth; x += 8) {
+      __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + x));
+      if (_mm256_movemask_epi8(_mm256_cmpgt_epi32(idx, lastRows))) {
+        remapColumnsScalar(lut, src, srcStride, dst, dstStride, y, x, x + 8,
+                           layout);
+        continue;
+      }
+      __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + x));
+      // Byte offset of the top-left source pixel
+      __m256i offset = _mm256_mullo_epi32(idx, _mm256_set1_epi32(bytes));
+      if (padding) {
+        __m256i row = _mm256_cvttps_epi32(
+            _mm256_mul_ps(_mm256_cvtepi32_ps(idx), inverseWidth));
+        __m256i column = _mm256_sub_epi32(idx, _mm256_mullo_epi32(row, widthVec));
+        // The float quotient can be one off either way
+        row = _mm256_add_epi32(row, _mm256_cmpgt_epi32(_mm256_setzero_si256(), column));
+        row = _mm256_sub_epi32(row, _mm256_cmpgt_epi32(column, _mm256_sub_epi32(
+                                                                   widthVec, _mm256_set1_epi32(1))));
+        offset = _mm256_add_epi32(offset,
+                                  _mm256_mullo_epi32(row, _mm256_set1_epi32(padding)));
+      }
+      // Horizontal byte weights (64 - wx, wx); vertical word weights
+      // (64 - wy, wy)
+      __m256i hx = _mm256_and_si256(w, low16);
+      __m256i vy = _mm256_srli_epi32(w, 16);
+      vy = _mm256_or_si256(_mm256_and_si256(vy, lowByte),
+                           _mm256_slli_epi32(_mm256_srli_epi32(vy, 8), 16));
+      __m256i noSource = _mm256_cmpeq_epi32(w, _mm256_setzero_si256());
+      __m256i merged = _mm256_setzero_si256(), mask = _mm256_setzero_si256();
+      for (int k = 0; k < layout.channels; k++) {
+        const int c = layout.firstChannel + k * layout.channelStep;
+        const int* top = reinterpret_cast<const int*>(src + c);
+        const int* bottom = reinterpret_cast<const int*>(src + srcStride + c);
+        __m256i topPair, bottomPair;
+        if (bytes == 4) {
+          __m256i p00 = _mm256_and_si256(_mm256_i32gather_epi32(top, offset, 1), lowByte);
+          __m256i p01 = _mm256_and_si256(_mm256_i32gather_epi32(top + 1, offset, 1), lowByte);
+          __m256i p10 = _mm256_and_si256(_mm256_i32gather_epi32(bottom, offset, 1), lowByte);
+          __m256i p11 = _mm256_and_si256(_mm256_i32gather_epi32(bottom + 1, offset, 1), lowByte);
+          topPair = _mm256_or_si256(p00, _mm256_slli_epi32(p01, 8));
+          bottomPair = _mm256_or_si256(p10, _mm256_slli_epi32(p11, 8));
+        } else {
+          topPair = _mm256_shuffle_epi8(_mm256_i32gather_epi32(top, offset, 1), pairBytes);
+          bottomPair =
+              _mm256_shuffle_epi8(_mm256_i32gather_epi32(bottom, offset, 1), pairBytes);
+        }
+        // One 16-bit horizontal sum per row, then both rows weighted
+        __m256i rowSums = _mm256_or_si256(
+            _mm256_maddubs_epi16(topPair, hx),
+            _mm256_slli_epi32(_mm256_maddubs_epi16(bottomPair, hx), 16));
+        __m256i value = _mm256_srli_epi32(
+            _mm256_add_epi32(_mm256_madd_epi16(rowSums, vy), round), 2 * kFracBits);
+        value = _mm256_blendv_epi8(value, fill, noSource);
+        if (bytes == 1) {
+          __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(value),
+                                           _mm256_extracti128_si256(value, 1));
+          _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x),
+                           _mm_packus_epi16(words, words));
+        } else {
+          merged = _mm256_or_si256(merged, _mm256_slli_epi32(value, 8 * c));
+          mask = _mm256_or_si256(mask, _mm256_slli_epi32(lowByte, 8 * c));
+        }
+      }
+      if (bytes == 2) {
+        // Two output bytes per pixel: 16 bytes for the group
+        __m128i words = _mm_packus_epi32(
+            _mm256_castsi256_si128(_mm256_and_si256(merged, low16)),
+            _mm256_extracti128_si256(_mm256_and_si256(merged, low16), 1));
+        __m128i wordMask = _mm_packus_epi32(
+            _mm256_castsi256_si128(_mm256_and_si256(mask, low16)),
+            _mm256_extracti128_si256(_mm256_and_si256(mask, low16), 1));
+        __m128i* target = reinterpret_cast<__m128i*>(out + x * 2);
+        _mm_storeu_si128(target, _mm_blendv_epi8(_mm_loadu_si128(target), words,
+                                                 wordMask));
+      } else if (bytes == 4) {
+        __m256i* target = reinterpret_cast<__m256i*>(out + x * 4);
+        _mm256_storeu_si256(target, _mm256_blendv_epi8(_mm256_loadu_si256(target),
+                                                       merged, mask));
+      }
+    }
+    if (vectorWidth < width)
+      remapColumnsScalar(lut, src, srcStride, dst, dstStride, y, vectorWidth,
+                         width, layout);
+  }
+}
+#endif
+
+}  // namespace undistort
+
+// Remaps frames through cached tables, in row bands across worker threads.
+class Undistorter {
+ public:
+  // Tables are cached on disk in `cacheDir` when it is not empty.
+  // `threads` includes the calling thread.
+  Undistorter(const std::string& cacheDir, int threads)
+      : cacheDir_(cacheDir), threadCount_(std::max(threads, 1)) {
+#if UNDISTORT_X86
+    avx2_ = __builtin_cpu_supports("avx2");
+#endif
+    for (int i = 1; i < threadCount_; i++)
+      workers_.emplace_back(&Undistorter::run, this, i);
+  }
+
+  ~Undistorter() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& worker : workers_) worker.join();
+  }
+
+  Undistorter(const Undistorter&) = delete;
+  Undistorter& operator=(const Undistorter&) = delete;
+
+  // Returns the table for `lens` at width x height: from memory, from the
+  // disk cache, or freshly built (and then saved).
+  std::shared_ptr<const UndistortLut> lut(const LensCalibration& lens,
+                                          int width, int height) {
+    std::string key = undistort::lutKey(lens, width, height);
+    {
+      std::lock_guard<std::mutex> lock(cacheMutex_);
+      auto it = cache_.find(key);
+      if (it != cache_.end()) return it->second;
+    }
+    uint64_t hash = undistort::hashKey(key);
+    std::string path;
+    if (!cacheDir_.empty()) {
+      char name[64];
+      snprintf(name, sizeof(name), "/undistort-%016llx.lut",
+               (unsigned long long)hash);
+      path = cacheDir_ + name;
+    }
+    std::shared_ptr<UndistortLut> table;
+    if (!path.empty()) table = undistort::loadLut(path, hash, width, height);
+    if (!table) {
+      table = undistort::buildLut(lens, width, height);
+      if (!path.empty()) undistort::saveLut(path, hash, *table);
+    }
+    std::lock_guard<std::mutex> lock(cacheMutex_);
+    cache_[key] = table;
+    return table;
+  }
+
+  // Remaps one frame. Both frames are lut.width x lut.height, 4 bytes per
+  // pixel, and must not overlap.
+  void remap(const UndistortLut& lut, const uint8_t* src, int srcStride,
+             uint8_t* dst, int dstStride) {
+    remap(lut, src, srcStride, dst, dstStride, RemapLayout());
+  }
+
+  // Remaps the bytes `layout` selects in one plane of lut.width x lut.height
+  // pixels.
+  void remap(const UndistortLut& lut, const uint8_t* src, int srcStride,
+             uint8_t* dst, int dstStride, const RemapLayout& layout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    job_ = Job{&lut, src, srcStride, dst, dstStride, layout};
+    pendingBands_ = threadCount_ - 1;
+    generation_++;
+    lock.unlock();
+    wake_.notify_all();
+    runBand(0);
+    lock.lock();
+    done_.wait(lock, [this] { return pendingBands_ == 0; });
+  }
+
+  bool usesAvx2() const { return avx2_; }
+  // For benchmarks: compare the SIMD path against the scalar one
+  void setAvx2(bool enabled) { avx2_ = enabled && avx2Supported(); }
+  int threads() const { return threadCount_; }
+
+ private:
+  struct Job {
+    const UndistortLut* lut;
+    const uint8_t* src;
+    int srcStride;
+    uint8_t* dst;
+    int dstStride;
+    RemapLayout layout;
+  };
+
+  static bool avx2Supported() {
+#if UNDISTORT_X86
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+  }
+
+  void runBand(int band) {
+    const Job& job = job_;
+    const int height = job.lut->height;
+    const int first = height * band / threadCount_;
+    const int rows = height * (band + 1) / threadCount_ - first;
+#if UNDISTORT_X86
+    if (avx2_ && job.layout.pixelBytes == 4 && job.layout.channels == 4 &&
+        job.srcStride == job.lut->width * 4) {
+      undistort::remapRowsAvx2(*job.lut, job.src, job.srcStride, job.dst,
+                               job.dstStride, first, rows);
+      return;
+    }
+    if (avx2_ && undistort::channelKernelFits(job.layout) &&
+        job.lut->height >= 2) {
+      undistort::remapRowsAvx2Channels(*job.lut, job.src, job.srcStride,
+                                       job.dst, job.dstStride, first, rows,
+                                       job.layout);
+      return;
+    }
+#endif
+    undistort::remapRowsScalar(*job.lut, job.src, job.srcStride, job.dst,
+                               job.dstStride, first, rows, 0, job.layout);
+  }
+
+  void run(int band) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+      if (stopping_) return;
+      seen = generation_;
+      lock.unlock();
+      runBand(band);
+      lock.lock();
+      if (--pendingBands_ == 0) done_.notify_one();
+    }
+  }
+
+  std::string cacheDir_;
+  int threadCount_;
+  bool avx2_ = false;
+  std::mutex cacheMutex_;
+  std::map<std::string, std::shared_ptr<const UndistortLut>> cache_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  std::vector<std::thread> workers_;
+  Job job_ = {};
+  int pendingBands_ = 0;
+  uint64_t generation_ = 0;
+  bool stopping_ = false;
+};
+
+#endif  // UNDISTORT_H